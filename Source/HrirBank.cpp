@@ -0,0 +1,202 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "HrirBank.h"
+
+//==============================================================================
+HrirBank::HrirBank(const File &bankFile, const File &sourceDirectory, int length) {
+    this->bankFile = bankFile;
+    this->sourceDirectory = sourceDirectory;
+    this->length = length;
+    this->mapped = nullptr;
+    this->header = nullptr;
+    this->entries = nullptr;
+    this->data = nullptr;
+}
+
+HrirBank::~HrirBank() {
+    delete this->mapped;
+}
+
+bool HrirBank::open() {
+    if (this->mapped != nullptr) {
+        return true;
+    }
+
+    Array<File> files;
+    int64 stamp = this->getSourceStamp(files);
+    if (this->map(stamp)) {
+        return true;
+    }
+    return this->build(files, stamp) && this->map(stamp);
+}
+
+int64 HrirBank::getSourceStamp(Array<File> &files) const {
+    this->sourceDirectory.findChildFiles(files, File::findFiles, true, "*.wav");
+    if (files.isEmpty()) {
+        // Any bank will do without the WAV files.
+        return 0;
+    }
+
+    files.sort();
+    String list;
+    for (int i = 0; i < files.size(); i++) {
+        list << files[i].getRelativePathFrom(this->sourceDirectory) << ":" << files[i].getSize() << ":"
+             << files[i].getLastModificationTime().toMilliseconds() << "\n";
+    }
+    int64 stamp = list.hashCode64();
+    return stamp != 0 ? stamp : 1;
+}
+
+bool HrirBank::build(const Array<File> &files, int64 stamp) {
+    WavAudioFormat wavAudioFormat;
+    AudioSampleBuffer buffer(2, this->length);
+    Array<HrirBankEntry> index;
+    MemoryBlock impulses;
+
+    for (int i = 0; i < files.size(); i++) {
+        // Named as H<elevation>e<azimuth>a.wav.
+        String name = files[i].getFileNameWithoutExtension();
+        HrirBankEntry entry;
+        entry.elevation = name.fromFirstOccurrenceOf("H", false, false).upToFirstOccurrenceOf("e", false, false).getIntValue();
+        entry.azimuth = name.fromLastOccurrenceOf("e", false, false).getIntValue();
+
+        std::unique_ptr<AudioFormatReader> reader(wavAudioFormat.createReaderFor(files[i].createInputStream(), true));
+        if (reader == nullptr || reader->numChannels != 2) {
+            continue;
+        }
+        buffer.clear();
+        reader->read(&buffer, 0, (int)jmin((int64)this->length, reader->lengthInSamples), 0, true, true);
+        impulses.append(buffer.getReadPointer(0), sizeof(float) * this->length);
+        impulses.append(buffer.getReadPointer(1), sizeof(float) * this->length);
+        index.add(entry);
+    }
+    if (index.isEmpty()) {
+        return false;
+    }
+
+    HrirBankHeader header;
+    header.magic = HrirBankMagic;
+    header.version = HrirBankVersion;
+    header.count = (uint32)index.size();
+    header.length = (uint32)this->length;
+    header.sourceStamp = stamp;
+    header.dataOffset = sizeof(HrirBankHeader) + sizeof(HrirBankEntry) * index.size();
+    header.dataOffset = (header.dataOffset + HrirBankAlignment - 1) / HrirBankAlignment * HrirBankAlignment;
+
+    MemoryBlock block((size_t)header.dataOffset + impulses.getSize(), true);
+    block.copyFrom(&header, 0, sizeof(HrirBankHeader));
+    block.copyFrom(index.getRawDataPointer(), sizeof(HrirBankHeader), sizeof(HrirBankEntry) * index.size());
+    block.copyFrom(impulses.getData(), (int)header.dataOffset, impulses.getSize());
+
+    this->bankFile.getParentDirectory().createDirectory();
+    return this->bankFile.replaceWithData(block.getData(), block.getSize());
+}
+
+bool HrirBank::map(int64 stamp) {
+    if (! this->bankFile.existsAsFile()) {
+        return false;
+    }
+
+    MemoryMappedFile *file = new MemoryMappedFile(this->bankFile, MemoryMappedFile::readOnly);
+    const HrirBankHeader *head = (const HrirBankHeader *)file->getData();
+    if (head == nullptr || file->getSize() < sizeof(HrirBankHeader) ||
+        head->magic != HrirBankMagic || head->version != HrirBankVersion ||
+        head->length != (uint32)this->length || head->count == 0 ||
+        (stamp != 0 && head->sourceStamp != stamp) ||
+        head->dataOffset < sizeof(HrirBankHeader) + sizeof(HrirBankEntry) * (uint64)head->count ||
+        head->dataOffset % HrirBankAlignment != 0 ||
+        head->dataOffset + sizeof(float) * 2 * this->length * (uint64)head->count != file->getSize()) {
+        delete file;
+        return false;
+    }
+
+    this->mapped = file;
+    this->header = head;
+    this->entries = (const HrirBankEntry *)((const char *)file->getData() + sizeof(HrirBankHeader));
+    this->data = (const float *)((const char *)file->getData() + head->dataOffset);
+    return true;
+}
+
+bool HrirBank::getNearest(float azimuth, float elevation, float *left, float *right) const {
+    if (this->mapped == nullptr) {
+        return false;
+    }
+
+    float azi = fmodf(azimuth, 360.0f);
+    if (azi < 0.0f) {
+        azi += 360.0f;
+    }
+    bool swapEars = azi > 180.0f;
+    if (swapEars) {
+        azi = 360.0f - azi;
+    }
+
+    // Nearest measured elevation, ties go up.
+    int ele = this->entries[0].elevation;
+    for (uint32 i = 1; i < this->header->count; i++) {
+        float diff = fabsf(this->entries[i].elevation - elevation), nearestDiff = fabsf(ele - elevation);
+        if (diff < nearestDiff || (diff == nearestDiff && this->entries[i].elevation > ele)) {
+            ele = this->entries[i].elevation;
+        }
+    }
+
+    // Nearest azimuth on that ring. Ties go to the measurement further from
+    // the front on the swapped side.
+    int nearest = -1;
+    for (uint32 i = 0; i < this->header->count; i++) {
+        if (this->entries[i].elevation != ele) {
+            continue;
+        }
+        int fileAzi = this->entries[i].azimuth;
+        if (nearest < 0) {
+            nearest = (int)i;
+            continue;
+        }
+        int nearestAzi = this->entries[nearest].azimuth;
+        float diff = fabsf(fileAzi - azi), nearestDiff = fabsf(nearestAzi - azi);
+        if (diff < nearestDiff || (diff == nearestDiff && (swapEars ? fileAzi > nearestAzi : fileAzi < nearestAzi))) {
+            nearest = (int)i;
+        }
+    }
+
+    const float *impulses = this->data + (size_t)nearest * 2 * this->length;
+    memcpy(left, impulses + (swapEars ? this->length : 0), sizeof(float) * this->length);
+    memcpy(right, impulses + (swapEars ? 0 : this->length), sizeof(float) * this->length);
+    return true;
+}
+
+int HrirBank::getNumMeasurements() const {
+    return this->mapped == nullptr ? 0 : (int)this->header->count;
+}
+
+bool HrirBank::getMeasurement(int index, bool swapEars, float &azimuth, float &elevation,
+                              float *left, float *right) const {
+    if (this->mapped == nullptr || index < 0 || (uint32)index >= this->header->count) {
+        return false;
+    }
+
+    azimuth = (float)(swapEars ? 360 - this->entries[index].azimuth : this->entries[index].azimuth);
+    elevation = (float)this->entries[index].elevation;
+
+    const float *impulses = this->data + (size_t)index * 2 * this->length;
+    memcpy(left, impulses + (swapEars ? this->length : 0), sizeof(float) * this->length);
+    memcpy(right, impulses + (swapEars ? 0 : this->length), sizeof(float) * this->length);
+    return true;
+}
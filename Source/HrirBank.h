@@ -0,0 +1,89 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HRIRBANK_H
+#define HRIRBANK_H
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace std;
+
+// Packed bank of the head-related impulse responses of the BINAURAL mode.
+// The WAV files of the KEMAR set are converted once into a single file
+// holding a header, an index of the measured directions and the impulses
+// of both ears as aligned floats. The bank is memory-mapped when the
+// binaural mode first needs it, and converted again if the WAV files change.
+
+static const uint32 HrirBankMagic     = 0x52495248; // "HRIR"
+static const uint32 HrirBankVersion   = 1;          // Bump when the format changes.
+static const int    HrirBankAlignment = 64;
+
+struct HrirBankHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 count;           // Measured directions.
+    uint32 length;          // Samples per ear.
+    int64  sourceStamp;     // Hash of the names, sizes and dates of the WAV files.
+    uint64 dataOffset;      // Aligned start of the impulses, [direction][ear][length].
+};
+
+struct HrirBankEntry {
+    int32 elevation;        // Degrees.
+    int32 azimuth;          // Degrees, 0 to 180.
+};
+
+class HrirBank
+{
+public :
+    HrirBank(const File &bankFile, const File &sourceDirectory, int length);
+    ~HrirBank();
+
+    // Maps the bank, converting the WAV files first if needed. Returns
+    // false if there is no measurement to use.
+    bool open();
+
+    // Copies the impulses measured nearest to a direction (degrees). The
+    // set only covers one side, the other one swaps the ears.
+    bool getNearest(float azimuth, float elevation, float *left, float *right) const;
+
+    // Measured directions, for the ambisonic decoder of the HOA BINAURAL
+    // mode. getMeasurement() gives a direction (degrees) and its impulses,
+    // or with swapEars the mirrored direction on the other side.
+    int getNumMeasurements() const;
+    bool getMeasurement(int index, bool swapEars, float &azimuth, float &elevation,
+                        float *left, float *right) const;
+
+private :
+    int64 getSourceStamp(Array<File> &files) const;
+    bool build(const Array<File> &files, int64 stamp);
+    bool map(int64 stamp);
+
+    File bankFile;
+    File sourceDirectory;
+    int length;
+
+    MemoryMappedFile *mapped;
+    const HrirBankHeader *header;
+    const HrirBankEntry *entries;
+    const float *data;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HrirBank)
+};
+
+#endif /* HRIRBANK_H */
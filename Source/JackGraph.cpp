@@ -0,0 +1,217 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <string.h>
+
+#include "JackGraph.h"
+
+//==============================================================================
+JackGraph::JackGraph() {
+    this->nextOrder = 0;
+    this->generation = 0;
+}
+
+void JackGraph::scan(jack_client_t *client) {
+    // Built apart, the server is not queried while the notifications wait.
+    // A notification received meanwhile may be missing from the copy, the
+    // server is then scanned again.
+    for (;;) {
+        unsigned int generation;
+        {
+            lock_guard<mutex> guard(this->lock);
+            generation = this->generation;
+        }
+
+        JackGraph scanned;
+        const char **names = jack_get_ports(client, NULL, NULL, 0);
+        for (int i = 0; names != NULL && names[i]; i++) {
+            scanned.addPort(jack_port_by_name(client, names[i]));
+        }
+        if (names != NULL) {
+            jack_free(names);
+        }
+
+        // Connections are listed on both ends.
+        for (auto&& it : scanned.ports) {
+            const char **conns = jack_port_get_all_connections(client, it.first);
+            for (int c = 0; conns != NULL && conns[c]; c++) {
+                auto other = scanned.portsByName.find(String(conns[c]));
+                if (other != scanned.portsByName.end()) {
+                    it.second.connections.push_back(other->second);
+                }
+            }
+            if (conns != NULL) {
+                jack_free(conns);
+            }
+        }
+
+        lock_guard<mutex> guard(this->lock);
+        if (this->generation == generation) {
+            this->ports.swap(scanned.ports);
+            this->portsByName.swap(scanned.portsByName);
+            this->nextOrder = scanned.nextOrder;
+            return;
+        }
+    }
+}
+
+bool JackGraph::portRegistration(jack_client_t *client, jack_port_id_t id, bool regist) {
+    jack_port_t *port = jack_port_by_id(client, id);
+    if (port == nullptr) {
+        return false;
+    }
+
+    lock_guard<mutex> guard(this->lock);
+    this->generation++;
+    if (regist) {
+        if (this->ports.find(port) != this->ports.end()) {
+            return false;
+        }
+        this->addPort(port);
+    } else {
+        if (this->ports.find(port) == this->ports.end()) {
+            return false;
+        }
+        this->removePort(port);
+    }
+    return true;
+}
+
+bool JackGraph::portConnection(jack_client_t *client, jack_port_id_t a, jack_port_id_t b, bool connect) {
+    jack_port_t *portA = jack_port_by_id(client, a);
+    jack_port_t *portB = jack_port_by_id(client, b);
+
+    lock_guard<mutex> guard(this->lock);
+    this->generation++;
+    auto itA = this->ports.find(portA);
+    auto itB = this->ports.find(portB);
+    if (itA == this->ports.end() || itB == this->ports.end()) {
+        return false;
+    }
+
+    vector<jack_port_t *> &connsA = itA->second.connections;
+    vector<jack_port_t *> &connsB = itB->second.connections;
+    auto posA = find(connsA.begin(), connsA.end(), portB);
+    auto posB = find(connsB.begin(), connsB.end(), portA);
+    if (connect) {
+        if (posA != connsA.end()) {
+            return false;
+        }
+        connsA.push_back(portB);
+        connsB.push_back(portA);
+    } else {
+        if (posA == connsA.end()) {
+            return false;
+        }
+        connsA.erase(posA);
+        if (posB != connsB.end()) {
+            connsB.erase(posB);
+        }
+    }
+    return true;
+}
+
+bool JackGraph::clientRegistration(const String &name, bool regist) {
+    if (regist) {
+        return false; // Its ports are notified one by one.
+    }
+
+    // Drops what is left of a client that closed.
+    lock_guard<mutex> guard(this->lock);
+    this->generation++;
+    vector<jack_port_t *> gone;
+    for (auto&& it : this->ports) {
+        if (it.second.client == name) {
+            gone.push_back(it.first);
+        }
+    }
+    for (auto&& port : gone) {
+        this->removePort(port);
+    }
+    return !gone.empty();
+}
+
+String JackGraph::getClientName(jack_port_t *port) const {
+    lock_guard<mutex> guard(this->lock);
+    auto it = this->ports.find(port);
+    return it != this->ports.end() ? it->second.client : String();
+}
+
+StringArray JackGraph::getPorts(const String &client, bool isInput) const {
+    vector<const JackGraphPort *> found;
+    StringArray names;
+
+    lock_guard<mutex> guard(this->lock);
+    for (auto&& it : this->ports) {
+        if (it.second.isAudio && it.second.isInput == isInput && it.second.client == client) {
+            found.push_back(&it.second);
+        }
+    }
+    sort(found.begin(), found.end(), [](const JackGraphPort *a, const JackGraphPort *b) { return a->order < b->order; });
+    for (auto&& port : found) {
+        names.add(port->name);
+    }
+    return names;
+}
+
+vector<pair<String, String>> JackGraph::getConnections(const String &from, const String &to) const {
+    vector<pair<String, String>> conns;
+
+    lock_guard<mutex> guard(this->lock);
+    for (auto&& it : this->ports) {
+        if (!it.second.isAudio || it.second.isInput || it.second.client != from) {
+            continue;
+        }
+        for (auto&& other : it.second.connections) {
+            auto dest = this->ports.find(other);
+            if (dest != this->ports.end() && dest->second.isInput && dest->second.client == to) {
+                conns.push_back(make_pair(it.second.name, dest->second.name));
+            }
+        }
+    }
+    return conns;
+}
+
+void JackGraph::addPort(jack_port_t *port) {
+    if (port == nullptr) {
+        return;
+    }
+    JackGraphPort entry;
+    entry.name = jack_port_name(port);
+    entry.client = entry.name.upToFirstOccurrenceOf(":", false, false);
+    entry.isInput = (jack_port_flags(port) & JackPortIsInput) != 0;
+    entry.isAudio = strcmp(jack_port_type(port), JACK_DEFAULT_AUDIO_TYPE) == 0;
+    entry.order = this->nextOrder++;
+    this->portsByName[entry.name] = port;
+    this->ports[port] = entry;
+}
+
+void JackGraph::removePort(jack_port_t *port) {
+    auto it = this->ports.find(port);
+    for (auto&& other : it->second.connections) {
+        auto peer = this->ports.find(other);
+        if (peer != this->ports.end()) {
+            vector<jack_port_t *> &conns = peer->second.connections;
+            conns.erase(remove(conns.begin(), conns.end(), port), conns.end());
+        }
+    }
+    this->portsByName.erase(it->second.name);
+    this->ports.erase(it);
+}
@@ -0,0 +1,85 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JACKGRAPH_H
+#define JACKGRAPH_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include <jack/jack.h>
+
+using namespace std;
+
+// In-memory copy of the JACK graph: the ports of every client and their
+// connections. It is filled once when the client is activated and kept up
+// to date from the registration and connection notifications, so that the
+// client management never has to query the server port by port. Ports are
+// identified by their jack_port_t, which stays the same for the life of a
+// port whether it is looked up by id or by name.
+
+struct JackGraphPort {
+    String       name;          // Full name, "client:port".
+    String       client;
+    bool         isInput;
+    bool         isAudio;
+    unsigned int order;         // Registration order, the one of jack_get_ports().
+    vector<jack_port_t *> connections;
+};
+
+class JackGraph
+{
+public :
+    JackGraph();
+
+    // Indexes every port of the server and its connections.
+    void scan(jack_client_t *client);
+
+    // Notifications, called from the JACK notification thread. Return
+    // true if the index changed.
+    bool portRegistration(jack_client_t *client, jack_port_id_t id, bool regist);
+    bool portConnection(jack_client_t *client, jack_port_id_t a, jack_port_id_t b, bool connect);
+    bool clientRegistration(const String &name, bool regist);
+
+    String getClientName(jack_port_t *port) const;
+
+    // Full names of the audio ports of a client, in registration order.
+    StringArray getPorts(const String &client, bool isInput) const;
+
+    // Audio connections from the outputs of `from` to the inputs of `to`,
+    // as pairs of full names (output, input).
+    vector<pair<String, String>> getConnections(const String &from, const String &to) const;
+
+private :
+    void addPort(jack_port_t *port);
+    void removePort(jack_port_t *port);
+
+    mutable mutex lock;
+    map<jack_port_t *, JackGraphPort> ports;
+    map<String, jack_port_t *> portsByName;
+    unsigned int nextOrder;
+    unsigned int generation;        // Notifications received, checked by scan().
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (JackGraph)
+};
+
+#endif /* JACKGRAPH_H */
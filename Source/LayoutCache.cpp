@@ -0,0 +1,104 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LayoutCache.h"
+
+//==============================================================================
+LayoutCache::LayoutCache(const File &directory) {
+    this->directory = directory;
+}
+
+String LayoutCache::makeKey(Kind kind, const MemoryBlock &geometry) {
+    MemoryBlock block;
+    uint32 prefix[2] = { LayoutCacheVersion, (uint32)kind };
+    block.append(prefix, sizeof(prefix));
+    block.append(geometry.getData(), geometry.getSize());
+    return SHA256(block.getData(), block.getSize()).toHexString().substring(0, 32);
+}
+
+File LayoutCache::getFile(const String &key) const {
+    return this->directory.getChildFile(key + ".layout");
+}
+
+bool LayoutCache::load(const String &key, Kind kind, function<bool (const void *, size_t)> parse) {
+    File file = this->getFile(key);
+    if (! file.existsAsFile()) {
+        return false;
+    }
+
+    bool ok = false;
+    {
+        MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
+        const LayoutCacheHeader *header = (const LayoutCacheHeader *)mapped.getData();
+        if (header != nullptr && mapped.getSize() >= sizeof(LayoutCacheHeader) &&
+            header->magic == LayoutCacheMagic && header->version == LayoutCacheVersion &&
+            header->kind == (uint32)kind && header->headerSize == sizeof(LayoutCacheHeader) &&
+            header->payloadSize == mapped.getSize() - sizeof(LayoutCacheHeader)) {
+            ok = parse((const char *)mapped.getData() + sizeof(LayoutCacheHeader),
+                       (size_t)header->payloadSize);
+        }
+    }
+
+    if (ok) {
+        // Marks the entry as recently used.
+        file.setLastModificationTime(Time::getCurrentTime());
+    } else {
+        file.deleteFile();
+    }
+    return ok;
+}
+
+void LayoutCache::store(const String &key, Kind kind, const MemoryBlock &payload) {
+    if (! this->directory.createDirectory()) {
+        return;
+    }
+
+    LayoutCacheHeader header;
+    header.magic = LayoutCacheMagic;
+    header.version = LayoutCacheVersion;
+    header.kind = (uint32)kind;
+    header.headerSize = sizeof(LayoutCacheHeader);
+    header.payloadSize = payload.getSize();
+
+    MemoryBlock block(&header, sizeof(header));
+    block.append(payload.getData(), payload.getSize());
+    if (this->getFile(key).replaceWithData(block.getData(), block.getSize())) {
+        this->prune();
+    }
+}
+
+void LayoutCache::prune() {
+    Array<File> files;
+    this->directory.findChildFiles(files, File::findFiles, false, "*.layout");
+    if (files.size() <= LayoutCacheMaxFiles) {
+        return;
+    }
+
+    // Most recently used first.
+    struct Comparator {
+        int compareElements(const File &a, const File &b) const {
+            Time ta = a.getLastModificationTime(), tb = b.getLastModificationTime();
+            return ta > tb ? -1 : (ta < tb ? 1 : 0);
+        }
+    } comparator;
+    files.sort(comparator);
+    for (int i = LayoutCacheMaxFiles; i < files.size(); i++) {
+        files[i].deleteFile();
+    }
+}
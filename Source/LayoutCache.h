@@ -0,0 +1,78 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LAYOUTCACHE_H
+#define LAYOUTCACHE_H
+
+#include <functional>
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace std;
+
+// On-disk cache of compiled speaker layouts (VBAP sets, inverse matrices and
+// lookup grid, LBAP field matrices). An entry is a file named after a hash of
+// the geometry the layout was computed from, holding a small header followed
+// by the payload serialized by vbap.c or lbap.c. Files are memory-mapped when
+// read; the least recently used ones are removed past LayoutCacheMaxFiles.
+
+static const uint32 LayoutCacheMagic    = 0x4c475253; // "SRGL"
+static const uint32 LayoutCacheVersion  = 2;          // Bump when a payload format changes.
+static const int    LayoutCacheMaxFiles = 32;
+
+struct LayoutCacheHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 kind;
+    uint32 headerSize;
+    uint64 payloadSize;
+};
+
+class LayoutCache
+{
+public :
+    enum Kind {
+        VbapLayout = 1,
+        LbapField  = 2
+    };
+
+    LayoutCache(const File &directory);
+
+    // Key of the layout computed from `geometry` (every value the
+    // computation depends on) for the given kind.
+    static String makeKey(Kind kind, const MemoryBlock &geometry);
+
+    // Gives the payload of the entry to `parse`, which must copy what it
+    // keeps: the mapping is released on return. Returns false if there is
+    // no valid entry or if `parse` fails.
+    bool load(const String &key, Kind kind, function<bool (const void *, size_t)> parse);
+
+    // Writes a new entry, replacing the file atomically.
+    void store(const String &key, Kind kind, const MemoryBlock &payload);
+
+private :
+    File getFile(const String &key) const;
+    void prune();
+
+    File directory;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LayoutCache)
+};
+
+#endif /* LAYOUTCACHE_H */
@@ -19,6 +19,14 @@
 
 #include "MainComponent.h"
 
+// Render targets of the monitor choices, in the order of MonitorModeString.
+static const int MonitorModes[] = {MonitorOff, STEREO, HOA_BINAURAL};
+
+// Settings key of a monitor's mix, the first one keeps its former key.
+static String getMonitorModeKey(unsigned int monitor) {
+    return monitor == 0 ? String("MonitorMode") : "MonitorMode" + String(monitor + 1);
+}
+
 // Audio recorder class used to write an interleaved multi-channel soundfile on disk.
 class AudioRenderer : public ThreadWithProgressWindow
 {
@@ -179,6 +187,11 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
         this->pathLastVbapSpeakerSetup = props->getValue("lastVbapSpeakerSetup");
     }
 
+    // Virtual speakers of the BINAURAL mode.
+    int binauralSpeakers = props->getIntValue("BinauralSpeakers", 0);
+    if (binauralSpeakers < 0 || binauralSpeakers >= BinauralSpeakerSetupFilePaths.size()) { binauralSpeakers = 0; }
+    this->pathBinauralSpeakerSetup = BinauralSpeakerSetupFilePaths[binauralSpeakers];
+
     this->listSpeaker = vector<Speaker *>();
     this->listSourceInput = vector<Input *>();
     
@@ -243,6 +256,15 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
         this->comBoxModeSpat->addItem(ModeSpatString[i], i+1);
     }
 
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        String tooltip = "Mix rendered on the outputs of monitor " + String(m + 1);
+        addLabel("Monitor " + String(m + 1) + " :", tooltip, 90 + m * 160, 112, 70, 22, this->boxControlUI->getContent());
+        this->comBoxMonitor[m] = addComboBox("", tooltip, 155 + m * 160, 112, 90, 22, this->boxControlUI->getContent());
+        for (int i = 0; i < MonitorModeString.size(); i++) {
+            this->comBoxMonitor[m]->addItem(MonitorModeString[i], i+1);
+        }
+    }
+
     this->tedAddInputs = addTextEditor("Inputs :", "0", "Numbers of Inputs", 122, 83, 43, 22, this->boxControlUI->getContent());
     this->tedAddInputs->setInputRestrictions(3, "0123456789");
 
@@ -255,6 +277,7 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
 
     // Jack client box.
     this->boxClientJack = new BoxClient(this, &mGrisFeel);
+    this->clientsVersionShown = 0;
     this->boxClientJack->setBounds(410, 0, 304, 138);
     this->boxControlUI->getContent()->addAndMakeVisible(this->boxClientJack);
     
@@ -293,6 +316,8 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
                                          msg + String("\nYou should check for any mismatch between the server and your device\n(Sampling Rate, Input/Ouput Channels, etc.)"));
     }
     this->jackClient = new jackClientGris();
+    this->jackClient->setLayoutCacheDirectory(props->getFile().getSiblingFile("LayoutCache"));
+    this->jackClient->setHrirBankFile(props->getFile().getSiblingFile("hrtf_compact.hrir"));
 
     alsaAvailableOutputDevices = this->jackServer->getAvailableOutputDevices();
 
@@ -300,6 +325,24 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
     this->jackClient->setRecordFormat(fileformat);
     unsigned int fileconfig = props->getIntValue("FileConfig", 0);
     this->jackClient->setRecordFileConfig(fileconfig);
+    this->lockInputs->lock();
+    this->jackClient->setDeadReckoning(props->getIntValue("DeadReckoning", 0) == 1);
+    this->lockInputs->unlock();
+    int crossfade = props->getIntValue("Crossfade", 2);
+    if (crossfade < 0 || crossfade >= CrossfadeTimes.size()) { crossfade = 2; }
+    this->jackClient->setCrossfadeTime(CrossfadeTimes[crossfade].getIntValue() * 0.001f);
+    int spreadDirs = props->getIntValue("SpreadDirections", 1);
+    if (spreadDirs < 0 || spreadDirs >= VbapSpreadDirections.size()) { spreadDirs = 1; }
+    this->jackClient->setVbapSpreadDirs(VbapSpreadDirections[spreadDirs].getIntValue());
+    int lbapResolution = props->getIntValue("LbapResolution", 1);
+    if (lbapResolution < 0 || lbapResolution >= LbapResolutions.size()) { lbapResolution = 1; }
+    this->jackClient->setLbapResolution(LbapResolutions[lbapResolution].getIntValue());
+    this->jackClient->setLbapHugePages(props->getIntValue("HugePages", 0) == 1);
+
+    // Real-time profile, before the speaker setup allocates its buffers.
+    int prefault = props->getIntValue("Prefault", 0);
+    if (prefault < 0 || prefault >= PrefaultSizes.size()) { prefault = 0; }
+    this->applyRealtimeProfile(props->getIntValue("LockMemory", 0), prefault, props->getValue("AudioCores", ""));
 
     if (!jackClient->isReady()) {
         this->labelJackStatus->setText("Jack ERROR", dontSendNotification);
@@ -312,14 +355,28 @@ MainContentComponent::MainContentComponent(DocumentWindow *parent)
     this->labelJackInfo->setText("I : " + String(this->jackClient->numberOutputs) +
                                  " - O : " + String(this->jackClient->numberInputs), dontSendNotification);
 
+    // Server-side trajectories, driven by OSC.
+    this->trajectoryEngine = new TrajectoryEngine(this);
+
     //Start the OSC Receiver.
     this->oscReceiver = new OscInput(this);
+    this->oscReceiver->setReceiverOptions(props->getIntValue("OscReceiveBufferSize", 4194304),
+                                          props->getIntValue("OscReceiveSockets", 1));
     this->oscReceiver->startConnection(this->oscInputPort);
 
+    // Start the shared-memory control channel for local clients.
+    this->shmControl = new ShmControlInput(this);
+    this->shmControl->open();
+
     // Default widget values.
     this->sliderMasterGainOut->setValue(0.0);
     this->sliderInterpolation->setValue(0.1);
     this->comBoxModeSpat->setSelectedId(1);
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        int monitorMode = props->getIntValue(getMonitorModeKey(m), 0);
+        if (monitorMode < 0 || monitorMode >= MonitorModeString.size()) { monitorMode = 0; }
+        this->comBoxMonitor[m]->setSelectedId(monitorMode + 1);
+    }
 
     this->tedAddInputs->setText("16", dontSendNotification);
     textEditorReturnKeyPressed(*this->tedAddInputs);
@@ -368,10 +425,15 @@ MainContentComponent::~MainContentComponent() {
     props->setValue("lastOpenSpeakerSetup", this->pathCurrentFileSpeaker);
     props->setValue("lastVbapSpeakerSetup", this->pathLastVbapSpeakerSetup);
     props->setValue("sashPosition", this->verticalLayout.getItemCurrentRelativeSize(0));
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        props->setValue(getMonitorModeKey(m), this->comBoxMonitor[m]->getSelectedId() - 1);
+    }
     this->applicationProperties.saveIfNeeded();
     this->applicationProperties.closeFiles();
 
+    delete this->shmControl;
     delete this->oscReceiver;
+    delete this->trajectoryEngine;
     
     if (this->winSpeakConfig != nullptr) {
         delete this->winSpeakConfig;
@@ -656,6 +718,15 @@ void MainContentComponent::handleShowPreferences() {
         unsigned int AttenuationDB = props->getIntValue("AttenuationDB", 3);
         unsigned int AttenuationHz = props->getIntValue("AttenuationHz", 3);
         unsigned int OscInputPort = props->getIntValue("OscInputPort", 18032);
+        unsigned int DeadReckoning = props->getIntValue("DeadReckoning", 0);
+        unsigned int Crossfade = props->getIntValue("Crossfade", 2);
+        unsigned int SpreadDirections = props->getIntValue("SpreadDirections", 1);
+        unsigned int LbapResolution = props->getIntValue("LbapResolution", 1);
+        unsigned int BinauralSpeakers = props->getIntValue("BinauralSpeakers", 0);
+        unsigned int LockMemory = props->getIntValue("LockMemory", 0);
+        unsigned int Prefault = props->getIntValue("Prefault", 0);
+        String AudioCores = props->getValue("AudioCores", "");
+        unsigned int HugePages = props->getIntValue("HugePages", 0);
         if (std::isnan(float(BufferValue)) || BufferValue == 0) { BufferValue = 1024; }
         if (std::isnan(float(RateValue)) || RateValue == 0) { RateValue = 48000; }
         if (std::isnan(float(FileFormat))) { FileFormat = 0; }
@@ -663,16 +734,23 @@ void MainContentComponent::handleShowPreferences() {
         if (std::isnan(float(AttenuationDB))) { AttenuationDB = 3; }
         if (std::isnan(float(AttenuationHz))) { AttenuationHz = 3; }
         if (std::isnan(float(OscInputPort))) { OscInputPort = 18032; }
+        if (Crossfade >= (unsigned int)CrossfadeTimes.size()) { Crossfade = 2; }
+        if (SpreadDirections >= (unsigned int)VbapSpreadDirections.size()) { SpreadDirections = 1; }
+        if (LbapResolution >= (unsigned int)LbapResolutions.size()) { LbapResolution = 1; }
+        if (BinauralSpeakers >= (unsigned int)BinauralSpeakerSetupFilePaths.size()) { BinauralSpeakers = 0; }
+        if (Prefault >= (unsigned int)PrefaultSizes.size()) { Prefault = 0; }
         this->windowProperties = new WindowProperties("Preferences", this->mGrisFeel.getWinBackgroundColour(),
                                                      DocumentWindow::allButtons, this, &this->mGrisFeel, 
                                                      alsaAvailableOutputDevices, alsaOutputDevice,
                                                      RateValues.indexOf(String(RateValue)), 
                                                      BufferSizes.indexOf(String(BufferValue)),
-                                                     FileFormat, FileConfig, AttenuationDB, AttenuationHz, OscInputPort);
+                                                     FileFormat, FileConfig, AttenuationDB, AttenuationHz, OscInputPort,
+                                                     DeadReckoning, Crossfade, SpreadDirections, LbapResolution, BinauralSpeakers,
+                                                     LockMemory, Prefault, AudioCores, HugePages);
     }
-    int height = 450;
+    int height = 860;
     if (alsaAvailableOutputDevices.isEmpty()) {
-        height = 420;
+        height = 830;
     }
     juce::Rectangle<int> result (this->getScreenX()+ (this->speakerView->getWidth()/2)-150, this->getScreenY()+(this->speakerView->getHeight()/2)-75, 270, height);
     this->windowProperties->setBounds(result);
@@ -1246,9 +1324,8 @@ void MainContentComponent::addSpeaker(int sortColumnId, bool isSortedForwards) {
     }
     this->lockSpeakers->unlock();
 
-    this->jackClient->processBlockOn = false;
     this->jackClient->addOutput(this->listSpeaker.back()->getOutputPatch());
-    this->jackClient->processBlockOn = true;
+    this->jackClient->connectedGristoSystem();
 }
 
 void MainContentComponent::insertSpeaker(int position, int sortColumnId, bool isSortedForwards) {
@@ -1277,16 +1354,14 @@ void MainContentComponent::insertSpeaker(int position, int sortColumnId, bool is
     }
     this->lockSpeakers->unlock();
 
-    this->jackClient->processBlockOn = false;
-    this->jackClient->clearOutput();
+    this->jackClient->maxOutputPatch = 0;
     for (auto&& it : this->listSpeaker) {
         this->jackClient->addOutput(it->getOutputPatch());
     }
-    this->jackClient->processBlockOn = true;
+    this->jackClient->connectedGristoSystem();
 }
 
 void MainContentComponent::removeSpeaker(int idSpeaker) {
-    this->jackClient->removeOutput(idSpeaker);
     this->lockSpeakers->lock();
     int index = 0;
     for (auto&& it : this->listSpeaker) {
@@ -1299,8 +1374,19 @@ void MainContentComponent::removeSpeaker(int idSpeaker) {
     this->lockSpeakers->unlock();
 }
 
+void MainContentComponent::updateSourcePosition(unsigned int idS, float azi, float ele, float azispan,
+                                                float elespan, float rad, float gain) {
+    if (this->listSourceInput.size() > idS) {
+        this->listSourceInput[idS]->updateValues(azi, ele, azispan, elespan,
+                                                 this->isRadiusNormalized() ? 1.0 : rad,
+                                                 gain, this->getModeSelected());
+        this->updateInputJack(idS, *this->listSourceInput[idS]);
+    }
+}
+
 bool MainContentComponent::isRadiusNormalized() {
-    if (this->jackClient->modeSelected == VBAP || this->jackClient->modeSelected == VBAP_HRTF)
+    if (this->jackClient->modeSelected == VBAP || this->jackClient->modeSelected == VBAP_HRTF ||
+        this->jackClient->modeSelected == HOA_BINAURAL)
         return true;
     else
         return false;
@@ -1309,22 +1395,24 @@ bool MainContentComponent::isRadiusNormalized() {
 void MainContentComponent::updateInputJack(int inInput, Input &inp) {
     SourceIn *si = &this->jackClient->listSourceIn[inInput];
 
-    if (this->jackClient->modeSelected == LBAP) {
-        si->radazi = inp.getAziMuth();
-        si->radele = M_PI2 - inp.getZenith();
-    } else {
-        si->azimuth = ((inp.getAziMuth() / M2_PI) * 360.0f);
-        if (si->azimuth > 180.0f) {
-            si->azimuth = si->azimuth - 360.0f;
-        }
-        si->zenith  = 90.0f - (inp.getZenith() / M2_PI) * 360.0f;
+    // Both forms are kept, the monitor mix may not render in the selected mode.
+    si->radazi = inp.getAziMuth();
+    si->radele = M_PI2 - inp.getZenith();
+    si->azimuth = ((inp.getAziMuth() / M2_PI) * 360.0f);
+    if (si->azimuth > 180.0f) {
+        si->azimuth = si->azimuth - 360.0f;
     }
+    si->zenith  = 90.0f - (inp.getZenith() / M2_PI) * 360.0f;
     si->radius  = inp.getRadius();
     
     si->aziSpan = inp.getAziMuthSpan() * 0.5f;
     si->zenSpan = inp.getZenithSpan() * 2.0f;
     
-    if (this->jackClient->modeSelected == VBAP || this->jackClient->modeSelected == VBAP_HRTF) {
+    if (this->jackClient->deadReckoning) {
+        this->jackClient->setSourceMotion(inInput, si->radazi, si->radele);
+    }
+
+    if (this->jackClient->modeSelected != LBAP || this->jackClient->isMonitorMode(HOA_BINAURAL)) {
         this->jackClient->vbapSourcesToUpdate[inInput] = 1;
     }
 }
@@ -1381,6 +1469,104 @@ static void Linkwitz_Riley_compute_variables(double freq, double sr, double **co
     (*coeffs)[4] = ha0; (*coeffs)[5] = ha1; (*coeffs)[6] = ha2; 
 }
 
+void MainContentComponent::updateSpeakerGainAndFilter(Speaker *speaker) {
+    if (speaker->outputPatch < 1 || speaker->outputPatch > (int)MaxOutputs) {
+        return;
+    }
+    SpeakerOut &so = this->jackClient->listSpeakerOut[speaker->outputPatch-1];
+    so.gain = pow(10.0, speaker->getGain() * 0.05);
+    if (speaker->getHighPassCutoff() > 0.0f) {
+        double *coeffs;
+        Linkwitz_Riley_compute_variables((double)speaker->getHighPassCutoff(), (double)this->samplingRate, &coeffs, 7);
+        so.b1 = coeffs[0];
+        so.b2 = coeffs[1];
+        so.b3 = coeffs[2];
+        so.b4 = coeffs[3];
+        so.ha0 = coeffs[4];
+        so.ha1 = coeffs[5];
+        so.ha2 = coeffs[6];
+        so.hpActive = true;
+        free(coeffs);
+    } else {
+        so.hpActive = false;
+    }
+    this->jackClient->applySpeakerOut(speaker->outputPatch-1);
+}
+
+bool MainContentComponent::updateSpeakerLayout() {
+    unsigned int dimensions = 2;
+    ModeSpatEnum mode = this->jackClient->modeSelected;
+
+    if (this->listSpeaker.size() == 0 || this->listSpeaker.size() >= MaxOutputs ||
+        (mode != VBAP && mode != VBAP_HRTF && mode != LBAP)) {
+        return false;
+    }
+
+    // Only positions, gains and filters may differ from the setup in use.
+    float zenith = -1.0f;
+    for (unsigned int i = 0; i < this->listSpeaker.size(); i++) {
+        Speaker *it = this->listSpeaker[i];
+        const SpeakerOut &so = this->jackClient->listSpeakerOut[i];
+        if (so.outputPatch != it->getOutputPatch() || so.directOut != it->getDirectOut()) {
+            return false;
+        }
+        if (it->getDirectOut()) {
+            continue;
+        }
+        if (zenith == -1.0f) {
+            zenith = it->getAziZenRad().y;
+        } else if (it->getAziZenRad().y < (zenith - 4.9) || it->getAziZenRad().y > (zenith + 4.9)) {
+            dimensions = 3;
+        }
+    }
+    if (this->jackClient->listSpeakerOut[this->listSpeaker.size()].outputPatch != 0) {
+        return false;
+    }
+    if (mode != LBAP && dimensions != this->jackClient->vbapDimensions) {
+        return false;
+    }
+
+    bool moved = false;
+    vector<Speaker *> tempListSpeaker;
+    for (unsigned int i = 0; i < this->listSpeaker.size(); i++) {
+        Speaker *it = this->listSpeaker[i];
+        SpeakerOut &so = this->jackClient->listSpeakerOut[i];
+        if (mode == VBAP || mode == VBAP_HRTF) {
+            it->normalizeRadius();
+        }
+        if (so.x != it->getCoordinate().x || so.y != it->getCoordinate().y || so.z != it->getCoordinate().z ||
+            so.azimuth != it->getAziZenRad().x || so.zenith != it->getAziZenRad().y || so.radius != it->getAziZenRad().z) {
+            so.x = it->getCoordinate().x;
+            so.y = it->getCoordinate().y;
+            so.z = it->getCoordinate().z;
+            so.azimuth = it->getAziZenRad().x;
+            so.zenith  = it->getAziZenRad().y;
+            so.radius  = it->getAziZenRad().z;
+            moved = moved || ! it->getDirectOut();
+        }
+        this->updateSpeakerGainAndFilter(it);
+        if (! it->getDirectOut()) {
+            tempListSpeaker.push_back(it);
+        }
+    }
+
+    if (moved) {
+        if (mode == LBAP) {
+            this->jackClient->updateLbapLayout(tempListSpeaker);
+        } else if (this->jackClient->updateVbapLayout(tempListSpeaker, dimensions)) {
+            this->setListTripletFromVbap();
+            if (mode == VBAP_HRTF) {
+                this->jackClient->setupBinauralSpeakers(tempListSpeaker);
+            }
+        } else {
+            return false;
+        }
+    }
+    this->needToComputeVbap = false;
+
+    return true;
+}
+
 bool MainContentComponent::updateLevelComp() {
     unsigned int dimensions = 2, directOutSpeakers = 0;
 
@@ -1444,23 +1630,20 @@ bool MainContentComponent::updateLevelComp() {
         }
     }
 
-    this->jackClient->processBlockOn = false;
+    // The new setup is built aside, the current one is heard until it is published.
+    this->jackClient->beginRenderPlan(this->jackClient->modeSelected);
     this->jackClient->maxOutputPatch = 0;
 
-    // Save mute/solo/directout states
-    bool inputsIsMuted[MaxInputs];
-    bool inputsIsSolo[MaxInputs];
-    bool soloIn = this->jackClient->soloIn;
+    // Save directout states
     int directOuts[MaxInputs];
-    for (unsigned int i = 0; i < MaxInputs; i++) {
-        inputsIsMuted[i] = (&this->jackClient->listSourceIn[i])->isMuted;
-        inputsIsSolo[i] = (&this->jackClient->listSourceIn[i])->isSolo;
-        directOuts[i] = (&this->jackClient->listSourceIn[i])->directOut;
+    this->lockInputs->lock();
+    for (unsigned int i = 0; i < this->listSourceInput.size(); i++) {
+        directOuts[i] = this->listSourceInput[i]->getDirectOutChannel();
     }
+    this->lockInputs->unlock();
 
     bool outputsIsMuted[MaxInputs];
     bool outputsIsSolo[MaxInputs];
-    bool soloOut = this->jackClient->soloOut;
     for (unsigned int i = 0; i < MaxOutputs; i++) {
         outputsIsMuted[i] = (&this->jackClient->listSpeakerOut[i])->isMuted;
         outputsIsSolo[i] = (&this->jackClient->listSpeakerOut[i])->isSolo;
@@ -1505,20 +1688,7 @@ bool MainContentComponent::updateLevelComp() {
 
     // Set user gain and highpass filter cutoff frequency for each speaker.
     for (auto&& it : this->listSpeaker) {
-        this->jackClient->listSpeakerOut[it->outputPatch-1].gain = pow(10.0, it->getGain() * 0.05);
-        if (it->getHighPassCutoff() > 0.0f) {
-            double *coeffs;
-            Linkwitz_Riley_compute_variables((double)it->getHighPassCutoff(), (double)this->samplingRate, &coeffs, 7);
-            this->jackClient->listSpeakerOut[it->outputPatch-1].b1 = coeffs[0];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].b2 = coeffs[1];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].b3 = coeffs[2];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].b4 = coeffs[3];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].ha0 = coeffs[4];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].ha1 = coeffs[5];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].ha2 = coeffs[6];
-            this->jackClient->listSpeakerOut[it->outputPatch-1].hpActive = true;
-            free(coeffs);
-        }
+        this->updateSpeakerGainAndFilter(it);
     }
     
     i = 0;
@@ -1534,15 +1704,10 @@ bool MainContentComponent::updateLevelComp() {
         
         x += VuMeterWidthInPixels;
 
-        SourceIn si;
-        si.id = it->getId();
-        si.radazi = it->getAziMuth();
-        si.radele = M_PI2 - it->getZenith();
-        si.azimuth = it->getAziMuth();
-        si.zenith  = it->getZenith();
-        si.radius  = it->getRadius();
-        si.gain = 0.0f;
-        this->jackClient->listSourceIn[i++] = si;
+        // The audio thread keeps reading the sources, only their positions change.
+        this->jackClient->listSourceIn[i].id = it->getId();
+        // Positions of every render target, the monitor may not use the mode's.
+        this->updateInputJack(i++, *it);
     }
 
     this->lockInputs->unlock();
@@ -1576,7 +1741,11 @@ bool MainContentComponent::updateLevelComp() {
         if (retval) {
             this->setListTripletFromVbap();
             this->needToComputeVbap = false;
+            if (this->jackClient->modeSelected == VBAP_HRTF) {
+                this->jackClient->setupBinauralSpeakers(tempListSpeaker);
+            }
         } else {
+            this->jackClient->discardRenderPlan();
             AlertWindow alert ("Not a valid DOME 3-D configuration!    ",
                                "Maybe you want to open it in CUBE mode? Reload the default speaker setup...    ",
                                AlertWindow::WarningIcon);
@@ -1589,28 +1758,25 @@ bool MainContentComponent::updateLevelComp() {
     } else if (this->jackClient->modeSelected == LBAP) {
         this->setShowTriplets(false);
         retval = this->jackClient->lbapSetupSpeakerField(tempListSpeaker);
+    } else if (this->jackClient->modeSelected == HOA_BINAURAL) {
+        this->setShowTriplets(false);
+        retval = this->jackClient->setupHoaBinaural();
     }
 
     // Restore mute/solo/directout states
-    this->jackClient->soloIn = soloIn;
-    for (unsigned int i = 0; i < MaxInputs; i++) {
-        (&this->jackClient->listSourceIn[i])->isMuted = inputsIsMuted[i];
-        (&this->jackClient->listSourceIn[i])->isSolo = inputsIsSolo[i];
-        (&this->jackClient->listSourceIn[i])->directOut = directOuts[i];
-    }
     this->lockInputs->lock();
     for (unsigned int i = 0; i < this->listSourceInput.size(); i++) {
         this->listSourceInput[i]->setDirectOutChannel(directOuts[i]);
     }
     this->lockInputs->unlock();
 
-    this->jackClient->soloOut = soloOut;
     for (unsigned int i = 0; i < MaxOutputs; i++) {
         (&this->jackClient->listSpeakerOut[i])->isMuted = outputsIsMuted[i];
         (&this->jackClient->listSpeakerOut[i])->isSolo = outputsIsSolo[i];
     }
 
-    this->jackClient->processBlockOn = true;
+    // Crossfades from the setup in use.
+    this->jackClient->publishRenderPlan();
 
     return retval;
 }
@@ -1621,38 +1787,25 @@ void MainContentComponent::setNameConfig() {
 }
 
 void MainContentComponent::muteInput(int id, bool mute) {
-    (&this->jackClient->listSourceIn[id-1])->isMuted = mute;
+    this->jackClient->setSourceMute(id-1, mute);
 }
 
 void MainContentComponent::muteOutput(int id, bool mute) {
     (&this->jackClient->listSpeakerOut[id-1])->isMuted = mute;
+    this->jackClient->applySpeakerOut(id-1);
 }
 
 void MainContentComponent::soloInput(int id, bool solo) {
-    (&this->jackClient->listSourceIn[id-1])->isSolo = solo;
-
-    this->jackClient->soloIn = false;
-    for (unsigned int i = 0; i < MaxInputs; i++) {
-        if ((&this->jackClient->listSourceIn[i])->isSolo) {
-            this->jackClient->soloIn = true;
-            break;
-        }
-    }
+    this->jackClient->setSourceSolo(id-1, solo);
 }
+
 void MainContentComponent::soloOutput(int id, bool solo) {
     (&this->jackClient->listSpeakerOut[id-1])->isSolo = solo;
-    
-    this->jackClient->soloOut = false;
-    for (unsigned int i = 0; i < MaxOutputs; i++) {
-        if ((&this->jackClient->listSpeakerOut[i])->isSolo) {
-            this->jackClient->soloOut = true;
-            break;
-        }
-    }
+    this->jackClient->applySpeakerOut(id-1);
 }
 
 void MainContentComponent::setDirectOut(int id, int chn) {
-    (&this->jackClient->listSourceIn[id-1])->directOut = chn;
+    this->jackClient->setSourceDirectOut(id-1, chn);
 }
 
 void MainContentComponent::reloadXmlFileSpeaker() {
@@ -1693,14 +1846,18 @@ void MainContentComponent::openXmlFileSpeaker(String path) {
                 }
                 this->listSpeaker.clear();
                 this->lockSpeakers->unlock();
-                if (path.compare(BinauralSpeakerSetupFilePath) == 0) {
+                if (BinauralSpeakerSetupFilePaths.contains(path)) {
                     this->jackClient->modeSelected = (ModeSpatEnum)(VBAP_HRTF);
                     this->comBoxModeSpat->setSelectedId(VBAP_HRTF + 1, NotificationType::dontSendNotification);
                 } else if (path.compare(StereoSpeakerSetupFilePath) == 0) {
                     this->jackClient->modeSelected = (ModeSpatEnum)(STEREO);
                     this->comBoxModeSpat->setSelectedId(STEREO + 1, NotificationType::dontSendNotification);
-               } else if (!isNewSameAsOld && oldPath.compare(BinauralSpeakerSetupFilePath) != 0 &&
-                           oldPath.compare(StereoSpeakerSetupFilePath) != 0) {
+                } else if (path.compare(HoaBinauralSpeakerSetupFilePath) == 0) {
+                    this->jackClient->modeSelected = (ModeSpatEnum)(HOA_BINAURAL);
+                    this->comBoxModeSpat->setSelectedId(HOA_BINAURAL + 1, NotificationType::dontSendNotification);
+               } else if (!isNewSameAsOld && !BinauralSpeakerSetupFilePaths.contains(oldPath) &&
+                           oldPath.compare(StereoSpeakerSetupFilePath) != 0 &&
+                           oldPath.compare(HoaBinauralSpeakerSetupFilePath) != 0) {
                     int spatMode = mainXmlElem->getIntAttribute("SpatMode");
                     this->jackClient->modeSelected = (ModeSpatEnum)(spatMode);
                     this->comBoxModeSpat->setSelectedId(spatMode + 1, NotificationType::dontSendNotification);
@@ -1715,8 +1872,6 @@ void MainContentComponent::openXmlFileSpeaker(String path) {
                     loadSetupFromXYZ = true;
 
                 this->setNameConfig();
-                this->jackClient->processBlockOn = false;
-                this->jackClient->clearOutput();
                 this->jackClient->maxOutputPatch = 0;
                 Array<int> layoutIndexes;
                 int maxLayoutIndex = 0;
@@ -1767,7 +1922,8 @@ void MainContentComponent::openXmlFileSpeaker(String path) {
                         this->listTriplet.push_back(tri);
                     }
                 }
-                this->jackClient->processBlockOn = true;
+                // Ports of the whole setup at once.
+                this->jackClient->connectedGristoSystem();
                 ok = true;
             } else {
                 if (mainXmlElem->hasTagName("ServerGRIS_Preset")) {
@@ -1792,8 +1948,10 @@ void MainContentComponent::openXmlFileSpeaker(String path) {
         }
         this->needToComputeVbap = true;
         this->updateLevelComp();
-        if (this->getJackClient()->modeSelected != VBAP_HRTF && this->getJackClient()->modeSelected != STEREO) {
-            if (this->pathCurrentFileSpeaker.compare(BinauralSpeakerSetupFilePath) != 0 && this->pathCurrentFileSpeaker.compare(StereoSpeakerSetupFilePath) != 0) {
+        if (this->getJackClient()->modeSelected != VBAP_HRTF && this->getJackClient()->modeSelected != STEREO &&
+            this->getJackClient()->modeSelected != HOA_BINAURAL) {
+            if (!BinauralSpeakerSetupFilePaths.contains(this->pathCurrentFileSpeaker) && this->pathCurrentFileSpeaker.compare(StereoSpeakerSetupFilePath) != 0 &&
+                this->pathCurrentFileSpeaker.compare(HoaBinauralSpeakerSetupFilePath) != 0) {
                 this->pathLastVbapSpeakerSetup = this->pathCurrentFileSpeaker;
             }
         }
@@ -2010,8 +2168,10 @@ void MainContentComponent::saveSpeakerSetup(String path) {
 
     this->needToSaveSpeakerSetup = false;
 
-    if (this->getJackClient()->modeSelected != VBAP_HRTF && this->getJackClient()->modeSelected != STEREO) {
-        if (this->pathCurrentFileSpeaker.compare(BinauralSpeakerSetupFilePath) != 0 && this->pathCurrentFileSpeaker.compare(StereoSpeakerSetupFilePath) != 0) {
+    if (this->getJackClient()->modeSelected != VBAP_HRTF && this->getJackClient()->modeSelected != STEREO &&
+        this->getJackClient()->modeSelected != HOA_BINAURAL) {
+        if (!BinauralSpeakerSetupFilePaths.contains(this->pathCurrentFileSpeaker) && this->pathCurrentFileSpeaker.compare(StereoSpeakerSetupFilePath) != 0 &&
+            this->pathCurrentFileSpeaker.compare(HoaBinauralSpeakerSetupFilePath) != 0) {
             this->pathLastVbapSpeakerSetup = this->pathCurrentFileSpeaker;
         }
     }
@@ -2020,7 +2180,9 @@ void MainContentComponent::saveSpeakerSetup(String path) {
 }
 
 void MainContentComponent::saveProperties(String device, int rate, int buff, int fileformat, int fileconfig,
-                                          int attenuationDB, int attenuationHz, int oscPort) {
+                                          int attenuationDB, int attenuationHz, int oscPort, int deadReckoning,
+                                          int crossfade, int spreadDirs, int lbapResolution, int binauralSpeakers,
+                                          int lockMemory, int prefault, String audioCores, int hugePages) {
 
     PropertiesFile *props = this->applicationProperties.getUserSettings();
 
@@ -2059,6 +2221,16 @@ void MainContentComponent::saveProperties(String device, int rate, int buff, int
         }
     }
 
+    // Handle dead reckoning
+    this->lockInputs->lock();
+    this->jackClient->setDeadReckoning(deadReckoning == 1);
+    this->lockInputs->unlock();
+    props->setValue("DeadReckoning", deadReckoning);
+
+    // Handle crossfade between speaker setups and modes.
+    this->jackClient->setCrossfadeTime(CrossfadeTimes[crossfade].getIntValue() * 0.001f);
+    props->setValue("Crossfade", crossfade);
+
     // Handle recording settings
     this->jackClient->setRecordFormat(fileformat);
     props->setValue("FileFormat", fileformat);
@@ -2075,11 +2247,97 @@ void MainContentComponent::saveProperties(String device, int rate, int buff, int
     this->jackClient->setAttenuationHz(coeff);
     props->setValue("AttenuationHz", attenuationHz);
 
+    // Handle DOME spread resolution, the sources are rebuilt if in use.
+    int count = VbapSpreadDirections[spreadDirs].getIntValue();
+    if (count != this->jackClient->getVbapSpreadDirs()) {
+        this->jackClient->setVbapSpreadDirs(count);
+        if (this->jackClient->modeSelected == VBAP || this->jackClient->modeSelected == VBAP_HRTF) {
+            this->updateLevelComp();
+        }
+    }
+    props->setValue("SpreadDirections", spreadDirs);
+
+    // Handle CUBE field resolution and pages, the field is rebuilt if in use.
+    int size = LbapResolutions[lbapResolution].getIntValue();
+    if (size != this->jackClient->getLbapResolution() || (hugePages == 1) != this->jackClient->getLbapHugePages()) {
+        this->jackClient->setLbapResolution(size);
+        this->jackClient->setLbapHugePages(hugePages == 1);
+        if (this->jackClient->modeSelected == LBAP) {
+            this->updateLevelComp();
+        }
+    }
+    props->setValue("LbapResolution", lbapResolution);
+    props->setValue("HugePages", hugePages);
+
+    // Handle real-time profile.
+    this->applyRealtimeProfile(lockMemory, prefault, audioCores);
+    props->setValue("LockMemory", lockMemory);
+    props->setValue("Prefault", prefault);
+    props->setValue("AudioCores", audioCores);
+
+    // Handle BINAURAL virtual speakers, the setup is reloaded if in use.
+    if (BinauralSpeakerSetupFilePaths[binauralSpeakers] != this->pathBinauralSpeakerSetup) {
+        this->pathBinauralSpeakerSetup = BinauralSpeakerSetupFilePaths[binauralSpeakers];
+        if (this->jackClient->modeSelected == VBAP_HRTF) {
+            this->openXmlFileSpeaker(this->pathBinauralSpeakerSetup);
+        }
+    }
+    props->setValue("BinauralSpeakers", binauralSpeakers);
+
     applicationProperties.saveIfNeeded();
 }
 
+String MainContentComponent::getLbapReport() {
+    lbap_field_report report = this->jackClient->getLbapReport();
+    if (report.bytes == 0) {
+        return String("Field not in use");
+    }
+    String text = String(report.bytes / 1048576.0, 2) + " MB, " + String(report.lookup_usec, 2) + " us/source";
+    if (this->jackClient->getLbapHugePages()) {
+        int huge = report.huge_page_layers + report.transparent_huge_page_layers;
+        text += ", " + String(huge) + "/" + String(report.num_of_layers) + " huge";
+    }
+    return text;
+}
+
+void MainContentComponent::applyRealtimeProfile(int lockMemory, int prefault, String audioCores) {
+    RealtimeProfile &profile = this->jackClient->realtimeProfile;
+    if (!profile.setMemoryLocked(lockMemory == 1)) {
+        cout << "Memory not locked: " << profile.getLastError() << endl;
+    }
+    if (!profile.prefaultHeap(PrefaultSizes[prefault].getIntValue())) {
+        cout << "Heap not prefaulted: " << profile.getLastError() << endl;
+    }
+    this->jackClient->setAudioCores(RealtimeProfile::parseCores(audioCores));
+}
+
+String MainContentComponent::getRealtimeReport() {
+    RealtimeProfile &profile = this->jackClient->realtimeProfile;
+    String report = profile.isMemoryLocked() ? "Locked" : "Not locked";
+    if (profile.getPrefaultedMegabytes() > 0) {
+        report += ", " + String(profile.getPrefaultedMegabytes()) + " MB";
+    }
+    Array<int> cores = this->jackClient->getAudioThreadCores();
+    if (!cores.isEmpty()) {
+        report += ", cores " + RealtimeProfile::formatCores(cores);
+    }
+    return report;
+}
+
 void MainContentComponent::timerCallback() {
     this->labelJackLoad->setText(String(this->jackClient->getCpuUsed(), 4)+ " %", dontSendNotification);
+
+    // Render plans replaced by the last crossfades.
+    this->jackClient->freeRetiredPlans();
+    // Control changes that didn't fit in the command queue.
+    this->jackClient->flushCommands();
+
+    uint64 oscDrops = this->oscReceiver->getDroppedPackets();
+    if (oscDrops > this->oscDroppedPackets && this->oscLogWindow != nullptr) {
+        this->oscLogWindow->addToLog("Kernel dropped " + String(oscDrops - this->oscDroppedPackets) +
+                                     " OSC packets (total " + String(oscDrops) + ")\n");
+    }
+    this->oscDroppedPackets = oscDrops;
     int seconds = this->jackClient->indexRecord/this->jackClient->sampleRate;
     int minute = int(seconds / 60) % 60;
     seconds = int(seconds % 60);
@@ -2134,7 +2392,10 @@ void MainContentComponent::timerCallback() {
         it->getVuMeter()->update();
     }
     
-    this->boxClientJack->updateContentCli();
+    if (this->jackClient->getClientsVersion() != this->clientsVersionShown) {
+        this->clientsVersionShown = this->jackClient->getClientsVersion();
+        this->boxClientJack->updateContentCli();
+    }
 
     if (this->isProcessForeground != Process::isForegroundProcess()) {
         this->isProcessForeground = Process::isForegroundProcess();
@@ -2228,6 +2489,19 @@ void MainContentComponent::sliderValueChanged(Slider* slider) {
 }
 
 void MainContentComponent::comboBoxChanged(ComboBox *comboBox) {
+    // The monitor mix doesn't depend on the speaker setup.
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        if (this->comBoxMonitor[m] == comboBox) {
+            int index = this->comBoxMonitor[m]->getSelectedId() - 1;
+            if (index > 0 && ! this->jackClient->setMonitorMode(m, MonitorModes[index])) {
+                this->comBoxMonitor[m]->setSelectedId(1, NotificationType::dontSendNotification);
+            } else if (index <= 0) {
+                this->jackClient->setMonitorMode(m, MonitorOff);
+            }
+            return;
+        }
+    }
+
     if (this->winSpeakConfig != nullptr && this->needToSaveSpeakerSetup) {
         AlertWindow alert ("The speaker configuration has changed!    ",
                            "Save your changes or close the speaker configuration window before switching mode...    ",
@@ -2240,7 +2514,6 @@ void MainContentComponent::comboBoxChanged(ComboBox *comboBox) {
     }
 
     if (this->comBoxModeSpat == comboBox) {
-        this->jackClient->processBlockOn = false;
         this->jackClient->modeSelected = (ModeSpatEnum)(this->comBoxModeSpat->getSelectedId() - 1);
         switch (this->jackClient->modeSelected) {
             case VBAP:
@@ -2254,9 +2527,8 @@ void MainContentComponent::comboBoxChanged(ComboBox *comboBox) {
                 this->isSpanShown = true;
                 break;
             case VBAP_HRTF:
-                this->openXmlFileSpeaker(BinauralSpeakerSetupFilePath);
+                this->openXmlFileSpeaker(this->pathBinauralSpeakerSetup);
                 this->needToSaveSpeakerSetup = false;
-                this->jackClient->resetHRTF();
                 this->isSpanShown = false;
                 break;
             case STEREO:
@@ -2264,10 +2536,14 @@ void MainContentComponent::comboBoxChanged(ComboBox *comboBox) {
                 this->needToSaveSpeakerSetup = false;
                 this->isSpanShown = false;
                 break;
+            case HOA_BINAURAL:
+                this->openXmlFileSpeaker(HoaBinauralSpeakerSetupFilePath);
+                this->needToSaveSpeakerSetup = false;
+                this->isSpanShown = false;
+                break;
             default:
                 break;
         }
-        this->jackClient->processBlockOn = true;
 
         if (this->winSpeakConfig != nullptr) {
             String windowName = String("Speakers Setup Edition - ") + String(ModeSpatString[this->jackClient->modeSelected]) + \
@@ -2283,9 +2559,8 @@ int MainContentComponent::getModeSelected() {
 
 void MainContentComponent::setOscLogging(const OSCMessage& message) {
     if (this->oscLogWindow != nullptr) {
-        String address = message.getAddressPattern().toString();
-        this->oscLogWindow->addToLog(address + "\n");
-        String msg;
+        // One entry per message, the receiver threads don't interleave them.
+        String msg = message.getAddressPattern().toString() + "\n";
         for (int i = 0; i < message.size(); i++) {
             if (message[i].isInt32()) {
                 msg = msg + String(message[i].getInt32()) + " ";
@@ -2293,6 +2568,8 @@ void MainContentComponent::setOscLogging(const OSCMessage& message) {
                 msg = msg + String(message[i].getFloat32()) + " ";
             } else if (message[i].isString()) {
                 msg = msg + message[i].getString() + " ";
+            } else if (message[i].isBlob()) {
+                msg = msg + "<blob " + String((int)message[i].getBlob().getSize()) + " bytes> ";
             }
         }
         this->oscLogWindow->addToLog(msg + "\n");
@@ -53,6 +53,8 @@
 #include "UiComponent.h"
 #include "LevelComponent.h"
 #include "OscInput.h"
+#include "ShmControl.h"
+#include "Trajectory.h"
 #include "Input.h"
 #include "WinControl.h"
 #include "MainWindow.h"
@@ -128,7 +130,12 @@ public:
     // Sources.
     vector<Input *> getListSourceInput() { return this->listSourceInput; }
     mutex* getLockInputs() { return this->lockInputs; }
+    TrajectoryEngine* getTrajectoryEngine() { return this->trajectoryEngine; }
     void updateInputJack(int inInput, Input &inp);
+    // Position of a source received by the OSC or the shared-memory channel,
+    // must be called with the inputs lock held.
+    void updateSourcePosition(unsigned int idS, float azi, float ele, float azispan,
+                              float elespan, float rad, float gain);
     bool isRadiusNormalized();
 
     // Jack clients.
@@ -181,6 +188,12 @@ public:
     // Called when the speaker setup has changed.
     bool updateLevelComp();
 
+    // Applies edited speaker positions, gains and filters without rebuilding
+    // the outputs or stopping the audio. Returns false if the setup changed
+    // otherwise, updateLevelComp() must then be used.
+    bool updateSpeakerLayout();
+    void updateSpeakerGainAndFilter(Speaker *speaker);
+
     // Open - save.
     void openXmlFileSpeaker(String path);
     void reloadXmlFileSpeaker();
@@ -188,7 +201,12 @@ public:
     void getPresetData(XmlElement *xml);
     void savePreset(String path);
     void saveSpeakerSetup(String path);
-    void saveProperties(String device, int rate, int buff, int fileformat, int fileconfig, int attenuationDB, int attenuationHz, int oscPort);
+    void saveProperties(String device, int rate, int buff, int fileformat, int fileconfig, int attenuationDB, int attenuationHz, int oscPort,
+                        int deadReckoning, int crossfade, int spreadDirs, int lbapResolution, int binauralSpeakers,
+                        int lockMemory, int prefault, String audioCores, int hugePages);
+    String getLbapReport();
+    void applyRealtimeProfile(int lockMemory, int prefault, String audioCores);
+    String getRealtimeReport();
     void chooseRecordingPath();
     void setNameConfig();
     void setTitle();
@@ -226,6 +244,7 @@ public:
     // App user settings.
     ApplicationProperties applicationProperties;
     int oscInputPort = 18032;
+    uint64 oscDroppedPackets = 0;
     unsigned int samplingRate = 48000;
     juce::Rectangle<int> winControlRect;
 
@@ -276,10 +295,13 @@ private:
 
     // Open Sound Control.
     OscInput *oscReceiver;
+    ShmControlInput *shmControl;
+    TrajectoryEngine *trajectoryEngine;
 
     // Paths.
     String nameConfig;
     String pathLastVbapSpeakerSetup;
+    String pathBinauralSpeakerSetup;
     String pathCurrentFileSpeaker;
     String pathCurrentPreset;
 
@@ -313,6 +335,7 @@ private:
     Label *labelJackInfo;
 
     ComboBox *comBoxModeSpat;
+    ComboBox *comBoxMonitor[MaxMonitors];
 
     Slider *sliderMasterGainOut;
     Slider *sliderInterpolation;
@@ -321,6 +344,7 @@ private:
         
     Label *labelAllClients;
     BoxClient *boxClientJack;
+    unsigned int clientsVersionShown; // Refresh the client table when the jack client's differs.
     
     TextButton *butStartRecord;
     TextEditor *tedMinRecord;
@@ -20,25 +20,50 @@
 #include "OscInput.h"
 #include "MainComponent.h"
 #include "Input.h"
+#include "Trajectory.h"
 
 OscInput::OscInput(MainContentComponent* parent) {
     this->mainParent = parent;
+    this->udpReceiver = nullptr;
+    if (OscUdpReceiver::isAvailable()) {
+        this->udpReceiver = new OscUdpReceiver(this);
+    }
 }
 
 OscInput::~OscInput() {
-    this->disconnect();
+    this->closeConnection();
+    delete this->udpReceiver;
 }
 
 bool OscInput::startConnection(int port) {
+    if (this->udpReceiver != nullptr) {
+        return this->udpReceiver->connect(port);
+    }
     bool b = this->connect(port);
     this->addListener(this);
     return b;
 }
 
 bool OscInput::closeConnection() {
+    if (this->udpReceiver != nullptr) {
+        return this->udpReceiver->disconnect();
+    }
     return this->disconnect();
 }
 
+void OscInput::setReceiverOptions(int receiveBufferSize, int numberOfSockets) {
+    if (this->udpReceiver != nullptr) {
+        this->udpReceiver->setSocketOptions(receiveBufferSize, numberOfSockets);
+    }
+}
+
+uint64 OscInput::getDroppedPackets() const {
+    if (this->udpReceiver != nullptr) {
+        return this->udpReceiver->getDroppedPackets();
+    }
+    return 0;
+}
+
 void OscInput::oscBundleReceived(const OSCBundle& bundle) {
     for (auto& element : bundle) {
         if (element.isMessage())
@@ -48,28 +73,93 @@ void OscInput::oscBundleReceived(const OSCBundle& bundle) {
     }
 }
 
+static float readBigEndianFloat(const char *data) {
+    uint32 bits = ByteOrder::bigEndianInt(data);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+void OscInput::bulkMessageReceived(const OSCMessage& message) {
+    // Many sources in one packet, either as a blob of packed big-endian records
+    // (int32 id, float azi, ele, azispan, elespan, distance, gain) or as a flat
+    // typed list repeating iffffff. All records are applied under a single lock.
+    if (message.isEmpty()) {
+        return;
+    }
+
+    this->mainParent->getLockInputs()->lock();
+    if (message[0].isBlob()) {
+        const MemoryBlock& blob = message[0].getBlob();
+        const char *data = static_cast<const char *>(blob.getData());
+        const size_t recordBytes = OscSpatServRecordSize * 4;
+        const size_t numRecords = blob.getSize() / recordBytes;
+        for (size_t r = 0; r < numRecords; r++) {
+            const char *rec = data + r * recordBytes;
+            this->mainParent->updateSourcePosition((unsigned int)ByteOrder::bigEndianInt(rec),
+                                                   readBigEndianFloat(rec + 4), readBigEndianFloat(rec + 8),
+                                                   readBigEndianFloat(rec + 12), readBigEndianFloat(rec + 16),
+                                                   readBigEndianFloat(rec + 20), readBigEndianFloat(rec + 24));
+        }
+    } else {
+        const int numRecords = message.size() / OscSpatServRecordSize;
+        for (int r = 0; r < numRecords; r++) {
+            const int off = r * OscSpatServRecordSize;
+            if (! message[off].isInt32()) {
+                break;
+            }
+            this->mainParent->updateSourcePosition(message[off].getInt32(), message[off+1].getFloat32(),
+                                                   message[off+2].getFloat32(), message[off+3].getFloat32(),
+                                                   message[off+4].getFloat32(), message[off+5].getFloat32(),
+                                                   message[off+6].getFloat32());
+        }
+    }
+    this->mainParent->getLockInputs()->unlock();
+}
+
+void OscInput::trajectoryMessageReceived(const OSCMessage& message) {
+    // int id, string type ("circle", "ellipse", "spiral", "randomwalk",
+    // "spline" or "stop"), then float parameters or the spline file path.
+    if (message.size() < 2 || ! message[1].isString()) {
+        return;
+    }
+    unsigned int idS = message[0].getInt32();
+    String type = message[1].getString();
+    Array<float> params;
+    String path;
+    for (int i = 2; i < message.size(); i++) {
+        if (message[i].isFloat32()) {
+            params.add(message[i].getFloat32());
+        } else if (message[i].isInt32()) {
+            params.add((float)message[i].getInt32());
+        } else if (message[i].isString()) {
+            path = message[i].getString();
+        }
+    }
+    this->mainParent->getTrajectoryEngine()->setTrajectory(idS, Trajectory::createFromArguments(type, params, path));
+}
+
 void OscInput::oscMessageReceived(const OSCMessage& message) {
     this->mainParent->setOscLogging(message);
     string address = message.getAddressPattern().toString().toStdString();
-    if (message[0].isInt32()) {
+    if (address == OscSpatServBulk) {
+        this->bulkMessageReceived(message);
+    } else if (message[0].isInt32()) {
         if (address == OscSpatServ) {
             // int id, float azi [0, 2pi], float ele [0, pi], float azispan [0, 2],
             // float elespan [0, 0.5], float distance [0, 1], float gain [0, 1].
-            unsigned int idS = message[0].getInt32();
             this->mainParent->getLockInputs()->lock();
-            if (this->mainParent->getListSourceInput().size() > idS) {
-                this->mainParent->getListSourceInput()[idS]->updateValues(message[1].getFloat32(),
-                                                                          message[2].getFloat32(),
-                                                                          message[3].getFloat32(),
-                                                                          message[4].getFloat32(),
-                                                                          this->mainParent->isRadiusNormalized() ? 1.0 : message[5].getFloat32(),
-                                                                          message[6].getFloat32(),
-                                                                          this->mainParent->getModeSelected());
-                this->mainParent->updateInputJack(idS, *this->mainParent->getListSourceInput()[idS]);
-            }
+            this->mainParent->updateSourcePosition(message[0].getInt32(), message[1].getFloat32(),
+                                                   message[2].getFloat32(), message[3].getFloat32(),
+                                                   message[4].getFloat32(), message[5].getFloat32(),
+                                                   message[6].getFloat32());
             this->mainParent->getLockInputs()->unlock();
         }
         
+        else if (address == OscSpatTraj) {
+            this->trajectoryMessageReceived(message);
+        }
+
         else if (address == OscPanAZ) {
             //id, azim, elev, azimSpan, elevSpan, gain (Zirkonium artifact).
             unsigned int idS = message[0].getInt32();
@@ -86,13 +176,15 @@ void OscInput::oscMessageReceived(const OSCMessage& message) {
         }
     } else if (message[0].isString()) {
         // string "reset", int voice_to_reset.
-        this->mainParent->getLockInputs()->lock();
         if (message[0].getString().compare("reset") == 0) {
             unsigned int idS = message[1].getInt32();
+            // Stopped first, setTrajectory() may wait for the timer, which takes lockInputs.
+            this->mainParent->getTrajectoryEngine()->setTrajectory(idS, nullptr);
+            this->mainParent->getLockInputs()->lock();
             if (this->mainParent->getListSourceInput().size() > idS) {
                 this->mainParent->getListSourceInput()[idS]->resetPosition();
             }
+            this->mainParent->getLockInputs()->unlock();
         }
-        this->mainParent->getLockInputs()->unlock();
     }
 }
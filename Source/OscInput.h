@@ -21,6 +21,7 @@
 #define OSCINPUT_H
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "OscUdpReceiver.h"
 
 class MainContentComponent;
 
@@ -28,6 +29,11 @@ using namespace std;
 
 static const string OscPanAZ    = "/pan/az";
 static const string OscSpatServ = "/spat/serv";
+static const string OscSpatServBulk = "/spat/serv/bulk";
+static const string OscSpatTraj = "/spat/traj";
+
+// Number of 32-bit fields (int id + six floats) in one /spat/serv/bulk record.
+static const unsigned int OscSpatServRecordSize = 7;
 
 class OscInput : private OSCReceiver,
                  private OSCReceiver::Listener<OSCReceiver::RealtimeCallback>
@@ -39,12 +45,19 @@ public :
     
     bool startConnection(int port);
     bool closeConnection();
+
+    // Options of the batched receiver (Linux only, ignored elsewhere).
+    void setReceiverOptions(int receiveBufferSize, int numberOfSockets);
+    uint64 getDroppedPackets() const;
     
 private :
     void oscMessageReceived(const OSCMessage& message) override;
     void oscBundleReceived(const OSCBundle& bundle) override;
+    void bulkMessageReceived(const OSCMessage& message);
+    void trajectoryMessageReceived(const OSCMessage& message);
 
     MainContentComponent * mainParent;
+    OscUdpReceiver * udpReceiver;
     
 };
 
@@ -0,0 +1,304 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "OscUdpReceiver.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+static size_t oscPaddedStringLength(const char *data, size_t size) {
+    size_t len = strnlen(data, size);
+    if (len == size) {
+        return 0; // Not null-terminated.
+    }
+    size_t padded = (len + 4) & ~(size_t)3;
+    return padded <= size ? padded : 0;
+}
+
+static float oscReadFloat(const char *data) {
+    uint32 bits = ByteOrder::bigEndianInt(data);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+//==============================================================================
+OscUdpReceiver::OscUdpReceiver(OSCReceiver::Listener<OSCReceiver::RealtimeCallback> *listener) {
+    this->listener = listener;
+}
+
+OscUdpReceiver::~OscUdpReceiver() {
+    this->disconnect();
+}
+
+bool OscUdpReceiver::isAvailable() {
+#if defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OscUdpReceiver::setSocketOptions(int receiveBufferSize, int numberOfShards) {
+    this->requestedBufferSize = receiveBufferSize;
+    this->numShards = jlimit(1, (int)OscUdpMaxShards, numberOfShards);
+}
+
+bool OscUdpReceiver::connect(int port) {
+#if defined(__linux__)
+    this->disconnect();
+
+    for (int i = 0; i < this->numShards; i++) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
+            break;
+        }
+
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+
+        // SO_RCVBUFFORCE bypasses rmem_max but needs CAP_NET_ADMIN.
+        int bufSize = this->requestedBufferSize;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &bufSize, sizeof(bufSize)) != 0) {
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+        }
+        socklen_t optLen = sizeof(bufSize);
+        if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufSize, &optLen) == 0) {
+            this->actualBufferSize = bufSize;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((uint16)port);
+        if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(sock);
+            break;
+        }
+
+        Shard *shard = new Shard(*this, sock);
+        this->shards.add(shard);
+        shard->startThread(8);
+    }
+
+    if (this->shards.size() != this->numShards) {
+        this->disconnect();
+        return false;
+    }
+    return true;
+#else
+    ignoreUnused(port);
+    return false;
+#endif
+}
+
+bool OscUdpReceiver::disconnect() {
+    for (auto *shard : this->shards) {
+        shard->signalThreadShouldExit();
+    }
+    // Shard destructors stop the threads and close the sockets.
+    this->shards.clear();
+    return true;
+}
+
+uint64 OscUdpReceiver::getDroppedPackets() const {
+    uint64 total = 0;
+    for (auto *shard : this->shards) {
+        total += shard->drops.load();
+    }
+    return total;
+}
+
+uint64 OscUdpReceiver::getReceivedPackets() const {
+    uint64 total = 0;
+    for (auto *shard : this->shards) {
+        total += shard->received.load();
+    }
+    return total;
+}
+
+void OscUdpReceiver::handlePacket(const char *data, size_t size) {
+    if (size < 4 || (size % 4) != 0) {
+        return;
+    }
+    if (data[0] == '#') {
+        this->handleBundle(data, size);
+    } else if (data[0] == '/') {
+        this->handleMessage(data, size);
+    }
+}
+
+bool OscUdpReceiver::handleBundle(const char *data, size_t size) {
+    // "#bundle\0", 64-bit time tag, then (int32 size, element) pairs.
+    if (size < 16 || memcmp(data, "#bundle", 8) != 0) {
+        return false;
+    }
+    size_t pos = 16;
+    while (pos + 4 <= size) {
+        size_t elemSize = (size_t)ByteOrder::bigEndianInt(data + pos);
+        pos += 4;
+        if (elemSize > size - pos) {
+            return false;
+        }
+        this->handlePacket(data + pos, elemSize);
+        pos += elemSize;
+    }
+    return true;
+}
+
+bool OscUdpReceiver::handleMessage(const char *data, size_t size) {
+    size_t addrLen = oscPaddedStringLength(data, size);
+    if (addrLen == 0 || addrLen >= size || data[addrLen] != ',') {
+        return false;
+    }
+    const char *tags = data + addrLen;
+    size_t tagsLen = oscPaddedStringLength(tags, size - addrLen);
+    if (tagsLen == 0) {
+        return false;
+    }
+
+    try {
+        OSCMessage message { OSCAddressPattern(String(CharPointer_UTF8(data))) };
+        size_t pos = addrLen + tagsLen;
+        for (const char *t = tags + 1; *t != '\0'; t++) {
+            switch (*t) {
+                case 'i':
+                    if (pos + 4 > size) return false;
+                    message.addInt32((int32)ByteOrder::bigEndianInt(data + pos));
+                    pos += 4;
+                    break;
+                case 'f':
+                    if (pos + 4 > size) return false;
+                    message.addFloat32(oscReadFloat(data + pos));
+                    pos += 4;
+                    break;
+                case 's': {
+                    size_t len = oscPaddedStringLength(data + pos, size - pos);
+                    if (len == 0) return false;
+                    message.addString(String(CharPointer_UTF8(data + pos)));
+                    pos += len;
+                    break;
+                }
+                case 'b': {
+                    if (pos + 4 > size) return false;
+                    size_t len = (size_t)ByteOrder::bigEndianInt(data + pos);
+                    pos += 4;
+                    if (len > size - pos) return false;
+                    message.addBlob(MemoryBlock(data + pos, len));
+                    pos += (len + 3) & ~(size_t)3;
+                    break;
+                }
+                case 'h':
+                case 'd':
+                case 't':
+                    // 64-bit types are not used by SpatGRIS, the message is rejected.
+                    return false;
+                case 'T':
+                case 'F':
+                case 'N':
+                case 'I':
+                    break;
+                default:
+                    return false;
+            }
+        }
+        if (pos > size) {
+            return false;
+        }
+        this->listener->oscMessageReceived(message);
+    }
+    catch (const OSCFormatError&) {
+        return false;
+    }
+    return true;
+}
+
+//==============================================================================
+OscUdpReceiver::Shard::~Shard() {
+    this->stopThread(500);
+#if defined(__linux__)
+    close(this->sock);
+#endif
+}
+
+void OscUdpReceiver::Shard::run() {
+#if defined(__linux__)
+    HeapBlock<char> buffers(OscUdpBatchSize * OscUdpMaxPacketSize);
+    HeapBlock<char> controls(OscUdpBatchSize * CMSG_SPACE(sizeof(uint32)));
+    struct mmsghdr msgs[OscUdpBatchSize];
+    struct iovec iovecs[OscUdpBatchSize];
+
+    struct pollfd pfd;
+    pfd.fd = this->sock;
+    pfd.events = POLLIN;
+
+    while (! this->threadShouldExit()) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        // Drain the socket in batches until it would block.
+        for (;;) {
+            for (unsigned int i = 0; i < OscUdpBatchSize; i++) {
+                iovecs[i].iov_base = buffers + i * OscUdpMaxPacketSize;
+                iovecs[i].iov_len = OscUdpMaxPacketSize;
+                memset(&msgs[i], 0, sizeof(struct mmsghdr));
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = controls + i * CMSG_SPACE(sizeof(uint32));
+                msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint32));
+            }
+
+            int num = recvmmsg(this->sock, msgs, OscUdpBatchSize, MSG_DONTWAIT, nullptr);
+            if (num <= 0) {
+                break;
+            }
+
+            for (int i = 0; i < num; i++) {
+                // SO_RXQ_OVFL reports the cumulative number of datagrams dropped by the kernel.
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                        uint32 dropped;
+                        memcpy(&dropped, CMSG_DATA(cmsg), sizeof(uint32));
+                        this->drops.store(dropped);
+                    }
+                }
+                if (! (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                    this->owner.handlePacket((const char *)iovecs[i].iov_base, msgs[i].msg_len);
+                }
+            }
+            this->received += (uint64)num;
+
+            if (num < (int)OscUdpBatchSize || this->threadShouldExit()) {
+                break;
+            }
+        }
+    }
+#endif
+}
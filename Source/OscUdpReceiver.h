@@ -0,0 +1,87 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OSCUDPRECEIVER_H
+#define OSCUDPRECEIVER_H
+
+#include <atomic>
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace std;
+
+// Batched OSC receiver for Linux. Every shard owns a UDP socket bound with
+// SO_REUSEPORT on the same port and drains it with recvmmsg(), so a burst of
+// datagrams costs one syscall instead of one per packet. The kernel drop
+// counter (SO_RXQ_OVFL) of every socket is collected and can be queried.
+// Decoded messages are dispatched to the listener from the shard threads.
+
+static const unsigned int OscUdpBatchSize = 64;
+static const unsigned int OscUdpMaxPacketSize = 8192;
+static const unsigned int OscUdpMaxShards = 8;
+
+class OscUdpReceiver
+{
+public :
+    OscUdpReceiver(OSCReceiver::Listener<OSCReceiver::RealtimeCallback> *listener);
+    ~OscUdpReceiver();
+
+    static bool isAvailable();
+
+    // Requested kernel receive buffer (bytes) and number of sockets.
+    // Only effective on the next connect().
+    void setSocketOptions(int receiveBufferSize, int numberOfShards);
+
+    bool connect(int port);
+    bool disconnect();
+
+    uint64 getDroppedPackets() const;
+    uint64 getReceivedPackets() const;
+    int getReceiveBufferSize() const { return this->actualBufferSize; }
+
+    // Decodes one OSC packet (message or bundle) and dispatches it.
+    void handlePacket(const char *data, size_t size);
+
+private :
+    class Shard : public Thread
+    {
+    public :
+        Shard(OscUdpReceiver& o, int s) : Thread("OscUdpShard"), owner(o), sock(s) {}
+        ~Shard();
+        void run() override;
+
+        OscUdpReceiver& owner;
+        int sock;
+        atomic<uint64> received { 0 };
+        atomic<uint32> drops { 0 };
+    };
+
+    bool handleBundle(const char *data, size_t size);
+    bool handleMessage(const char *data, size_t size);
+
+    OSCReceiver::Listener<OSCReceiver::RealtimeCallback> *listener;
+    OwnedArray<Shard> shards;
+    int requestedBufferSize = 4 * 1024 * 1024;
+    int numShards = 1;
+    int actualBufferSize = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscUdpReceiver)
+};
+
+#endif /* OSCUDPRECEIVER_H */
@@ -0,0 +1,199 @@
+/*
+ This file is part of SpatGRIS2.
+
+ Developers: Olivier Belanger, Nicolas Masson
+
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RealtimeProfile.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+//==============================================================================
+RealtimeProfile::RealtimeProfile() {
+    this->memoryLocked = false;
+    this->prefaultedMegabytes = 0;
+}
+
+bool RealtimeProfile::setMemoryLocked(bool lock) {
+    this->lastError = String();
+    if (lock == this->memoryLocked) {
+        return true;
+    }
+#ifdef __linux__
+    if (!lock) {
+        munlockall();
+        this->memoryLocked = false;
+        return true;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        this->lastError = "mlockall: " + String(strerror(errno));
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            this->lastError += " (limit " + String((int64)(limit.rlim_cur / 1024)) + " KB)";
+        }
+        return false;
+    }
+    this->memoryLocked = true;
+    return true;
+#else
+    this->lastError = "Memory locking is not supported on this platform";
+    return false;
+#endif
+}
+
+bool RealtimeProfile::prefaultHeap(int megabytes) {
+    this->lastError = String();
+#ifdef __linux__
+    if (megabytes <= 0 && this->prefaultedMegabytes > 0) {
+        // Back to the glibc defaults, the reserve is given back to the system.
+        mallopt(M_TRIM_THRESHOLD, 128 * 1024);
+        mallopt(M_MMAP_MAX, 65536);
+        mallopt(M_ARENA_MAX, 8 * (int)sysconf(_SC_NPROCESSORS_ONLN));
+        malloc_trim(0);
+        this->prefaultedMegabytes = 0;
+        return true;
+    }
+#endif
+    if (megabytes <= this->prefaultedMegabytes) {
+        return true;
+    }
+#ifdef __linux__
+    // Freed blocks stay in the heap and the large ones are carved from it.
+    // A single arena makes the threads that allocate later (LBAP pool, JACK
+    // callbacks) use the touched pages too, threads that already have their
+    // own arena keep it.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    size_t bytes = (size_t)megabytes * 1048576;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char *reserve = (char *)malloc(bytes);
+    if (reserve == nullptr) {
+        this->lastError = "Can't reserve " + String(megabytes) + " MB of heap";
+        return false;
+    }
+    volatile char *touch = reserve;
+    for (size_t i = 0; i < bytes; i += page) {
+        touch[i] = 0;
+    }
+    free(reserve);
+    this->prefaultedMegabytes = megabytes;
+    return true;
+#else
+    this->lastError = "Heap prefaulting is not supported on this platform";
+    return false;
+#endif
+}
+
+#ifdef __linux__
+// Cores allowed by the list, or the ones of the process if it is empty.
+static bool getAffinitySet(const Array<int> &cores, cpu_set_t *set) {
+    CPU_ZERO(set);
+    if (cores.isEmpty()) {
+        return sched_getaffinity(0, sizeof(cpu_set_t), set) == 0;
+    }
+    for (int i = 0; i < cores.size(); i++) {
+        if (cores[i] >= 0 && cores[i] < CPU_SETSIZE && cores[i] < SystemStats::getNumCpus()) {
+            CPU_SET(cores[i], set);
+        }
+    }
+    return CPU_COUNT(set) > 0;
+}
+#endif
+
+bool RealtimeProfile::setThreadAffinity(jack_native_thread_t thread, const Array<int> &cores) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (!getAffinitySet(cores, &set)) {
+        return false;
+    }
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+#else
+    (void)thread;
+    (void)cores;
+    return false;
+#endif
+}
+
+bool RealtimeProfile::setCurrentThreadAffinity(const Array<int> &cores) {
+#ifdef __linux__
+    return setThreadAffinity(pthread_self(), cores);
+#else
+    (void)cores;
+    return false;
+#endif
+}
+
+Array<int> RealtimeProfile::getThreadAffinity(jack_native_thread_t thread) {
+    Array<int> cores;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(thread, sizeof(cpu_set_t), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) {
+                cores.add(i);
+            }
+        }
+    }
+#else
+    (void)thread;
+#endif
+    return cores;
+}
+
+Array<int> RealtimeProfile::parseCores(const String &text) {
+    Array<int> cores;
+    StringArray items;
+    items.addTokens(text, ",", "");
+    items.trim();
+    items.removeEmptyStrings();
+    for (int i = 0; i < items.size(); i++) {
+        int first = items[i].upToFirstOccurrenceOf("-", false, false).trim().getIntValue();
+        int last = items[i].contains("-") ? items[i].fromFirstOccurrenceOf("-", false, false).trim().getIntValue() : first;
+        for (int c = first; c <= last && c < 1024; c++) {
+            cores.addIfNotAlreadyThere(c);
+        }
+    }
+    DefaultElementComparator<int> sorter;
+    cores.sort(sorter);
+    return cores;
+}
+
+String RealtimeProfile::formatCores(const Array<int> &cores) {
+    String text;
+    for (int i = 0; i < cores.size(); i++) {
+        int first = cores[i];
+        while (i + 1 < cores.size() && cores[i + 1] == cores[i] + 1) {
+            i++;
+        }
+        if (text.isNotEmpty()) {
+            text += ",";
+        }
+        text += (cores[i] == first) ? String(first) : String(first) + "-" + String(cores[i]);
+    }
+    return text;
+}
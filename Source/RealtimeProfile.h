@@ -0,0 +1,68 @@
+/*
+ This file is part of SpatGRIS2.
+
+ Developers: Olivier Belanger, Nicolas Masson
+
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REALTIMEPROFILE_H
+#define REALTIMEPROFILE_H
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include <jack/jack.h>
+
+// Real-time tuning of the process: locking its pages in memory, keeping a
+// prefaulted heap reserve for the buffers allocated later (render plans,
+// recorder FIFOs) and pinning threads on chosen cores. Linux only, the
+// other platforms report the requests as not supported.
+
+class RealtimeProfile
+{
+public :
+    RealtimeProfile();
+
+    // Locks the current and future pages of the process, or unlocks them.
+    // Returns false if the system refused, see getLastError().
+    bool setMemoryLocked(bool lock);
+    bool isMemoryLocked() const { return this->memoryLocked; }
+
+    // Keeps the heap from being trimmed or bypassed by separate mappings and
+    // writes `megabytes` of it once. The reserve only grows, zero restores
+    // the default allocator settings and releases it.
+    bool prefaultHeap(int megabytes);
+    int getPrefaultedMegabytes() const { return this->prefaultedMegabytes; }
+
+    String getLastError() const { return this->lastError; }
+
+    // Pins a thread on `cores`, or gives it back the cores of the process
+    // if the list is empty.
+    static bool setThreadAffinity(jack_native_thread_t thread, const Array<int> &cores);
+    static bool setCurrentThreadAffinity(const Array<int> &cores);
+    static Array<int> getThreadAffinity(jack_native_thread_t thread);
+
+    // Core lists written as "2,3" or "2-5".
+    static Array<int> parseCores(const String &text);
+    static String formatCores(const Array<int> &cores);
+
+private :
+    bool memoryLocked;
+    int prefaultedMegabytes;
+    String lastError;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeProfile)
+};
+
+#endif /* REALTIMEPROFILE_H */
@@ -42,13 +42,16 @@ const String DefaultPresetDirectoryPath = CURRENT_WORKING_DIR + RESOURCES_DIR +
 const String DefaultSpeakerSetupFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/default_speaker_setup.xml";
 const String BinauralSpeakerSetupFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/BINAURAL_SPEAKER_SETUP.xml";
 const String StereoSpeakerSetupFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/STEREO_SPEAKER_SETUP.xml";
+const String HoaBinauralSpeakerSetupFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/HOA_BINAURAL_SPEAKER_SETUP.xml";
 const String ServerGrisManualFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "SpatGRIS2_2.0_Manual.pdf";
 const String ServerGrisIconSmallFilePath = CURRENT_WORKING_DIR + RESOURCES_DIR + "ServerGRIS_icon_small.png";
-const String HRTFFolder0Path = CURRENT_WORKING_DIR + RESOURCES_DIR + "hrtf_compact/elev" + String(0) + "/";
-const String HRTFFolder40Path = CURRENT_WORKING_DIR + RESOURCES_DIR + "hrtf_compact/elev" + String(40) + "/";
-const String HRTFFolder80Path = CURRENT_WORKING_DIR + RESOURCES_DIR + "hrtf_compact/elev" + String(80) + "/";
+const String HRTFFolderPath = CURRENT_WORKING_DIR + RESOURCES_DIR + "hrtf_compact/";
+const StringArray BinauralSpeakerSetupFilePaths = {BinauralSpeakerSetupFilePath,
+                                                   CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/BINAURAL_SPEAKER_SETUP_24.xml",
+                                                   CURRENT_WORKING_DIR + RESOURCES_DIR + "default_preset/BINAURAL_SPEAKER_SETUP_50.xml"};
 
-const StringArray ModeSpatString = {"DOME",  "CUBE", "BINAURAL", "STEREO"};
+const StringArray ModeSpatString = {"DOME",  "CUBE", "BINAURAL", "STEREO", "HOA BINAURAL"};
+const StringArray MonitorModeString = {"NONE", "STEREO", "HOA BINAURAL"};
 
 // Settings Jack Server
 const StringArray BufferSizes = {"32", "64", "128", "256", "512", "1024", "2048"};
@@ -57,5 +60,11 @@ const StringArray FileFormats = {"WAV", "AIFF"};
 const StringArray FileConfigs = {"Multiple Mono Files", "Single Interleaved"};
 const StringArray AttenuationDBs = {"0", "-12", "-24", "-36", "-48", "-60", "-72"};
 const StringArray AttenuationCutoffs = {"125", "250", "500", "1000", "2000", "4000", "8000", "16000"};
+const StringArray OffOnValues = {"Off", "On"};
+const StringArray CrossfadeTimes = {"0", "25", "50", "100", "250", "500"};
+const StringArray PrefaultSizes = {"0", "32", "64", "128", "256"};
+const StringArray LbapResolutions = {"32", "64", "128", "256"};
+const StringArray VbapSpreadDirections = {"8", "16", "32"};
+const StringArray BinauralVirtualSpeakers = {"16", "24", "50"};
 
 const unsigned int VuMeterWidthInPixels = 22;
\ No newline at end of file
@@ -34,14 +34,15 @@ extern const String DefaultPresetDirectoryPath;
 extern const String DefaultSpeakerSetupFilePath;
 extern const String BinauralSpeakerSetupFilePath;
 extern const String StereoSpeakerSetupFilePath;
+extern const String HoaBinauralSpeakerSetupFilePath;
 extern const String ServerGrisManualFilePath;
 extern const String ServerGrisIconSmallFilePath;
 
-extern const String HRTFFolder0Path;
-extern const String HRTFFolder40Path;
-extern const String HRTFFolder80Path;
+extern const String HRTFFolderPath;
+extern const StringArray BinauralSpeakerSetupFilePaths;
 
 extern const StringArray ModeSpatString;
+extern const StringArray MonitorModeString;
 
 extern const bool UseOSNativeDialogBox;
 
@@ -51,6 +52,12 @@ extern const StringArray FileFormats;
 extern const StringArray FileConfigs;
 extern const StringArray AttenuationDBs;
 extern const StringArray AttenuationCutoffs;
+extern const StringArray OffOnValues;
+extern const StringArray CrossfadeTimes;
+extern const StringArray PrefaultSizes;
+extern const StringArray LbapResolutions;
+extern const StringArray VbapSpreadDirections;
+extern const StringArray BinauralVirtualSpeakers;
 
 extern const unsigned int VuMeterWidthInPixels;
 
@@ -0,0 +1,256 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ShmControl.h"
+#include "MainComponent.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//==============================================================================
+ShmControlInput::ShmControlInput(MainContentComponent *parent) : Thread("ShmControlInput") {
+    this->mainParent = parent;
+    this->header = nullptr;
+    this->semaphore = nullptr;
+}
+
+ShmControlInput::~ShmControlInput() {
+    this->close();
+}
+
+bool ShmControlInput::open(const char *name) {
+#if defined(__linux__)
+    this->close();
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0660);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, sizeof(ShmControlHeader)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void *mem = mmap(nullptr, sizeof(ShmControlHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    sem_t *sem = sem_open((String(name) + "_sem").toRawUTF8(), O_CREAT, 0660, 0);
+    if (sem == SEM_FAILED) {
+        munmap(mem, sizeof(ShmControlHeader));
+        return false;
+    }
+
+    this->header = (ShmControlHeader *)mem;
+    this->header->recordSize = sizeof(ShmPositionRecord);
+    this->header->capacity = ShmControlCapacity;
+    this->header->numRings = ShmControlMaxClients;
+    this->header->version = ShmControlVersion;
+    for (uint32 i = 0; i < ShmControlMaxClients; i++) {
+        ShmControlRing& ring = this->header->rings[i];
+        ring.readIndex.store(ring.writeIndex.load());
+    }
+    this->header->magic = ShmControlMagic;
+    this->semaphore = sem;
+    this->shmName = name;
+
+    this->startThread(8);
+    return true;
+#else
+    ignoreUnused(name);
+    return false;
+#endif
+}
+
+void ShmControlInput::close() {
+#if defined(__linux__)
+    if (this->header == nullptr) {
+        return;
+    }
+    this->signalThreadShouldExit();
+    sem_post((sem_t *)this->semaphore);
+    this->stopThread(500);
+
+    this->header->magic = 0;
+    munmap(this->header, sizeof(ShmControlHeader));
+    sem_close((sem_t *)this->semaphore);
+    shm_unlink(this->shmName.toRawUTF8());
+    sem_unlink((this->shmName + "_sem").toRawUTF8());
+    this->header = nullptr;
+    this->semaphore = nullptr;
+#endif
+}
+
+void ShmControlInput::drain() {
+    uint32 writeIndices[ShmControlMaxClients];
+    bool pending = false;
+    for (uint32 i = 0; i < ShmControlMaxClients; i++) {
+        ShmControlRing& ring = this->header->rings[i];
+        writeIndices[i] = ring.writeIndex.load(memory_order_acquire);
+        pending |= writeIndices[i] != ring.readIndex.load(memory_order_relaxed);
+    }
+    if (! pending) {
+        return;
+    }
+
+    // The records of all the clients are applied under a single lock.
+    this->mainParent->getLockInputs()->lock();
+    for (uint32 i = 0; i < ShmControlMaxClients; i++) {
+        ShmControlRing& ring = this->header->rings[i];
+        uint32 readIndex = ring.readIndex.load(memory_order_relaxed);
+        for (; readIndex != writeIndices[i]; readIndex++) {
+            const ShmPositionRecord& rec = ring.records[readIndex & (ShmControlCapacity - 1)];
+            this->mainParent->updateSourcePosition((unsigned int)rec.id, rec.azi, rec.ele, rec.azispan,
+                                                   rec.elespan, rec.rad, rec.gain);
+        }
+        ring.readIndex.store(readIndex, memory_order_release);
+    }
+    this->mainParent->getLockInputs()->unlock();
+}
+
+void ShmControlInput::run() {
+#if defined(__linux__)
+    while (! this->threadShouldExit()) {
+        this->drain();
+
+        // Sleep until a writer signals new records, with a timeout as a safety net.
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        sem_timedwait((sem_t *)this->semaphore, &ts);
+    }
+#endif
+}
+
+//==============================================================================
+ShmControlWriter::ShmControlWriter() {
+    this->header = nullptr;
+    this->ring = nullptr;
+    this->semaphore = nullptr;
+}
+
+ShmControlWriter::~ShmControlWriter() {
+    this->close();
+}
+
+bool ShmControlWriter::open(const char *name) {
+#if defined(__linux__)
+    this->close();
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return false;
+    }
+    void *mem = mmap(nullptr, sizeof(ShmControlHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    ShmControlHeader *h = (ShmControlHeader *)mem;
+    if (h->magic != ShmControlMagic || h->version != ShmControlVersion ||
+        h->recordSize != sizeof(ShmPositionRecord) || h->capacity != ShmControlCapacity ||
+        h->numRings != ShmControlMaxClients) {
+        munmap(mem, sizeof(ShmControlHeader));
+        return false;
+    }
+
+    // A free ring, or one left by a client that exited without closing.
+    int32 pid = (int32)getpid();
+    ShmControlRing *claimed = nullptr;
+    for (uint32 i = 0; i < ShmControlMaxClients && claimed == nullptr; i++) {
+        int32 owner = h->rings[i].owner.load();
+        if (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        if (h->rings[i].owner.compare_exchange_strong(owner, pid)) {
+            claimed = &h->rings[i];
+        }
+    }
+    if (claimed == nullptr) {
+        munmap(mem, sizeof(ShmControlHeader));
+        return false;
+    }
+
+    sem_t *sem = sem_open((String(name) + "_sem").toRawUTF8(), 0);
+    if (sem == SEM_FAILED) {
+        claimed->owner.store(0);
+        munmap(mem, sizeof(ShmControlHeader));
+        return false;
+    }
+    this->header = h;
+    this->ring = claimed;
+    this->semaphore = sem;
+    return true;
+#else
+    ignoreUnused(name);
+    return false;
+#endif
+}
+
+void ShmControlWriter::close() {
+#if defined(__linux__)
+    if (this->header != nullptr) {
+        this->ring->owner.store(0);
+        munmap(this->header, sizeof(ShmControlHeader));
+        sem_close((sem_t *)this->semaphore);
+    }
+#endif
+    this->header = nullptr;
+    this->ring = nullptr;
+    this->semaphore = nullptr;
+}
+
+int ShmControlWriter::write(const ShmPositionRecord *records, int num) {
+#if defined(__linux__)
+    if (this->header == nullptr) {
+        return 0;
+    }
+    // The ring is this client's only, other clients write in their own.
+    uint32 writeIndex = this->ring->writeIndex.load(memory_order_relaxed);
+    uint32 readIndex = this->ring->readIndex.load(memory_order_acquire);
+    int space = (int)(ShmControlCapacity - (writeIndex - readIndex));
+    int count = jmin(num, space);
+    for (int i = 0; i < count; i++) {
+        this->ring->records[(writeIndex + i) & (ShmControlCapacity - 1)] = records[i];
+    }
+    this->ring->writeIndex.store(writeIndex + count, memory_order_release);
+
+    // sem_post only enters the kernel when the reader is actually waiting.
+    if (count > 0) {
+        sem_post((sem_t *)this->semaphore);
+    }
+    return count;
+#else
+    ignoreUnused(records, num);
+    return 0;
+#endif
+}
@@ -0,0 +1,121 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHMCONTROL_H
+#define SHMCONTROL_H
+
+#include <atomic>
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+class MainContentComponent;
+
+using namespace std;
+
+// Local control channel for clients running on the same machine (ControlGRIS,
+// a DAW, a sequencer). A named shared-memory segment holds one ring of fixed
+// size position records per client, each one single-producer/single-consumer
+// (same indexing scheme as jack_ringbuffer: free running indices masked by a
+// power-of-two capacity). A client claims a free ring when it attaches. A named
+// semaphore wakes the reader after each write. The segment and the semaphore
+// are only open to the user and the group of SpatGRIS. Linux only.
+
+static const char ShmControlDefaultName[] = "/SpatGRIS2_control";
+static const uint32 ShmControlMagic       = 0x43524753; // "SGRC"
+static const uint32 ShmControlVersion     = 2;
+static const uint32 ShmControlCapacity    = 4096;       // Records per ring, power of two.
+static const uint32 ShmControlMaxClients  = 8;
+
+// Same fields as the /spat/serv message, in native byte order.
+struct ShmPositionRecord {
+    int32 id;
+    float azi;
+    float ele;
+    float azispan;
+    float elespan;
+    float rad;
+    float gain;
+};
+
+// Ring of one client, claimed by swapping its pid in the owner field.
+struct ShmControlRing {
+    alignas(64) atomic<int32> owner;        // Pid of the client, 0 if free.
+    alignas(64) atomic<uint32> writeIndex;  // Only written by the owner.
+    alignas(64) atomic<uint32> readIndex;   // Only written by SpatGRIS.
+    alignas(64) ShmPositionRecord records[ShmControlCapacity];
+};
+
+struct ShmControlHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 recordSize;
+    uint32 capacity;
+    uint32 numRings;
+    ShmControlRing rings[ShmControlMaxClients];
+};
+
+//==============================================================================
+// Server side: creates the segment and applies the records to the sources.
+class ShmControlInput : public Thread
+{
+public :
+    ShmControlInput(MainContentComponent *parent);
+    ~ShmControlInput();
+
+    bool open(const char *name = ShmControlDefaultName);
+    void close();
+    bool isOpen() const { return this->header != nullptr; }
+
+    void run() override;
+
+private :
+    void drain();
+
+    MainContentComponent *mainParent;
+    ShmControlHeader *header;
+    void *semaphore;
+    String shmName;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ShmControlInput)
+};
+
+//==============================================================================
+// Client side: attaches to an existing segment, claims a ring and pushes records.
+// Fails if all the rings are in use.
+class ShmControlWriter
+{
+public :
+    ShmControlWriter();
+    ~ShmControlWriter();
+
+    bool open(const char *name = ShmControlDefaultName);
+    void close();
+
+    // Returns the number of records written (less than num when the ring is full).
+    int write(const ShmPositionRecord *records, int num);
+
+private :
+    ShmControlHeader *header;
+    ShmControlRing *ring;
+    void *semaphore;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ShmControlWriter)
+};
+
+#endif /* SHMCONTROL_H */
@@ -0,0 +1,305 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Trajectory.h"
+#include "MainComponent.h"
+#include "Input.h"
+
+static float wrapAzimuth(float azi) {
+    azi = fmodf(azi, M2_PI);
+    return azi < 0.0f ? azi + (float)M2_PI : azi;
+}
+
+//==============================================================================
+Trajectory::Trajectory(TrajectoryType t) {
+    this->type = t;
+}
+
+Trajectory * Trajectory::createFromArguments(const String& type, const Array<float>& params, const String& path) {
+    Trajectory *traj = nullptr;
+    int n = params.size();
+
+    if (type == "circle") {
+        // period, zenith, radius
+        traj = new Trajectory(TrajectoryCircle);
+        if (n > 0) traj->period = params[0];
+        if (n > 1) traj->ele0 = params[1];
+        if (n > 2) traj->rad0 = params[2];
+    } else if (type == "ellipse") {
+        // period, zenith, x axis, y axis
+        traj = new Trajectory(TrajectoryEllipse);
+        if (n > 0) traj->period = params[0];
+        if (n > 1) traj->ele0 = params[1];
+        if (n > 2) traj->rad0 = params[2];
+        traj->rad1 = traj->rad0 * 0.5f;
+        if (n > 3) traj->rad1 = params[3];
+    } else if (type == "spiral") {
+        // period, duration, start zenith, end zenith, start radius, end radius
+        traj = new Trajectory(TrajectorySpiral);
+        if (n > 0) traj->period = params[0];
+        if (n > 1) traj->duration = params[1];
+        if (n > 2) traj->ele0 = params[2];
+        if (n > 3) traj->ele1 = params[3];
+        if (n > 4) traj->rad0 = params[4];
+        if (n > 5) traj->rad1 = params[5];
+    } else if (type == "randomwalk") {
+        // speed, start zenith, radius
+        traj = new Trajectory(TrajectoryRandomWalk);
+        if (n > 0) traj->speed = params[0];
+        if (n > 1) traj->walkEle = params[1];
+        if (n > 2) traj->rad0 = params[2];
+        traj->walkAzi = traj->random.nextFloat() * (float)M2_PI;
+        traj->walkHeading = traj->random.nextFloat() * (float)M2_PI;
+    } else if (type == "spline") {
+        traj = new Trajectory(TrajectorySpline);
+        if (! traj->loadKeyframes(File(path))) {
+            delete traj;
+            return nullptr;
+        }
+    }
+
+    if (traj != nullptr && traj->period == 0.0f) {
+        traj->period = 10.0f;
+    }
+    if (traj != nullptr && traj->duration <= 0.0f) {
+        traj->duration = 30.0f;
+    }
+    return traj;
+}
+
+bool Trajectory::loadKeyframes(const File& file) {
+    // One keyframe per line: time (seconds) azimuth zenith radius. '#' starts a comment.
+    if (! file.existsAsFile()) {
+        return false;
+    }
+    StringArray lines = StringArray::fromLines(file.loadFileAsString());
+    this->keyframes.clear();
+    for (auto& line : lines) {
+        String l = line.upToFirstOccurrenceOf("#", false, false).trim();
+        if (l.isEmpty()) {
+            continue;
+        }
+        StringArray tokens = StringArray::fromTokens(l, " \t,", "");
+        tokens.removeEmptyStrings();
+        if (tokens.size() < 3) {
+            continue;
+        }
+        TrajectoryKeyframe key;
+        key.time = tokens[0].getFloatValue();
+        key.azi = tokens[1].getFloatValue();
+        key.ele = tokens[2].getFloatValue();
+        key.rad = tokens.size() > 3 ? tokens[3].getFloatValue() : 1.0f;
+        if (! this->keyframes.empty() && key.time <= this->keyframes.back().time) {
+            continue;
+        }
+        // Unwrap azimuth so interpolation takes the shortest way around.
+        if (! this->keyframes.empty()) {
+            float prev = this->keyframes.back().azi;
+            while (key.azi - prev > M_PI) key.azi -= M2_PI;
+            while (key.azi - prev < -M_PI) key.azi += M2_PI;
+        }
+        this->keyframes.push_back(key);
+    }
+    return this->keyframes.size() >= 2;
+}
+
+static float catmullRom(float p0, float p1, float p2, float p3, float u) {
+    float u2 = u * u;
+    float u3 = u2 * u;
+    return 0.5f * ((2.0f * p1) + (p2 - p0) * u +
+                   (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u2 +
+                   (3.0f * p1 - p0 - 3.0f * p2 + p3) * u3);
+}
+
+void Trajectory::evaluateSpline(double t, float &azi, float &ele, float &rad) {
+    const int num = (int)this->keyframes.size();
+    const float first = this->keyframes.front().time;
+    const float total = this->keyframes.back().time - first;
+    float tt = first + (total > 0.0f ? fmodf((float)t, total) : 0.0f);
+
+    int i = 0;
+    while (i < num - 2 && this->keyframes[i + 1].time <= tt) {
+        i++;
+    }
+    const TrajectoryKeyframe& k0 = this->keyframes[jmax(i - 1, 0)];
+    const TrajectoryKeyframe& k1 = this->keyframes[i];
+    const TrajectoryKeyframe& k2 = this->keyframes[i + 1];
+    const TrajectoryKeyframe& k3 = this->keyframes[jmin(i + 2, num - 1)];
+    float u = jlimit(0.0f, 1.0f, (tt - k1.time) / (k2.time - k1.time));
+
+    azi = wrapAzimuth(catmullRom(k0.azi, k1.azi, k2.azi, k3.azi, u));
+    ele = jlimit(0.0f, (float)M_PI2, catmullRom(k0.ele, k1.ele, k2.ele, k3.ele, u));
+    rad = jlimit(0.0f, 1.0f, catmullRom(k0.rad, k1.rad, k2.rad, k3.rad, u));
+}
+
+void Trajectory::evaluate(double t, double dt, float &azi, float &ele, float &rad) {
+    float phase = (float)(M2_PI * t / this->period);
+
+    switch (this->type) {
+        case TrajectoryCircle:
+            azi = wrapAzimuth(phase);
+            ele = this->ele0;
+            rad = this->rad0;
+            break;
+        case TrajectoryEllipse: {
+            float x = this->rad0 * cosf(phase);
+            float y = this->rad1 * sinf(phase);
+            azi = wrapAzimuth(atan2f(y, x));
+            ele = this->ele0;
+            rad = jmin(1.0f, sqrtf(x * x + y * y));
+            break;
+        }
+        case TrajectorySpiral: {
+            // Travels back and forth between the start and end points.
+            float p = fmodf((float)(t / this->duration), 2.0f);
+            if (p > 1.0f) {
+                p = 2.0f - p;
+            }
+            azi = wrapAzimuth(phase);
+            ele = this->ele0 + (this->ele1 - this->ele0) * p;
+            rad = this->rad0 + (this->rad1 - this->rad0) * p;
+            break;
+        }
+        case TrajectoryRandomWalk: {
+            // Move along a great circle, with a slowly wandering heading.
+            float x = sinf(this->walkEle) * cosf(this->walkAzi);
+            float y = sinf(this->walkEle) * sinf(this->walkAzi);
+            float z = cosf(this->walkEle);
+            // Tangent basis: east and north at the current point.
+            float ex = -sinf(this->walkAzi), ey = cosf(this->walkAzi), ez = 0.0f;
+            float nx = -cosf(this->walkEle) * cosf(this->walkAzi);
+            float ny = -cosf(this->walkEle) * sinf(this->walkAzi);
+            float nz = sinf(this->walkEle);
+            float hx = cosf(this->walkHeading) * ex + sinf(this->walkHeading) * nx;
+            float hy = cosf(this->walkHeading) * ey + sinf(this->walkHeading) * ny;
+            float hz = cosf(this->walkHeading) * ez + sinf(this->walkHeading) * nz;
+            float d = this->speed * (float)dt;
+            float px = x * cosf(d) + hx * sinf(d);
+            float py = y * cosf(d) + hy * sinf(d);
+            float pz = z * cosf(d) + hz * sinf(d);
+            // Bounce on the horizon and at the top, so the source stays on the dome.
+            if (pz < 0.0f) {
+                pz = -pz;
+                this->walkHeading = -this->walkHeading;
+            }
+            this->walkEle = acosf(jlimit(-1.0f, 1.0f, pz));
+            if (this->walkEle < 0.01f) {
+                this->walkHeading += (float)M_PI;
+            }
+            this->walkAzi = wrapAzimuth(atan2f(py, px));
+            this->walkHeading += (this->random.nextFloat() - 0.5f) * 2.0f * (float)dt;
+            azi = this->walkAzi;
+            ele = this->walkEle;
+            rad = this->rad0;
+            break;
+        }
+        case TrajectorySpline:
+            this->evaluateSpline(t, azi, ele, rad);
+            break;
+        case TrajectoryNone:
+            break;
+    }
+}
+
+//==============================================================================
+TrajectoryEngine::TrajectoryEngine(MainContentComponent *parent) {
+    this->mainParent = parent;
+    for (unsigned int i = 0; i < MaxInputs; i++) {
+        this->trajectories[i] = nullptr;
+    }
+}
+
+TrajectoryEngine::~TrajectoryEngine() {
+    this->stopTimer();
+    this->clearAll();
+}
+
+void TrajectoryEngine::setTrajectory(unsigned int idS, Trajectory *traj) {
+    if (idS >= MaxInputs) {
+        delete traj;
+        return;
+    }
+    if (traj != nullptr) {
+        traj->startTime = traj->lastTime = Time::getMillisecondCounterHiRes() * 0.001;
+    }
+
+    this->lockTrajectories.lock();
+    if (this->trajectories[idS] != nullptr) {
+        delete this->trajectories[idS];
+        this->numActive--;
+    }
+    this->trajectories[idS] = traj;
+    if (traj != nullptr) {
+        this->numActive++;
+    }
+    bool active = this->numActive > 0;
+    this->lockTrajectories.unlock();
+
+    if (active && ! this->isTimerRunning()) {
+        this->startTimer(1000 / TrajectoryRateHz);
+    } else if (! active && this->isTimerRunning()) {
+        this->stopTimer();
+    }
+}
+
+void TrajectoryEngine::clearAll() {
+    this->lockTrajectories.lock();
+    for (unsigned int i = 0; i < MaxInputs; i++) {
+        delete this->trajectories[i];
+        this->trajectories[i] = nullptr;
+    }
+    this->numActive = 0;
+    this->lockTrajectories.unlock();
+}
+
+bool TrajectoryEngine::hasTrajectory(unsigned int idS) {
+    if (idS >= MaxInputs) {
+        return false;
+    }
+    this->lockTrajectories.lock();
+    bool has = this->trajectories[idS] != nullptr;
+    this->lockTrajectories.unlock();
+    return has;
+}
+
+void TrajectoryEngine::hiResTimerCallback() {
+    double now = Time::getMillisecondCounterHiRes() * 0.001;
+    float azi, ele, rad;
+
+    // Same order as the OSC thread: lockInputs, then lockTrajectories.
+    this->mainParent->getLockInputs()->lock();
+    this->lockTrajectories.lock();
+    unsigned int numOfSources = this->mainParent->getListSourceInput().size();
+    for (unsigned int i = 0; i < numOfSources && i < MaxInputs; i++) {
+        Trajectory *traj = this->trajectories[i];
+        if (traj == nullptr) {
+            continue;
+        }
+        traj->evaluate(now - traj->startTime, now - traj->lastTime, azi, ele, rad);
+        traj->lastTime = now;
+
+        Input *input = this->mainParent->getListSourceInput()[i];
+        input->updateValues(azi, ele, input->getAziMuthSpan(), input->getZenithSpan(),
+                            this->mainParent->isRadiusNormalized() ? 1.0f : rad,
+                            input->getGain(), this->mainParent->getModeSelected());
+        this->mainParent->updateInputJack(i, *input);
+    }
+    this->lockTrajectories.unlock();
+    this->mainParent->getLockInputs()->unlock();
+}
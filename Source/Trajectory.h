@@ -0,0 +1,118 @@
+/*
+ This file is part of SpatGRIS2.
+ 
+ Developers: Olivier Belanger, Nicolas Masson
+ 
+ SpatGRIS2 is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ SpatGRIS2 is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with SpatGRIS2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <mutex>
+#include <vector>
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "jackClientGRIS.h"
+
+class MainContentComponent;
+
+using namespace std;
+
+// Server-side source motion. Trajectories produce positions in the units of
+// the /spat/serv message (azimuth 0 .. 2pi, zenith 0 (top) .. pi/2 (horizon),
+// radius 0 .. 1) and are evaluated at control rate by the TrajectoryEngine.
+
+static const int TrajectoryRateHz = 50;
+
+enum TrajectoryType {
+    TrajectoryNone = 0,
+    TrajectoryCircle,
+    TrajectoryEllipse,
+    TrajectorySpiral,
+    TrajectoryRandomWalk,
+    TrajectorySpline
+};
+
+struct TrajectoryKeyframe {
+    float time;
+    float azi;
+    float ele;
+    float rad;
+};
+
+class Trajectory
+{
+public :
+    Trajectory(TrajectoryType t = TrajectoryNone);
+
+    // Build a trajectory from a type name and its parameters, as received by OSC.
+    // Returns nullptr if the type is unknown or the spline file can't be read.
+    static Trajectory * createFromArguments(const String& type, const Array<float>& params,
+                                            const String& path = String());
+
+    bool loadKeyframes(const File& file);
+
+    // t is the time in seconds since the trajectory was started, dt the time since
+    // the previous call.
+    void evaluate(double t, double dt, float &azi, float &ele, float &rad);
+
+    TrajectoryType type;
+    double startTime = 0.0;
+    double lastTime = 0.0;
+
+    float period = 10.0f;       // Seconds per turn.
+    float duration = 30.0f;     // Spiral: seconds to travel from ele0 to ele1.
+    float ele0 = 0.0f;          // Zenith (circle, ellipse, spiral start).
+    float ele1 = 1.5707963f;    // Spiral end zenith.
+    float rad0 = 1.0f;          // Radius (circle, spiral start), ellipse x axis.
+    float rad1 = 1.0f;          // Spiral end radius, ellipse y axis.
+    float speed = 0.5f;         // Random walk: radians per second.
+
+private :
+    void evaluateSpline(double t, float &azi, float &ele, float &rad);
+
+    vector<TrajectoryKeyframe> keyframes;
+    float walkAzi = 0.0f;
+    float walkEle = 0.7853982f;
+    float walkHeading = 0.0f;
+    Random random;
+};
+
+//==============================================================================
+class TrajectoryEngine : private HighResolutionTimer
+{
+public :
+    TrajectoryEngine(MainContentComponent *parent);
+    ~TrajectoryEngine();
+
+    // Takes ownership of traj. A nullptr stops the source's trajectory.
+    // Must not be called with lockInputs held: stopping the timer waits for
+    // a callback that takes it.
+    void setTrajectory(unsigned int idS, Trajectory *traj);
+    void clearAll();
+    bool hasTrajectory(unsigned int idS);
+
+private :
+    void hiResTimerCallback() override;
+
+    MainContentComponent *mainParent;
+    Trajectory *trajectories[MaxInputs];
+    mutex lockTrajectories;
+    int numActive = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TrajectoryEngine)
+};
+
+#endif /* TRAJECTORY_H */
@@ -548,7 +548,7 @@ void WindowEditSpeaker::buttonClicked(Button *button) {
         this->tableListSpeakers.getHeader().setSortColumnId(sortColumnId, sortedForwards);
         this->mainParent->needToComputeVbap = true;
     } else if (button == this->butcompSpeakers) {
-        if (this->mainParent->updateLevelComp()) {
+        if (this->mainParent->updateSpeakerLayout() || this->mainParent->updateLevelComp()) {
             this->mainParent->setShowTriplets(tripletState);
         }
     } else if (button == this->butAddRing) {
@@ -1006,7 +1006,16 @@ void WindowEditSpeaker::setText(const int columnNumber, const int rowNumber, con
             }
         }
         this->updateWinContent();
-        this->mainParent->needToComputeVbap = true;
+        if ((columnNumber == 9 || columnNumber == 10) && this->mainParent->getListSpeaker().size() > (unsigned int)rowNumber) {
+            // Gains and filters are applied right away, only to the edited speakers.
+            this->mainParent->updateSpeakerGainAndFilter(this->mainParent->getListSpeaker()[rowNumber]);
+            for (int i = 0; i < this->tableListSpeakers.getSelectedRows().size(); i++) {
+                int rownum = this->tableListSpeakers.getSelectedRows()[i];
+                this->mainParent->updateSpeakerGainAndFilter(this->mainParent->getListSpeaker()[rownum]);
+            }
+        } else {
+            this->mainParent->needToComputeVbap = true;
+        }
         this->mainParent->getLockSpeakers()->unlock();
     }
 }
@@ -1147,7 +1156,9 @@ ComboBox * WindowProperties::createPropComboBox(const StringArray choices, int s
 
 WindowProperties::WindowProperties(const String& name, Colour backgroundColour, int buttonsNeeded,
                                    MainContentComponent *parent, GrisLookAndFeel *feel, Array<String> devices,
-                                   String currentDevice, int indR, int indB, int indFF, int indFC, int indAttDB, int indAttHz, int oscPort):
+                                   String currentDevice, int indR, int indB, int indFF, int indFC, int indAttDB, int indAttHz, int oscPort,
+                                   int indDeadReck, int indCrossfade, int indSpreadDirs, int indLbapRes, int indBinSpk,
+                                   int indLockMem, int indPrefault, String audioCores, int indHugePages):
     DocumentWindow (name, backgroundColour, buttonsNeeded)
 {
     this->mainParent = parent;
@@ -1160,6 +1171,16 @@ WindowProperties::WindowProperties(const String& name, Colour backgroundColour,
 
     this->labOSCInPort = this->createPropLabel("OSC Input Port :", Justification::left, ypos);
     this->tedOSCInPort = this->createPropIntTextEditor("Port Socket OSC Input", ypos, oscPort);
+    ypos += 30;
+
+    this->labDeadReckoning = this->createPropLabel("Extrapolation :", Justification::left, ypos);
+    this->cobDeadReckoning = this->createPropComboBox(OffOnValues, indDeadReck, ypos);
+    this->cobDeadReckoning->setTooltip("Extrapolate source motion between OSC messages");
+    ypos += 30;
+
+    this->labCrossfade = this->createPropLabel("Crossfade (ms) :", Justification::left, ypos);
+    this->cobCrossfade = this->createPropComboBox(CrossfadeTimes, indCrossfade, ypos);
+    this->cobCrossfade->setTooltip("Fade from the current render when the speaker setup or the mode changes");
     ypos += 40;
 
     this->jackSettingsLabel = this->createPropLabel("Jack Settings", Justification::left, ypos);
@@ -1181,6 +1202,25 @@ WindowProperties::WindowProperties(const String& name, Colour backgroundColour,
 
     this->labBuff = this->createPropLabel("Buffer Size (spls) :", Justification::left, ypos);
     this->cobBuffer = this->createPropComboBox(BufferSizes, indB, ypos);
+    ypos += 30;
+
+    this->labLockMemory = this->createPropLabel("Lock Memory :", Justification::left, ypos);
+    this->cobLockMemory = this->createPropComboBox(OffOnValues, indLockMem, ypos);
+    this->cobLockMemory->setTooltip("Keep all the pages of SpatGRIS in memory");
+    ypos += 30;
+
+    this->labPrefault = this->createPropLabel("Prefault (MB) :", Justification::left, ypos);
+    this->cobPrefault = this->createPropComboBox(PrefaultSizes, indPrefault, ypos);
+    this->cobPrefault->setTooltip("Heap written once, reused by the buffers allocated later");
+    ypos += 30;
+
+    this->labAudioCores = this->createPropLabel("Audio Cores :", Justification::left, ypos);
+    this->tedAudioCores = this->createPropIntTextEditor("Cores of the audio thread, as 2,3 or 2-3, any if empty", ypos, 0);
+    this->tedAudioCores->setInputRestrictions(32, "0123456789,-");
+    this->tedAudioCores->setText(audioCores);
+    ypos += 30;
+
+    this->labRealtimeReport = this->createPropLabel(this->mainParent->getRealtimeReport(), Justification::right, ypos, 240);
     ypos += 40;
 
     this->recordingLabel = this->createPropLabel("Recording Settings", Justification::left, ypos);
@@ -1194,6 +1234,14 @@ WindowProperties::WindowProperties(const String& name, Colour backgroundColour,
     this->recordFileConfig = this->createPropComboBox(FileConfigs, indFC, ypos);
     ypos += 40;
 
+    this->domeLabel = this->createPropLabel("DOME Settings", Justification::left, ypos, 250);
+    ypos += 30;
+
+    this->labSpreadDirs = this->createPropLabel("Spread Directions :", Justification::left, ypos);
+    this->cobSpreadDirs = this->createPropComboBox(VbapSpreadDirections, indSpreadDirs, ypos);
+    this->cobSpreadDirs->setTooltip("Directions summed by a source span, fewer are cheaper, more are smoother");
+    ypos += 40;
+
     this->cubeDistanceLabel = this->createPropLabel("CUBE Distance Settings", Justification::left, ypos, 250);
     ypos += 30;
 
@@ -1203,6 +1251,27 @@ WindowProperties::WindowProperties(const String& name, Colour backgroundColour,
 
     this->labDistanceCutoff = this->createPropLabel("Attenuation (Hz) :", Justification::left, ypos);
     this->cobDistanceCutoff = this->createPropComboBox(AttenuationCutoffs, indAttHz, ypos);
+    ypos += 30;
+
+    this->labLbapResolution = this->createPropLabel("Resolution :", Justification::left, ypos);
+    this->cobLbapResolution = this->createPropComboBox(LbapResolutions, indLbapRes, ypos);
+    this->cobLbapResolution->setTooltip("Size of the CUBE gain matrices, lower fits better in cache");
+    ypos += 30;
+
+    this->labHugePages = this->createPropLabel("Huge Pages :", Justification::left, ypos);
+    this->cobHugePages = this->createPropComboBox(OffOnValues, indHugePages, ypos);
+    this->cobHugePages->setTooltip("Map the CUBE gain matrices on huge pages");
+    ypos += 30;
+
+    this->labLbapReport = this->createPropLabel(this->mainParent->getLbapReport(), Justification::right, ypos, 240);
+    ypos += 40;
+
+    this->binauralLabel = this->createPropLabel("BINAURAL Settings", Justification::left, ypos, 250);
+    ypos += 30;
+
+    this->labBinauralSpeakers = this->createPropLabel("Virtual Speakers :", Justification::left, ypos);
+    this->cobBinauralSpeakers = this->createPropComboBox(BinauralVirtualSpeakers, indBinSpk, ypos);
+    this->cobBinauralSpeakers->setTooltip("Number of virtual speakers rendered to the headphones");
     ypos += 40;
 
     this->butValidSettings = new TextButton();
@@ -1219,12 +1288,34 @@ WindowProperties::~WindowProperties() {
     delete this->jackSettingsLabel;
     delete this->recordingLabel;
     delete this->labOSCInPort;
+    delete this->labDeadReckoning;
+    delete this->cobDeadReckoning;
+    delete this->labCrossfade;
+    delete this->cobCrossfade;
+    delete this->domeLabel;
+    delete this->labSpreadDirs;
+    delete this->cobSpreadDirs;
+    delete this->labLbapResolution;
+    delete this->cobLbapResolution;
+    delete this->labHugePages;
+    delete this->cobHugePages;
+    delete this->labLbapReport;
+    delete this->binauralLabel;
+    delete this->labBinauralSpeakers;
+    delete this->cobBinauralSpeakers;
     if (this->cobDevice != nullptr) {
         delete this->labDevice;
         delete this->cobDevice;
     }
     delete this->labRate;
     delete this->labBuff;
+    delete this->labLockMemory;
+    delete this->cobLockMemory;
+    delete this->labPrefault;
+    delete this->cobPrefault;
+    delete this->labAudioCores;
+    delete this->tedAudioCores;
+    delete this->labRealtimeReport;
     delete this->labRecFormat;
     delete this->labRecFileConfig;
     delete this->tedOSCInPort;
@@ -1249,7 +1340,16 @@ void WindowProperties::buttonClicked(Button *button) {
                                          this->recordFileConfig->getSelectedItemIndex(),
                                          this->cobDistanceDB->getSelectedItemIndex(),
                                          this->cobDistanceCutoff->getSelectedItemIndex(),
-                                         this->tedOSCInPort->getTextValue().toString().getIntValue());
+                                         this->tedOSCInPort->getTextValue().toString().getIntValue(),
+                                         this->cobDeadReckoning->getSelectedItemIndex(),
+                                         this->cobCrossfade->getSelectedItemIndex(),
+                                         this->cobSpreadDirs->getSelectedItemIndex(),
+                                         this->cobLbapResolution->getSelectedItemIndex(),
+                                         this->cobBinauralSpeakers->getSelectedItemIndex(),
+                                         this->cobLockMemory->getSelectedItemIndex(),
+                                         this->cobPrefault->getSelectedItemIndex(),
+                                         this->tedAudioCores->getText(),
+                                         this->cobHugePages->getSelectedItemIndex());
         delete this;
     }
 }
@@ -1384,10 +1484,10 @@ OscLogWindow::~OscLogWindow() {
 
 void OscLogWindow::addToLog(String msg) {
     if (this->activated) {
-        this->index++;
-
+        // The OSC receiver threads log concurrently, they are serialized here.
         const MessageManagerLock mmLock;
 
+        this->index++;
         this->logger.insertTextAtCaret(msg);
 
         if (this->index == 500) {
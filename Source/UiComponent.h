@@ -282,7 +282,8 @@ public:
     WindowProperties(const String& name, Colour backgroundColour, int buttonsNeeded,
                       MainContentComponent *parent, GrisLookAndFeel *feel, Array<String> devices,
                       String currentDevice, int indR=0, int indB=0, int indFF=0, int indFC=0, int indAttDB=2, int indAttHz=3,
-                      int oscPort=18032);
+                      int oscPort=18032, int indDeadReck=0, int indCrossfade=2, int indSpreadDirs=1, int indLbapRes=1, int indBinSpk=0,
+                      int indLockMem=0, int indPrefault=0, String audioCores=String(), int indHugePages=0);
     ~WindowProperties();
 
     Label * createPropLabel(String lab, Justification::Flags just, int ypos, int width=100);
@@ -299,11 +300,19 @@ private:
     Label *generalLabel;
     Label *jackSettingsLabel;
     Label *recordingLabel;
+    Label *domeLabel;
     Label *cubeDistanceLabel;
+    Label *binauralLabel;
 
     Label *labOSCInPort;
     TextEditor *tedOSCInPort;
 
+    Label *labDeadReckoning;
+    ComboBox *cobDeadReckoning;
+
+    Label *labCrossfade;
+    ComboBox *cobCrossfade;
+
     Label *labDevice;
     ComboBox *cobDevice = nullptr;
 
@@ -313,6 +322,16 @@ private:
     Label *labBuff;
     ComboBox *cobBuffer;
 
+    Label *labLockMemory;
+    ComboBox *cobLockMemory;
+
+    Label *labPrefault;
+    ComboBox *cobPrefault;
+
+    Label *labAudioCores;
+    TextEditor *tedAudioCores;
+    Label *labRealtimeReport;
+
     Label *labRecFormat;
     ComboBox *recordFormat;
 
@@ -325,6 +344,18 @@ private:
     Label *labDistanceCutoff;
     ComboBox *cobDistanceCutoff;
 
+    Label *labSpreadDirs;
+    ComboBox *cobSpreadDirs;
+
+    Label *labLbapResolution;
+    ComboBox *cobLbapResolution;
+    Label *labHugePages;
+    ComboBox *cobHugePages;
+    Label *labLbapReport;
+
+    Label *labBinauralSpeakers;
+    ComboBox *cobBinauralSpeakers;
+
     TextButton *butValidSettings;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WindowProperties)
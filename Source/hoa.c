@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hoa.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define HOA_USE_SSE 1
+#endif
+
+#ifndef M_PI
+#define M_PI    (3.14159265358979323846264338327950288)
+#endif
+
+/* Directions evaluated together, the inner loops run over a batch. */
+#define HOA_BATCH_SIZE 16
+
+/* =================================================================================
+Utility functions.
+================================================================================= */
+
+/* SN3D normalization of the harmonics of degree n and order m >= 0. */
+static double
+hoa_sn3d(int n, int m) {
+    int i;
+    double ratio = 1.0;
+    for (i=n-m+1; i<=n+m; i++) {
+        ratio /= i;
+    }
+    return sqrt((m == 0 ? 1.0 : 2.0) * ratio);
+}
+
+/* Inverts the n x n matrix `a` in place (Gauss-Jordan with partial
+ * pivoting). Returns -1 if the matrix is singular. */
+static int
+hoa_invert(double *a, int n) {
+    int i, j, k, p;
+    double max, tmp, *inv;
+
+    inv = (double *)calloc(n * n, sizeof(double));
+    for (i=0; i<n; i++) {
+        inv[i * n + i] = 1.0;
+    }
+    for (k=0; k<n; k++) {
+        p = k;
+        max = fabs(a[k * n + k]);
+        for (i=k+1; i<n; i++) {
+            if (fabs(a[i * n + k]) > max) {
+                max = fabs(a[i * n + k]);
+                p = i;
+            }
+        }
+        if (max < 1e-12) {
+            free(inv);
+            return -1;
+        }
+        if (p != k) {
+            for (j=0; j<n; j++) {
+                tmp = a[k * n + j]; a[k * n + j] = a[p * n + j]; a[p * n + j] = tmp;
+                tmp = inv[k * n + j]; inv[k * n + j] = inv[p * n + j]; inv[p * n + j] = tmp;
+            }
+        }
+        tmp = 1.0 / a[k * n + k];
+        for (j=0; j<n; j++) {
+            a[k * n + j] *= tmp;
+            inv[k * n + j] *= tmp;
+        }
+        for (i=0; i<n; i++) {
+            if (i != k && a[i * n + k] != 0.0) {
+                tmp = a[i * n + k];
+                for (j=0; j<n; j++) {
+                    a[i * n + j] -= tmp * a[k * n + j];
+                    inv[i * n + j] -= tmp * inv[k * n + j];
+                }
+            }
+        }
+    }
+    memcpy(a, inv, sizeof(double) * n * n);
+    free(inv);
+    return 0;
+}
+
+/* =================================================================================
+====================================================================================
+Ambisonics interface implementation.
+====================================================================================
+================================================================================= */
+
+int
+hoa_get_num_channels(int order) {
+    return (order + 1) * (order + 1);
+}
+
+void
+hoa_evaluate_batch(int order, const float *azimuths, const float *elevations,
+                   int num, float **coeffs) {
+    int b, i, m, n, count;
+    float norm[HOA_MAX_ORDER+1][HOA_MAX_ORDER+1];
+    float sinele[HOA_BATCH_SIZE], cosele[HOA_BATCH_SIZE];
+    float cosazi[HOA_BATCH_SIZE], sinazi[HOA_BATCH_SIZE];
+    float cosm[HOA_BATCH_SIZE], sinm[HOA_BATCH_SIZE], tmp[HOA_BATCH_SIZE];
+    float pmm[HOA_BATCH_SIZE], p0[HOA_BATCH_SIZE], p1[HOA_BATCH_SIZE], p2[HOA_BATCH_SIZE];
+    float toRad = (float)(M_PI / 180.0);
+
+    if (order > HOA_MAX_ORDER) {
+        order = HOA_MAX_ORDER;
+    }
+    for (n=0; n<=order; n++) {
+        for (m=0; m<=n; m++) {
+            norm[n][m] = (float)hoa_sn3d(n, m);
+        }
+    }
+
+    for (b=0; b<num; b+=HOA_BATCH_SIZE) {
+        count = num - b < HOA_BATCH_SIZE ? num - b : HOA_BATCH_SIZE;
+        for (i=0; i<count; i++) {
+            sinele[i] = sinf(elevations[b+i] * toRad);
+            cosele[i] = cosf(elevations[b+i] * toRad);
+            cosazi[i] = cosf(azimuths[b+i] * toRad);
+            sinazi[i] = sinf(azimuths[b+i] * toRad);
+            cosm[i] = 1.0f;
+            sinm[i] = 0.0f;
+            pmm[i] = 1.0f;
+            p1[i] = p2[i] = 0.0f;
+        }
+
+        /* Associated Legendre functions by increasing order m, without
+         * the Condon-Shortley phase. */
+        for (m=0; m<=order; m++) {
+            if (m > 0) {
+                for (i=0; i<count; i++) {
+                    pmm[i] *= (2 * m - 1) * cosele[i];
+                    tmp[i] = cosm[i] * cosazi[i] - sinm[i] * sinazi[i];
+                    sinm[i] = sinm[i] * cosazi[i] + cosm[i] * sinazi[i];
+                    cosm[i] = tmp[i];
+                }
+            }
+            for (n=m; n<=order; n++) {
+                for (i=0; i<count; i++) {
+                    if (n == m) {
+                        p0[i] = pmm[i];
+                    } else if (n == m + 1) {
+                        p0[i] = (2 * m + 1) * sinele[i] * p1[i];
+                    } else {
+                        p0[i] = ((2 * n - 1) * sinele[i] * p1[i] - (n + m - 1) * p2[i]) / (n - m);
+                    }
+                    p2[i] = p1[i];
+                    p1[i] = p0[i];
+                }
+                for (i=0; i<count; i++) {
+                    coeffs[b+i][n * n + n + m] = norm[n][m] * p0[i] * cosm[i];
+                    if (m > 0) {
+                        coeffs[b+i][n * n + n - m] = norm[n][m] * p0[i] * sinm[i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+hoa_encode(const float *in, int nframes, const float *from, const float *to,
+           int channels, float **outs) {
+    int c, f;
+    float gain, step, *out;
+#ifdef HOA_USE_SSE
+    __m128 vgain, vstep;
+#endif
+
+    for (c=0; c<channels; c++) {
+        if (from[c] == 0.0f && to[c] == 0.0f) {
+            continue;
+        }
+        out = outs[c];
+        step = (to[c] - from[c]) / nframes;
+        gain = from[c];
+        f = 0;
+#ifdef HOA_USE_SSE
+        vgain = _mm_setr_ps(gain + step, gain + 2 * step, gain + 3 * step, gain + 4 * step);
+        vstep = _mm_set1_ps(4 * step);
+        for (; f+4<=nframes; f+=4) {
+            _mm_storeu_ps(out + f, _mm_add_ps(_mm_loadu_ps(out + f),
+                                              _mm_mul_ps(_mm_loadu_ps(in + f), vgain)));
+            vgain = _mm_add_ps(vgain, vstep);
+        }
+#endif
+        for (; f<nframes; f++) {
+            out[f] += in[f] * (gain + step * (f + 1));
+        }
+    }
+}
+
+int
+hoa_decoder_matrix(int order, const float *azimuths, const float *elevations,
+                   int count, float regularization, float *matrix) {
+    int i, j, k, c, channels = hoa_get_num_channels(order);
+    float *harmonics, **rows;
+    double trace = 0.0, *gram, sum;
+
+    harmonics = (float *)malloc(sizeof(float) * count * channels);
+    rows = (float **)malloc(sizeof(float *) * count);
+    for (i=0; i<count; i++) {
+        rows[i] = harmonics + i * channels;
+    }
+    hoa_evaluate_batch(order, azimuths, elevations, count, rows);
+
+    /* D = Y^T (Y Y^T + lambda I)^-1, Y being [channels][count]. */
+    gram = (double *)calloc(channels * channels, sizeof(double));
+    for (j=0; j<channels; j++) {
+        for (k=j; k<channels; k++) {
+            sum = 0.0;
+            for (i=0; i<count; i++) {
+                sum += (double)rows[i][j] * rows[i][k];
+            }
+            gram[j * channels + k] = gram[k * channels + j] = sum;
+        }
+        trace += gram[j * channels + j];
+    }
+    for (j=0; j<channels; j++) {
+        gram[j * channels + j] += regularization * trace / channels;
+    }
+    if (hoa_invert(gram, channels) != 0) {
+        free(gram);
+        free(rows);
+        free(harmonics);
+        return -1;
+    }
+
+    for (i=0; i<count; i++) {
+        for (c=0; c<channels; c++) {
+            sum = 0.0;
+            for (k=0; k<channels; k++) {
+                sum += rows[i][k] * gram[k * channels + c];
+            }
+            matrix[i * channels + c] = (float)sum;
+        }
+    }
+
+    free(gram);
+    free(rows);
+    free(harmonics);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/** \file hoa.h
+ *  \brief Higher order ambisonics encoding and decoding.
+ *
+ * Real spherical harmonics in ACN order with SN3D normalization. A
+ * direction is encoded as the values of the harmonics up to an order,
+ * and a set of directions (virtual speakers or measured impulse 
+ * responses) is decoded with a regularized least squares matrix.
+ *
+ * Angles are in degrees, azimuth counter-clockwise from the front and
+ * elevation up from the horizontal plane.
+ */
+
+#ifndef __HOA_H
+#define __HOA_H
+
+#ifdef __cplusplus 
+extern "C" {
+#endif
+
+/* Highest supported order. */
+#define HOA_MAX_ORDER 7
+
+/** \brief Returns the number of channels of an order, (order + 1)^2.
+ */
+int hoa_get_num_channels(int order);
+
+/** \brief Evaluates the spherical harmonics for a batch of directions.
+ *
+ * This function writes the `hoa_get_num_channels(order)` values of the 
+ * harmonics for the direction of `azimuths[i]` and `elevations[i]` in 
+ * `coeffs[i]`, for the `num` directions.
+ */
+void hoa_evaluate_batch(int order, const float *azimuths, const float *elevations,
+                        int num, float **coeffs);
+
+/** \brief Adds a signal encoded with ramped coefficients to the channels.
+ *
+ * The coefficients go linearly from `from` to `to` over the `nframes`
+ * frames of `in`, and the encoded signal is added to the `channels`
+ * arrays of `outs`.
+ */
+void hoa_encode(const float *in, int nframes, const float *from, const float *to,
+                int channels, float **outs);
+
+/** \brief Computes a decoder for a set of directions.
+ *
+ * This function computes the matrix giving the gains of `count` 
+ * directions from the channels of an order, the pseudo-inverse of the
+ * harmonics of the directions. `regularization` (relative to the mean
+ * energy of the harmonics) keeps the inverse stable when the directions
+ * do not cover the sphere. The matrix is written in `matrix` as 
+ * [count][channels].
+ *
+ * \return 0 on success, -1 if the matrix can't be inverted.
+ */
+int hoa_decoder_matrix(int order, const float *azimuths, const float *elevations,
+                       int count, float regularization, float *matrix);
+
+#ifdef __cplusplus 
+}
+#endif
+
+#endif /* __HOA_H */
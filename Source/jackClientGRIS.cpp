@@ -18,6 +18,7 @@
 */
 
 #include <stdarg.h>
+#include <algorithm>
 #include "ServerGrisConstants.h"
 #include "jackClientGRIS.h"
 #include "vbap.h"
@@ -26,6 +27,11 @@
 
 static bool jack_client_log_print = false;
 
+// Dead reckoning limits.
+static const float DeadReckoningMaxGap     = 0.5f;   // Seconds without update before motion is dropped.
+static const float DeadReckoningMaxHorizon = 0.25f;  // Maximum extrapolation in seconds.
+static const float DeadReckoningGlide      = 0.02f;  // Time constant toward the extrapolated direction.
+
 // Utilities.
 static bool int_vector_contains(vector<int> vec, int value) {
     return (std::find(vec.begin(), vec.end(), value) != vec.end());
@@ -65,7 +71,7 @@ static void muteSoloVuMeterIn(jackClientGris &jackCli, jack_default_audio_sample
     }
 }
 
-static void muteSoloVuMeterGainOut(jackClientGris &jackCli, jack_default_audio_sample_t **outs,
+static void muteSoloVuMeterGainOut(jackClientGris &jackCli, const RenderPlan &plan, jack_default_audio_sample_t **outs,
                                    const jack_nframes_t &nframes, const unsigned int &sizeOutputs,
                                    const float mGain = 1.0f) {
     unsigned int num_of_channels = 2;
@@ -77,23 +83,23 @@ static void muteSoloVuMeterGainOut(jackClientGris &jackCli, jack_default_audio_s
     }
     
     for (unsigned int i = 0; i < sizeOutputs; ++i) {
-        if (jackCli.listSpeakerOut[i].isMuted) { // Mute
+        if (plan.speakers[i].isMuted) { // Mute
             memset(outs[i], 0, sizeof(jack_default_audio_sample_t) * nframes);
         } else if (jackCli.soloOut) { // Solo
-            if (!jackCli.listSpeakerOut[i].isSolo) {
+            if (!plan.speakers[i].isSolo) {
                 memset(outs[i], 0, sizeof(jack_default_audio_sample_t) * nframes);
             }
         }
 
         // Speaker independent gain.
-        gain = jackCli.listSpeakerOut[i].gain;
+        gain = plan.speakers[i].gain;
         for (unsigned int f = 0; f < nframes; ++f) {
             outs[i][f] *= gain * mGain;
         }
 
         // Speaker independent crossover filter.
-        if (jackCli.listSpeakerOut[i].hpActive) {
-            SpeakerOut so = jackCli.listSpeakerOut[i];
+        if (plan.speakers[i].hpActive) {
+            const SpeakerOut &so = plan.speakers[i];
             for (unsigned int f = 0; f < nframes; ++f) {
                 inval = (double)outs[i][f];
                 val = so.ha0 * inval + so.ha1 * jackCli.x1[i] + so.ha2 * jackCli.x2[i] +
@@ -173,9 +179,138 @@ static void addNoiseSound(jackClientGris &jackCli, jack_default_audio_sample_t *
     }
 }
 
+// Copies the last published motion of a source. A snapshot being written is
+// retried a few times, then the previous one is kept until the next period.
+static void loadSourceMotion(SourceIn &si) {
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint32_t seq = si.dr_seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        SourceMotion motion = si.dr_shared;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (si.dr_seq.load(std::memory_order_relaxed) == seq) {
+            if (motion.valid && !si.dr_motion.valid) {
+                // First position or tracking restarted: no glide from the old direction.
+                for (int j = 0; j < 3; j++) {
+                    si.dr_cur[j] = motion.pos[j];
+                }
+            }
+            si.dr_motion = motion;
+            return;
+        }
+    }
+}
+
+static void publishSourceMotion(SourceIn &si) {
+    uint32_t seq = si.dr_seq.load(std::memory_order_relaxed);
+    si.dr_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    si.dr_shared = si.dr_next;
+    si.dr_seq.store(seq + 2, std::memory_order_release);
+}
+
+// Rendered direction of a dead reckoned source, azimuth and elevation in radians.
+static void deadReckoningDirection(const SourceIn &si, float &azi, float &ele) {
+    const float *cur = si.dr_cur;
+    azi = atan2f(cur[1], cur[0]);
+    ele = asinf(cur[2] > 1.0f ? 1.0f : (cur[2] < -1.0f ? -1.0f : cur[2]));
+}
+
+// Dead reckoning: extrapolates the last received direction along its great circle
+// motion (bounded by its horizon) and glides the rendered direction toward it, so a
+// new position is blended in instead of jumped to. The rendered direction is
+// renormalized at every step, it always stays on the sphere. Gives the rendered
+// azimuth and elevation (radians) and returns true if it moved.
+static bool deadReckoningStep(jackClientGris &jackCli, SourceIn &si, const jack_nframes_t &now,
+                              const jack_nframes_t &nframes, float &azi, float &ele) {
+    loadSourceMotion(si);
+    const SourceMotion &m = si.dr_motion;
+    if (!m.valid) {
+        return false;
+    }
+
+    // Signed, the position may have been received after this cycle started.
+    int32_t elapsed = (int32_t)(now - m.time);
+    if (elapsed < 0) {
+        elapsed = 0;
+    } else if (elapsed > (int32_t)m.horizon) {
+        elapsed = (int32_t)m.horizon;
+    }
+    float theta = m.omega * elapsed;
+    float c = cosf(theta), s = sinf(theta);
+    const float *p = m.pos, *k = m.axis;
+    float target[3] = {p[0] * c + (k[1] * p[2] - k[2] * p[1]) * s,
+                       p[1] * c + (k[2] * p[0] - k[0] * p[2]) * s,
+                       p[2] * c + (k[0] * p[1] - k[1] * p[0]) * s};
+
+    float alpha = 1.0f - expf(-(float)nframes / (DeadReckoningGlide * jackCli.sampleRate));
+    float cur[3], norm = 0.0f, moved = 0.0f;
+    for (int j = 0; j < 3; j++) {
+        cur[j] = si.dr_cur[j] + (target[j] - si.dr_cur[j]) * alpha;
+        norm += cur[j] * cur[j];
+    }
+    norm = norm > 0.0f ? 1.0f / sqrtf(norm) : 0.0f;
+    for (int j = 0; j < 3; j++) {
+        cur[j] *= norm;
+        moved += fabsf(cur[j] - si.dr_cur[j]);
+        si.dr_cur[j] = cur[j];
+    }
+
+    deadReckoningDirection(si, azi, ele);
+    return moved > 1e-6f;
+}
+
+// Advances the dead reckoning and gathers the sources that have moved, once
+// per period for all the render targets.
+static void collectMovedSources(jackClientGris &jackCli, const jack_nframes_t &nframes, const unsigned int &sizeInputs) {
+    float azi, ele;
+    jack_nframes_t now = jack_last_frame_time(jackCli.client);
+    float toDegrees = 180.0f / M_PI;
+    int *ids = jackCli.movedSources.ids, num = 0;
+    float *azimuths = jackCli.movedSources.azimuths, *zeniths = jackCli.movedSources.zeniths;
+
+    for (unsigned int i = 0; i < sizeInputs; ++i) {
+        if (jackCli.deadReckoning &&
+            (deadReckoningStep(jackCli, jackCli.listSourceIn[i], now, nframes, azi, ele) ||
+             (jackCli.vbapSourcesToUpdate[i] == 1 && jackCli.listSourceIn[i].dr_motion.valid))) {
+            ids[num] = i;
+            azimuths[num] = azi * toDegrees;
+            zeniths[num++] = ele * toDegrees;
+            jackCli.vbapSourcesToUpdate[i] = 0;
+        } else if (jackCli.vbapSourcesToUpdate[i] == 1) {
+            ids[num] = i;
+            azimuths[num] = jackCli.listSourceIn[i].azimuth;
+            zeniths[num++] = jackCli.listSourceIn[i].zenith;
+            jackCli.vbapSourcesToUpdate[i] = 0;
+        }
+    }
+    jackCli.movedSources.num = num;
+}
+
+// Recomputes the VBAP gains of sources that have moved.
+static void updateVbapSources(jackClientGris &jackCli, RenderPlan &plan) {
+    SourceMoves &moves = jackCli.movedSources;
+
+    // All the sources that moved are computed together.
+    if (moves.num > 0) {
+        jackCli.updateSourcesVbap(plan, moves.ids, moves.azimuths, moves.zeniths, moves.num);
+    }
+}
+
+// Recomputes the ambisonic encoding gains of sources that have moved.
+static void updateHoaSources(jackClientGris &jackCli, RenderPlan &plan) {
+    SourceMoves &moves = jackCli.movedSources;
+
+    if (moves.num > 0) {
+        jackCli.updateSourcesHoa(plan, moves.ids, moves.azimuths, moves.zeniths, moves.num);
+    }
+}
+
 // VBAP processing function.
-static void processVBAP(jackClientGris &jackCli, jack_default_audio_sample_t **ins, jack_default_audio_sample_t **outs,
-                        const jack_nframes_t &nframes, const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+static void processVBAP(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                        jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                        const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
 {
     unsigned int f, i, o, ilinear;
     float y, interpG = 0.99, iogain = 0.0;
@@ -187,19 +322,14 @@ static void processVBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
         interpG = powf(jackCli.interMaster, 0.1) * 0.0099 + 0.99;
     }
 
-    for (i = 0; i < sizeInputs; ++i) {
-        if (jackCli.vbapSourcesToUpdate[i] == 1) {
-            jackCli.updateSourceVbap(i);
-            jackCli.vbapSourcesToUpdate[i] = 0;
-        }
-    }
+    updateVbapSources(jackCli, plan);
 
     for (o = 0; o < sizeOutputs; ++o) {
         memset(outs[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
         for (i = 0; i < sizeInputs; ++i) {
-            if (!jackCli.listSourceIn[i].directOut && jackCli.listSourceIn[i].paramVBap != nullptr) {
-                iogain = jackCli.listSourceIn[i].paramVBap->gains[o];
-                y = jackCli.listSourceIn[i].paramVBap->y[o];
+            if (!jackCli.listSourceIn[i].directOut && plan.vbap[i] != nullptr) {
+                iogain = plan.vbap[i]->gains[o];
+                y = plan.vbap[i]->y[o];
                 if (ilinear) {
                     interpG = (iogain - y) / nframes;
                     for (f = 0; f < nframes; ++f) {
@@ -216,7 +346,7 @@ static void processVBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
                         }
                     }
                 }
-                jackCli.listSourceIn[i].paramVBap->y[o] = y;
+                plan.vbap[i]->y[o] = y;
             } else if ((unsigned int)(jackCli.listSourceIn[i].directOut - 1) == o) {
                 for (f = 0; f < nframes; ++f) {
                     outs[o][f] += ins[i][f];
@@ -227,12 +357,17 @@ static void processVBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
 }
 
 // LBAP processing function.
-static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **ins, jack_default_audio_sample_t **outs,
-                        const jack_nframes_t &nframes, const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+static void processLBAP(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                        jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                        const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
 {
     unsigned int f, i, o, ilinear;
     float y, gain, distance, distgain , distcoef, interpG = 0.99;
+    float azi, ele;
     lbap_pos pos;
+    lbap_pos positions[MaxInputs];
+    float *gains[MaxInputs];
+    unsigned int ids[MaxInputs], num = 0;
 
     float filteredInputSignal[2048];
     memset(filteredInputSignal, 0, sizeof(float) * nframes);
@@ -248,19 +383,37 @@ static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
         memset(outs[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
     }
 
+    // Gains of the sources that moved, computed together.
     for (i = 0; i < sizeInputs; ++i) {
         if (!jackCli.listSourceIn[i].directOut) {
-            lbap_pos_init_from_radians(&pos,
-                                       jackCli.listSourceIn[i].radazi,
-                                       jackCli.listSourceIn[i].radele,
-                                       jackCli.listSourceIn[i].radius);
+            azi = jackCli.listSourceIn[i].radazi;
+            ele = jackCli.listSourceIn[i].radele;
+            if (jackCli.deadReckoning && jackCli.listSourceIn[i].dr_motion.valid) {
+                deadReckoningDirection(jackCli.listSourceIn[i], azi, ele);
+                if (ele < 0.0f) {
+                    ele = 0.0f;
+                }
+            }
+            lbap_pos_init_from_radians(&pos, azi, ele, jackCli.listSourceIn[i].radius);
             pos.radspan = jackCli.listSourceIn[i].aziSpan;
             pos.elespan = jackCli.listSourceIn[i].zenSpan;
-            distance = jackCli.listSourceIn[i].radius;
-            if (!lbap_pos_compare(&pos, &jackCli.listSourceIn[i].lbap_last_pos)) {
-                lbap_field_compute(jackCli.lbap_speaker_field, &pos, jackCli.listSourceIn[i].lbap_gains);
-                lbap_pos_copy(&jackCli.listSourceIn[i].lbap_last_pos, &pos);
+            if (!lbap_pos_compare(&pos, &plan.lbap[i].pos)) {
+                positions[num] = pos;
+                gains[num] = plan.lbap[i].gains;
+                ids[num++] = i;
             }
+        }
+    }
+    if (num > 0) {
+        lbap_field_compute_batch(plan.lbapField, positions, gains, num);
+        for (i = 0; i < num; ++i) {
+            lbap_pos_copy(&plan.lbap[ids[i]].pos, &positions[i]);
+        }
+    }
+
+    for (i = 0; i < sizeInputs; ++i) {
+        if (!jackCli.listSourceIn[i].directOut) {
+            distance = jackCli.listSourceIn[i].radius;
 
             // Energy lost with distance, radius is in the range 0 - 2.6 (>1 is beyond HP circle).
             if (distance < 1.0f) {
@@ -275,12 +428,12 @@ static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
                 distgain = (1.0f - distance) * (1.0f - jackCli.attenuationLinearGain[0]) + jackCli.attenuationLinearGain[0];
                 distcoef = distance * jackCli.attenuationLowpassCoeff[0];
             }
-            float diffgain = (distgain - jackCli.lastAttenuationGain[i]) / nframes;
-            float diffcoef = (distcoef - jackCli.lastAttenuationCoef[i]) / nframes;
-            float filtInY = jackCli.attenuationLowpassY[i];
-            float filtInZ = jackCli.attenuationLowpassZ[i];
-            float lastcoef = jackCli.lastAttenuationCoef[i];
-            float lastgain = jackCli.lastAttenuationGain[i];
+            float diffgain = (distgain - plan.lastAttenuationGain[i]) / nframes;
+            float diffcoef = (distcoef - plan.lastAttenuationCoef[i]) / nframes;
+            float filtInY = plan.attenuationLowpassY[i];
+            float filtInZ = plan.attenuationLowpassZ[i];
+            float lastcoef = plan.lastAttenuationCoef[i];
+            float lastgain = plan.lastAttenuationGain[i];
             for (unsigned int k =0; k < nframes; k++) {
                 lastcoef += diffcoef;
                 lastgain += diffgain;
@@ -288,15 +441,15 @@ static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
                 filtInZ = filtInY + (filtInZ - filtInY) * lastcoef;
                 filteredInputSignal[k] = filtInZ * lastgain;
             }
-            jackCli.attenuationLowpassY[i] = filtInY;
-            jackCli.attenuationLowpassZ[i] = filtInZ;
-            jackCli.lastAttenuationGain[i] = distgain;
-            jackCli.lastAttenuationCoef[i] = distcoef;
+            plan.attenuationLowpassY[i] = filtInY;
+            plan.attenuationLowpassZ[i] = filtInZ;
+            plan.lastAttenuationGain[i] = distgain;
+            plan.lastAttenuationCoef[i] = distcoef;
             //----------------------------------------------------------------------------------------
 
             for (o = 0; o < sizeOutputs; ++o) {
-                gain = jackCli.listSourceIn[i].lbap_gains[o];
-                y = jackCli.listSourceIn[i].lbap_y[o];
+                gain = plan.lbap[i].gains[o];
+                y = plan.lbap[i].y[o];
                 if (ilinear) {
                     interpG = (gain - y) / nframes;
                     for (f = 0; f < nframes; ++f) {
@@ -313,7 +466,7 @@ static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
                         }
                     }
                 }
-                jackCli.listSourceIn[i].lbap_y[o] = y;
+                plan.lbap[i].y[o] = y;
             }
         } else {
             for (o = 0; o < sizeOutputs; ++o) {
@@ -327,14 +480,89 @@ static void processLBAP(jackClientGris &jackCli, jack_default_audio_sample_t **i
     }
 }
 
+// Partition size of the binaural convolution for this period, 0 while the
+// setup isn't ready for it (only the direct outs are heard then).
+static unsigned int getBinauralBlock(BinauralSetup *binaural, const jack_nframes_t &nframes) {
+    if (binaural != nullptr && binaural->conv != nullptr && nframes == binaural->periodFrames) {
+        return partconv_get_block_size(binaural->conv);
+    }
+    return 0;
+}
+
+// Filters the feeds of the binaural setup into the two first outputs. Each
+// feed is transformed once, its spectra are filtered and summed per ear
+// before the inverse transform.
+static void convolveBinaural(BinauralSetup *binaural, unsigned int block, jack_default_audio_sample_t **outs,
+                             const jack_nframes_t &nframes) {
+    unsigned int f, o;
+    float *convIns[MaxOutputs], *convOuts[2];
+
+    if (block != 0 && binaural->latency != 0) {
+        // Whole blocks are filtered from the FIFO, the outputs are the
+        // ones of the previous block.
+        unsigned int count;
+        for (o = 0; o < binaural->numSpeakers; ++o) {
+            convIns[o] = binaural->fifo + o * block;
+        }
+        convOuts[0] = binaural->fifo + binaural->numSpeakers * block;
+        convOuts[1] = convOuts[0] + block;
+        for (f = 0; f < nframes; f += count) {
+            count = jmin(block - binaural->fifoFill, nframes - f);
+            for (o = 0; o < binaural->numSpeakers; ++o) {
+                memcpy(convIns[o] + binaural->fifoFill, binaural->feeds + o * binaural->feedFrames + f,
+                       sizeof(float) * count);
+            }
+            memcpy(outs[0] + f, convOuts[0] + binaural->fifoFill, sizeof(float) * count);
+            memcpy(outs[1] + f, convOuts[1] + binaural->fifoFill, sizeof(float) * count);
+            binaural->fifoFill += count;
+            if (binaural->fifoFill == block) {
+                partconv_process(binaural->conv, convIns, convOuts);
+                binaural->fifoFill = 0;
+            }
+        }
+        return;
+    }
+
+    for (f = 0; block != 0 && f + block <= nframes; f += block) {
+        for (o = 0; o < binaural->numSpeakers; ++o) {
+            convIns[o] = binaural->feeds + o * binaural->feedFrames + f;
+        }
+        convOuts[0] = outs[0] + f;
+        convOuts[1] = outs[1] + f;
+        partconv_process(binaural->conv, convIns, convOuts);
+    }
+}
+
+// Adds the direct outs to the stereo signal of the binaural modes.
+static void addBinauralDirectOuts(jackClientGris &jackCli, jack_default_audio_sample_t **ins,
+                                  jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                                  const unsigned int &sizeInputs) {
+    unsigned int f, i;
+
+    for (i = 0; i < sizeInputs; ++i) {
+        if (jackCli.listSourceIn[i].directOut != 0) {
+            if ((jackCli.listSourceIn[i].directOut % 2) == 1) {
+                for (f = 0; f < nframes; ++f) {
+                    outs[0][f] += ins[i][f];
+                }
+            } else {
+                for (f = 0; f < nframes; ++f) {
+                    outs[1][f] += ins[i][f];
+                }
+            }
+        }
+    }
+}
+
 // BINAURAL processing function.
-static void processVBapHRTF(jackClientGris &jackCli, jack_default_audio_sample_t **ins, jack_default_audio_sample_t **outs,
-                            const jack_nframes_t &nframes, const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+static void processVBapHRTF(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                            jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                            const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
 {
-    int tmp_count;
-    unsigned int f, i, o, k, ilinear;
-    float sig, y, interpG = 0.99, iogain = 0.0;
-    float vbapouts[16][2048];
+    unsigned int f, i, o, ilinear, block;
+    float y, interpG = 0.99, iogain = 0.0;
+    float *feed;
+    BinauralSetup *binaural = plan.binaural;
 
     for (o = 0; o < sizeOutputs; ++o) {
         memset(outs[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
@@ -347,24 +575,26 @@ static void processVBapHRTF(jackClientGris &jackCli, jack_default_audio_sample_t
         interpG = powf(jackCli.interMaster, 0.1) * 0.0099 + 0.99;
     }
 
-    for (i = 0; i < sizeInputs; ++i) {
-        if (jackCli.vbapSourcesToUpdate[i] == 1) {
-            jackCli.updateSourceVbap(i);
-            jackCli.vbapSourcesToUpdate[i] = 0;
-        }
-    }
+    updateVbapSources(jackCli, plan);
 
-    for (o = 0; o < 16; ++o) {
-        memset(vbapouts[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
+    block = getBinauralBlock(binaural, nframes);
+
+    for (o = 0; block != 0 && o < binaural->numSpeakers; ++o) {
+        feed = binaural->feeds + o * binaural->feedFrames;
+        memset(feed, 0, sizeof(jack_default_audio_sample_t) * nframes);
         for (i = 0; i < sizeInputs; ++i) {
-            if (!jackCli.listSourceIn[i].directOut && jackCli.listSourceIn[i].paramVBap != nullptr) {
-                iogain = jackCli.listSourceIn[i].paramVBap->gains[o];
-                y = jackCli.listSourceIn[i].paramVBap->y[o];
+            if (!jackCli.listSourceIn[i].directOut && plan.vbap[i] != nullptr) {
+                iogain = plan.vbap[i]->gains[o];
+                y = plan.vbap[i]->y[o];
+                // Most virtual speakers are silent for a given source.
+                if (iogain == 0.0f && y == 0.0f) {
+                    continue;
+                }
                 if (ilinear) {
                     interpG = (iogain - y) / nframes;
                     for (f = 0; f < nframes; ++f) {
                         y += interpG;
-                        vbapouts[o][f] += ins[i][f] * y;
+                        feed[f] += ins[i][f] * y;
                     }
                 } else {
                     for (f = 0; f < nframes; ++f) {
@@ -372,52 +602,74 @@ static void processVBapHRTF(jackClientGris &jackCli, jack_default_audio_sample_t
                         if (y < 0.0000000000001f) {
                             y = 0.0;
                         } else {
-                            vbapouts[o][f] += ins[i][f] * y;
+                            feed[f] += ins[i][f] * y;
                         }
                     }
                 }
-                jackCli.listSourceIn[i].paramVBap->y[o] = y;
+                plan.vbap[i]->y[o] = y;
             }
         }
+    }
 
-        for (f=0; f<nframes; f++) {
-            tmp_count = jackCli.hrtf_count[o];
-            for (k=0; k<128; ++k) {
-                if (tmp_count < 0) {
-                    tmp_count += 128;
-                }
-                sig = jackCli.hrtf_input_tmp[o][tmp_count];
-                outs[0][f] += sig * jackCli.vbap_hrtf_left_impulses[o][k];
-                outs[1][f] += sig * jackCli.vbap_hrtf_right_impulses[o][k];
-                tmp_count--;
-            }
-            jackCli.hrtf_count[o]++;
-            if (jackCli.hrtf_count[o] >= 128) {
-                jackCli.hrtf_count[o] = 0;
-            }
-            jackCli.hrtf_input_tmp[o][jackCli.hrtf_count[o]] = vbapouts[o][f];
-        }
+    convolveBinaural(binaural, block, outs, nframes);
+    addBinauralDirectOuts(jackCli, ins, outs, nframes, sizeInputs);
+}
+
+// HOA BINAURAL processing function. The sources are encoded in the
+// ambisonic domain, then a fixed set of filters renders each channel to
+// both ears: only the encoding cost grows with the number of sources.
+static void processHOABinaural(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                               jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                               const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+{
+    unsigned int c, i, o, block;
+    float interpG = 0.0;
+    float *feeds[HoaBinauralChannels], target[HoaBinauralChannels];
+    BinauralSetup *binaural = plan.binaural;
+
+    for (o = 0; o < sizeOutputs; ++o) {
+        memset(outs[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
     }
 
-    // Add direct outs to the now stereo signal.
-    for (i = 0; i < sizeInputs; ++i) {
-        if (jackCli.listSourceIn[i].directOut != 0) {
-            if ((jackCli.listSourceIn[i].directOut % 2) == 1) {
-                for (f = 0; f < nframes; ++f) {
-                    outs[0][f] += ins[i][f];
-                }
-            } else {
-                for (f = 0; f < nframes; ++f) {
-                    outs[1][f] += ins[i][f];
+    // The encoder ramps linearly over the period, the smoothing of the
+    // other modes is applied once per period.
+    if (jackCli.interMaster != 0.0) {
+        interpG = powf(powf(jackCli.interMaster, 0.1) * 0.0099 + 0.99, nframes);
+    }
+
+    updateHoaSources(jackCli, plan);
+
+    block = getBinauralBlock(binaural, nframes);
+
+    if (block != 0) {
+        for (c = 0; c < HoaBinauralChannels; ++c) {
+            feeds[c] = binaural->feeds + c * binaural->feedFrames;
+            memset(feeds[c], 0, sizeof(jack_default_audio_sample_t) * nframes);
+        }
+        for (i = 0; i < sizeInputs; ++i) {
+            if (jackCli.listSourceIn[i].directOut) {
+                continue;
+            }
+            float *gains = plan.hoaGains[i], *y = plan.hoaY[i];
+            for (c = 0; c < HoaBinauralChannels; ++c) {
+                target[c] = gains[c] + (y[c] - gains[c]) * interpG;
+                if (gains[c] == 0.0f && fabsf(target[c]) < 0.0000000000001f) {
+                    target[c] = 0.0f;
                 }
             }
+            hoa_encode(ins[i], nframes, y, target, HoaBinauralChannels, feeds);
+            memcpy(y, target, sizeof(float) * HoaBinauralChannels);
         }
     }
+
+    convolveBinaural(binaural, block, outs, nframes);
+    addBinauralDirectOuts(jackCli, ins, outs, nframes, sizeInputs);
 }
 
 // STEREO processing function.
-static void processSTEREO(jackClientGris &jackCli, jack_default_audio_sample_t **ins, jack_default_audio_sample_t **outs,
-                        const jack_nframes_t &nframes, const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+static void processSTEREO(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                          jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                          const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
 {
     unsigned int f, i;
     float azi, last_azi, scaled;
@@ -432,7 +684,7 @@ static void processSTEREO(jackClientGris &jackCli, jack_default_audio_sample_t *
     for (i = 0; i < sizeInputs; ++i) {
         if (!jackCli.listSourceIn[i].directOut) {
             azi = jackCli.listSourceIn[i].azimuth;
-            last_azi = jackCli.last_azi[i];
+            last_azi = plan.lastAzi[i];
             for (f = 0; f < nframes; ++f) {
                 // Removes the chirp at 180->-180 degrees azimuth boundary.
                 if (abs(last_azi - azi) > 300.0f) {
@@ -450,7 +702,7 @@ static void processSTEREO(jackClientGris &jackCli, jack_default_audio_sample_t *
                 outs[0][f] += ins[i][f] * cosf(scaled);
                 outs[1][f] += ins[i][f] * sinf(scaled);
             }
-            jackCli.last_azi[i] = last_azi;
+            plan.lastAzi[i] = last_azi;
 
         } else if ((jackCli.listSourceIn[i].directOut % 2) == 1) {
             for (f = 0; f < nframes; ++f) {
@@ -469,22 +721,150 @@ static void processSTEREO(jackClientGris &jackCli, jack_default_audio_sample_t *
     }
 }
 
+// Renders a plan into the outputs.
+static void renderPlan(jackClientGris &jackCli, RenderPlan &plan, jack_default_audio_sample_t **ins,
+                       jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                       const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+{
+    switch (plan.mode) {
+        case VBAP:
+            processVBAP(jackCli, plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+            break;
+        case LBAP:
+            processLBAP(jackCli, plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+            break;
+        case VBAP_HRTF:
+            processVBapHRTF(jackCli, plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+            break;
+        case STEREO:
+            processSTEREO(jackCli, plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+            break;
+        case HOA_BINAURAL:
+            processHOABinaural(jackCli, plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+            break;
+        default:
+            jassertfalse;
+            break;
+    }
+}
+
+// Renders the replaced plan on its own and mixes it with the new one, equal
+// power over the crossfade. The replaced plan is retired at the end.
+static void crossfadePlans(jackClientGris &jackCli, jack_default_audio_sample_t **ins,
+                           jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                           const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+{
+    unsigned int f, o;
+    RenderPlan *fading = jackCli.fadingPlan.load(memory_order_acquire);
+    jack_default_audio_sample_t *olds[MaxOutputs];
+
+    if (fading == nullptr) {
+        return;
+    }
+    if (jackCli.crossfadePosition >= jackCli.crossfadeLength) {
+        // Over, the replaced plan is retired, or kept until a slot frees.
+        if (jackCli.retirePlan(fading)) {
+            jackCli.fadingPlan.store(nullptr, memory_order_release);
+        }
+        return;
+    }
+
+    for (o = 0; o < sizeOutputs; ++o) {
+        olds[o] = jackCli.crossfadeBuffer + o * jackCli.crossfadeFrames;
+    }
+    renderPlan(jackCli, *fading, ins, olds, nframes, sizeInputs, sizeOutputs);
+
+    float *fadeIn = jackCli.crossfadeBuffer + MaxOutputs * jackCli.crossfadeFrames;
+    float *fadeOut = fadeIn + jackCli.crossfadeFrames;
+    float step = 1.0f / jackCli.crossfadeLength;
+    for (f = 0; f < nframes; ++f) {
+        float t = (jackCli.crossfadePosition + f + 1) * step;
+        if (t > 1.0f) {
+            t = 1.0f;
+        }
+        fadeIn[f] = sinf(t * M_PI2);
+        fadeOut[f] = cosf(t * M_PI2);
+    }
+    for (o = 0; o < sizeOutputs; ++o) {
+        for (f = 0; f < nframes; ++f) {
+            outs[o][f] = outs[o][f] * fadeIn[f] + olds[o][f] * fadeOut[f];
+        }
+    }
+    jackCli.crossfadePosition += nframes;
+}
+
+// Monitor render target, on its own ports. The source directions, mute,
+// solo and input levels of the period are the ones of the speaker feed.
+static void processMonitor(jackClientGris &jackCli, RenderTarget &target, jack_default_audio_sample_t **ins,
+                           jack_default_audio_sample_t **outs, const jack_nframes_t &nframes,
+                           const unsigned int &sizeInputs, const unsigned int &sizeOutputs)
+{
+    unsigned int f, o;
+    jack_default_audio_sample_t *monitorOuts[MonitorChannels];
+    RenderPlan *monitor = target.plan;
+
+    for (o = 0; o < MonitorChannels; ++o) {
+        monitorOuts[o] = (jack_default_audio_sample_t *)jack_port_get_buffer(target.ports[o], nframes);
+    }
+
+    if (monitor == nullptr) {
+        for (o = 0; o < MonitorChannels; ++o) {
+            memset(monitorOuts[o], 0, sizeof(jack_default_audio_sample_t) * nframes);
+        }
+        return;
+    }
+
+    if (monitor->mode == jackCli.plan->mode && sizeOutputs >= MonitorChannels) {
+        // Already rendered for the speaker feed.
+        for (o = 0; o < MonitorChannels; ++o) {
+            memcpy(monitorOuts[o], outs[o], sizeof(jack_default_audio_sample_t) * nframes);
+        }
+    } else {
+        renderPlan(jackCli, *monitor, ins, monitorOuts, nframes, sizeInputs, MonitorChannels);
+    }
+
+    for (o = 0; o < MonitorChannels; ++o) {
+        for (f = 0; f < nframes; ++f) {
+            monitorOuts[o][f] *= jackCli.masterGainOut;
+        }
+    }
+}
+
 // Jack processing callback.
 static int process_audio(jack_nframes_t nframes, void *arg) {
     jackClientGris *jackCli = (jackClientGris *)arg;
+
+    // New plan or speaker positions changed, also taken while the processing
+    // is blocked so that only this thread installs them.
+    int expected = LayoutSwapPending;
+    if (jackCli->layoutSwapState.load(memory_order_acquire) == LayoutSwapPending &&
+        jackCli->canInstallPendingLayout() &&
+        jackCli->layoutSwapState.compare_exchange_strong(expected, LayoutSwapTaken, memory_order_acquire)) {
+        jackCli->installPendingLayout();
+        jackCli->layoutSwapState.store(LayoutSwapDone, memory_order_release);
+    }
     
     // Return if the user is editing the speaker setup.
     if (!jackCli->processBlockOn) {
-        for (unsigned int i = 0; i < jackCli->outputsPort.size(); ++i) {
+        for (unsigned int i = 0; i < jackCli->numOutputPorts; ++i) {
             memset(((jack_default_audio_sample_t*)jack_port_get_buffer(jackCli->outputsPort[i], nframes)),
                    0, sizeof(jack_default_audio_sample_t) * nframes);
             jackCli->levelsOut[i] = 0.0f;
         }
+        for (unsigned int m = 0; m < MaxMonitors; ++m) {
+            for (unsigned int i = 0; i < MonitorChannels; ++i) {
+                memset(((jack_default_audio_sample_t*)jack_port_get_buffer(jackCli->monitors[m].ports[i], nframes)),
+                       0, sizeof(jack_default_audio_sample_t) * nframes);
+            }
+        }
         return 0;
     }
+
+    // Mute, solo, direct out and output changes, all applied before the block.
+    jackCli->drainCommands();
     
     const unsigned int sizeInputs = (unsigned int)jackCli->inputsPort.size();
-    const unsigned int sizeOutputs = (unsigned int)jackCli->outputsPort.size();
+    const unsigned int sizeOutputs = jackCli->numOutputPorts.load(memory_order_acquire);
     
     jack_default_audio_sample_t *ins[MaxInputs];
     jack_default_audio_sample_t *outs[MaxOutputs];
@@ -498,29 +878,23 @@ static int process_audio(jack_nframes_t nframes, void *arg) {
 
     muteSoloVuMeterIn(*jackCli, ins, nframes, sizeInputs);
 
-    switch ((ModeSpatEnum)jackCli->modeSelected) {
-        case VBAP:
-            processVBAP(*jackCli, ins, outs, nframes, sizeInputs, sizeOutputs);
-            break;
-        case LBAP:
-            processLBAP(*jackCli, ins, outs, nframes, sizeInputs, sizeOutputs);
-            break;
-        case VBAP_HRTF:
-            processVBapHRTF(*jackCli, ins, outs, nframes, sizeInputs, sizeOutputs);
-            break;
-        case STEREO:
-            processSTEREO(*jackCli, ins, outs, nframes, sizeInputs, sizeOutputs);
-            break;
-        default:
-            jassertfalse;
-            break;
+    // Shared by the speaker feed, the replaced plan and the monitor mix.
+    collectMovedSources(*jackCli, nframes, sizeInputs);
+
+    RenderPlan *plan = jackCli->plan;
+    renderPlan(*jackCli, *plan, ins, outs, nframes, sizeInputs, sizeOutputs);
+    crossfadePlans(*jackCli, ins, outs, nframes, sizeInputs, sizeOutputs);
+
+    for (unsigned int m = 0; m < MaxMonitors; ++m) {
+        processMonitor(*jackCli, jackCli->monitors[m], ins, outs, nframes, sizeInputs, sizeOutputs);
     }
 
     if (jackCli->pinkNoiseSound) {
         addNoiseSound(*jackCli, outs, nframes, sizeOutputs);
     }
 
-    muteSoloVuMeterGainOut(*jackCli, outs, nframes, sizeOutputs, jackCli->masterGainOut);
+    // The outputs of the new plan apply to the crossfaded signal.
+    muteSoloVuMeterGainOut(*jackCli, *plan, outs, nframes, sizeOutputs, jackCli->masterGainOut);
         
     jackCli->overload = false;
 
@@ -548,11 +922,22 @@ void session_callback(jack_session_event_t *event, void *arg) {
 int graph_order_callback(void *arg) {
     jackClientGris *jackCli = (jackClientGris *)arg;
     jack_client_log("graph_order_callback...\n");
-    jackCli->updateClientPortAvailable(true);
+    // A connection alone doesn't change the ports of the clients.
+    if (jackCli->clientPortsChanged.exchange(false)) {
+        jackCli->updateClientPortAvailable(true);
+    }
     jack_client_log("... done!\n");
     return 0;
 }
 
+void thread_init_callback(void *arg) {
+    // Writes the first pages of the process thread's stack before the first period.
+    volatile char stack[65536];
+    for (unsigned int i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
 int xrun_callback(void * arg) {
     jackClientGris *jackCli = (jackClientGris *)arg;
     jackCli->overload = true;
@@ -560,6 +945,37 @@ int xrun_callback(void * arg) {
     return 0;
 }
 
+int buffer_size_callback(jack_nframes_t nframes, void *arg) {
+    jackClientGris *jackCli = (jackClientGris *)arg;
+    jackCli->bufferSizeChanged(nframes);
+    return 0;
+}
+
+void latency_callback(jack_latency_callback_mode_t mode, void *arg) {
+    jackClientGris *jackCli = (jackClientGris *)arg;
+    jack_latency_range_t range, portRange;
+    vector<jack_port_t *> &from = (mode == JackCaptureLatency) ? jackCli->inputsPort : jackCli->outputsPort;
+    vector<jack_port_t *> &to = (mode == JackCaptureLatency) ? jackCli->outputsPort : jackCli->inputsPort;
+
+    // Every output depends on every input, delayed by the binaural FIFO
+    // when the partitions don't divide the buffer size.
+    range.min = range.max = 0;
+    for (unsigned int i = 0; i < from.size(); i++) {
+        jack_port_get_latency_range(from[i], mode, &portRange);
+        if (i == 0 || portRange.min < range.min) {
+            range.min = portRange.min;
+        }
+        if (portRange.max > range.max) {
+            range.max = portRange.max;
+        }
+    }
+    range.min += jackCli->binauralLatency.load();
+    range.max += jackCli->binauralLatency.load();
+    for (unsigned int i = 0; i < to.size(); i++) {
+        jack_port_set_latency_range(to[i], mode, &range);
+    }
+}
+
 void jack_shutdown(void *arg) {
     AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "FATAL ERROR",
                                      "Please check :\n - Buffer Size\n - Sample Rate\n - Inputs/Outputs");
@@ -591,30 +1007,49 @@ void client_registration_callback(const char *name, int regist, void *arg) {
         }
     }
     jackCli->lockListClient.unlock();
+
+    jackCli->graph.clientRegistration(String(name), regist != 0);
+    jackCli->clientPortsChanged = true;
+    jackCli->clientsVersion++;
 }
 
 void port_registration_callback(jack_port_id_t a, int regist, void *arg) {
+    jackClientGris *jackCli = (jackClientGris *)arg;
     jack_client_log("Jack port : % : " , a);
     if (regist) {
         jack_client_log("registered\n");
     } else {
         jack_client_log("deleted\n");
     }
+    if (jackCli->graph.portRegistration(jackCli->client, a, regist != 0)) {
+        jackCli->clientPortsChanged = true;
+        jackCli->clientsVersion++;
+    }
 }
 
 void port_connect_callback(jack_port_id_t a, jack_port_id_t b, int connect, void *arg) {
     jackClientGris *jackCli = (jackClientGris *)arg;
     jack_client_log("Jack port : ");
+    if (jackCli->graph.portConnection(jackCli->client, a, b, connect != 0)) {
+        jackCli->clientsVersion++;
+    }
     if (connect) {
         // Stop Auto connection with system.
-        if (!jackCli->autoConnection) {
-            string nameClient = jack_port_name(jack_port_by_id(jackCli->client, a));
-            string tempN = jack_port_short_name(jack_port_by_id(jackCli->client, a));
-            nameClient = nameClient.substr(0, nameClient.size() - (tempN.size() + 1));
-            if ((nameClient != ClientName && nameClient != ClientNameSys) || nameClient == ClientNameSys) {
-                jack_disconnect(jackCli->client,
-                                jack_port_name(jack_port_by_id(jackCli->client, a)),
-                                jack_port_name(jack_port_by_id(jackCli->client, b)));
+        jack_port_t *portA = jack_port_by_id(jackCli->client, a);
+        jack_port_t *portB = jack_port_by_id(jackCli->client, b);
+        if (portA != nullptr && portB != nullptr && jackCli->graph.getClientName(portA) != ClientName) {
+            pair<String, String> conn(jack_port_name(portA), jack_port_name(portB));
+            bool expected = false;
+            jackCli->lockExpectedConnections.lock();
+            vector<pair<String, String>> &list = jackCli->expectedConnections;
+            vector<pair<String, String>>::iterator pos = find(list.begin(), list.end(), conn);
+            if (pos != list.end()) {
+                list.erase(pos);
+                expected = true;
+            }
+            jackCli->lockExpectedConnections.unlock();
+            if (!expected) {
+                jack_disconnect(jackCli->client, conn.first.toRawUTF8(), conn.second.toRawUTF8());
             }
         }
         jack_client_log("Connect ");
@@ -624,31 +1059,116 @@ void port_connect_callback(jack_port_id_t a, jack_port_id_t b, int connect, void
     jack_client_log("% <> % \n", a, b);
 }
 
-// Load samples from a wav file into a float array.
-static float ** getSamplesFromWavFile(String filename) {
-    int **wavData;
-    float factor = powf(2.0f, 31.0f);
-    AudioFormat *wavAudioFormat;
-    File file = File(filename); 
-    wavAudioFormat = new WavAudioFormat(); 
-    FileInputStream *stream = file.createInputStream();
-    AudioFormatReader *audioFormatReader = wavAudioFormat->createReaderFor(stream, true);
-    wavData = new int * [3]; 
-    wavData[0] = new int[audioFormatReader->lengthInSamples];
-    wavData[1] = new int[audioFormatReader->lengthInSamples];
-    wavData[2] = 0; 
-    audioFormatReader->read(wavData, 2, 0, (int)audioFormatReader->lengthInSamples, false);
-    float **samples = (float **)malloc(2 * sizeof(float *));
-    for (int i = 0; i < 2; i++) {
-        samples[i] = (float *)malloc(audioFormatReader->lengthInSamples * sizeof(float));
-        for (int j=0; j<audioFormatReader->lengthInSamples; j++) {
-            samples[i][j] = wavData[i][j] / factor;
-        }
-    }
-    // FIXME: wavData is leaking memory...
-    delete wavAudioFormat;
-    delete stream;
-    return samples;
+static BinauralSetup * newBinauralSetup(unsigned int numSpeakers) {
+    BinauralSetup *setup = new BinauralSetup;
+    setup->numSpeakers = numSpeakers;
+    setup->impulses = new float[numSpeakers * 2 * HRIRLength]();
+    setup->feeds = nullptr;
+    setup->feedFrames = 0;
+    setup->periodFrames = 0;
+    setup->conv = nullptr;
+    setup->fifo = nullptr;
+    setup->fifoFill = 0;
+    setup->latency = 0;
+    return setup;
+}
+
+static void freeBinauralSetup(BinauralSetup *setup) {
+    if (setup->conv != nullptr) {
+        partconv_free(setup->conv);
+    }
+    delete[] setup->feeds;
+    delete[] setup->fifo;
+    delete[] setup->impulses;
+    delete setup;
+}
+
+// Builds the convolver and the feed buffers of a binaural setup for blocks
+// of nframes. The partitions are the largest power of two dividing nframes,
+// so the convolution adds no latency, down to HRTFMinPartitionSize. Smaller
+// or odd periods are buffered in blocks of that size.
+static void prepareBinauralSetup(BinauralSetup *setup, unsigned int nframes) {
+    unsigned int block = HRTFPartitionSize;
+    while (block > HRTFMinPartitionSize && (nframes % block) != 0) {
+        block >>= 1;
+    }
+    setup->latency = (nframes % block) != 0 ? block : 0;
+
+    if (setup->conv == nullptr || (unsigned int)partconv_get_block_size(setup->conv) != block) {
+        if (setup->conv != nullptr) {
+            partconv_free(setup->conv);
+        }
+        setup->conv = partconv_init(setup->numSpeakers, 2, block, HRIRLength);
+        for (unsigned int i = 0; setup->conv != nullptr && i < setup->numSpeakers; i++) {
+            partconv_set_impulse(setup->conv, i, 0, setup->impulses + (i * 2) * HRIRLength, HRIRLength);
+            partconv_set_impulse(setup->conv, i, 1, setup->impulses + (i * 2 + 1) * HRIRLength, HRIRLength);
+        }
+    }
+    if (setup->feedFrames < nframes) {
+        delete[] setup->feeds;
+        setup->feeds = new float[setup->numSpeakers * nframes]();
+        setup->feedFrames = nframes;
+    }
+    delete[] setup->fifo;
+    setup->fifo = setup->latency != 0 ? new float[(setup->numSpeakers + 2) * block]() : nullptr;
+    setup->fifoFill = 0;
+    setup->periodFrames = nframes;
+}
+
+// Copy of a binaural setup with its own convolver and feeds.
+static BinauralSetup * copyBinauralSetup(BinauralSetup *setup, unsigned int nframes) {
+    BinauralSetup *copy = newBinauralSetup(setup->numSpeakers);
+    memcpy(copy->impulses, setup->impulses, sizeof(float) * setup->numSpeakers * 2 * HRIRLength);
+    prepareBinauralSetup(copy, nframes);
+    return copy;
+}
+
+static void freeRenderPlan(RenderPlan *plan) {
+    if (plan == nullptr) {
+        return;
+    }
+    for (unsigned int i = 0; i < MaxInputs; i++) {
+        if (plan->vbap[i] != nullptr) {
+            free_vbap_data(plan->vbap[i]);
+        }
+    }
+    if (plan->lbapField != nullptr) {
+        lbap_field_free(plan->lbapField);
+    }
+    delete[] plan->lbap;
+    if (plan->binaural != nullptr) {
+        freeBinauralSetup(plan->binaural);
+    }
+    delete plan;
+}
+
+// Runs the LBAP field tasks on the thread pool of the jackClientGris given as
+// context, its workers pinned on its worker cores. The calling thread takes
+// tasks too, and returns when all of them are done.
+static void runLbapTasks(void *context, lbap_task task, void *arg, int count) {
+    jackClientGris *jackCli = (jackClientGris *)context;
+    ThreadPool *pool = jackCli->lbapPool;
+    int workers = jmin(pool->getNumThreads(), count);
+    std::atomic<int> next(0), running(workers);
+    WaitableEvent finished;
+
+    for (int w = 0; w < workers; w++) {
+        pool->addJob([&]() {
+            RealtimeProfile::setCurrentThreadAffinity(jackCli->workerCores);
+            for (int i = next++; i < count; i = next++) {
+                task(arg, i);
+            }
+            if (--running == 0) {
+                finished.signal();
+            }
+        });
+    }
+    for (int i = next++; i < count; i = next++) {
+        task(arg, i);
+    }
+    if (workers > 0) {
+        finished.wait();
+    }
 }
 
 // jackClientGris class definition.
@@ -656,74 +1176,58 @@ jackClientGris::jackClientGris() {
     // Initialize variables.
     this->pinkNoiseSound = false;
     this->clientReady = false;
-    this->autoConnection = false;
+    this->clientsVersion = 0;
+    this->clientPortsChanged = false;
     this->overload = false;
     this->masterGainOut = 1.0f;
     this->pinkNoiseGain = 0.1f;
     this->processBlockOn = true;
+    this->clientActive = false;
     this->modeSelected = VBAP;
     this->recording = false;
+    this->deadReckoning = false;
+    this->paramVBap = nullptr;
+    this->vbapDimensions = 0;
 
     this->attenuationLinearGain[0] = 0.01584893;    // -36 dB
     this->attenuationLowpassCoeff[0] = 0.867208;   // 1000 Hz
     for (unsigned int i=0; i < MaxInputs; ++i) {
         this->vbapSourcesToUpdate[i] = 0;
-        this->attenuationLowpassY[i] = 0.0f;
-        this->attenuationLowpassZ[i] = 0.0f;
-        this->lastAttenuationGain[i] = 0.0f;
-        this->lastAttenuationCoef[i] = 0.0f;
-    }
-
-    // Initialize impulse responses for VBAP+HRTF (BINAURAL mode).
-    float **stbuf;
-    // Azimuth = 0
-    String names0[8] = {"H0e025a.wav", "H0e020a.wav", "H0e065a.wav", "H0e110a.wav",
-                       "H0e155a.wav", "H0e160a.wav", "H0e115a.wav", "H0e070a.wav"};
-    int reverse0[8] = {1, 0, 0, 0, 0, 1, 1, 1};
-    for (int i=0; i<8; i++) {
-        stbuf = getSamplesFromWavFile(HRTFFolder0Path + names0[i]);
-        for (int k=0; k<128; k++) {
-            this->vbap_hrtf_left_impulses[i][k] = stbuf[reverse0[i]][k];
-            this->vbap_hrtf_right_impulses[i][k] = stbuf[1-reverse0[i]][k];
-        }
-    }
-    // Azimuth = 40
-    String names40[6] = {"H40e032a.wav", "H40e026a.wav", "H40e084a.wav", "H40e148a.wav",
-                         "H40e154a.wav", "H40e090a.wav"};
-    int reverse40[6] = {1, 0, 0, 0, 1, 1};
-    for (int i=0; i<6; i++) {
-        stbuf = getSamplesFromWavFile(HRTFFolder40Path + names40[i]);
-        for (int k=0; k<128; k++) {
-            this->vbap_hrtf_left_impulses[i+8][k] = stbuf[reverse40[i]][k];
-            this->vbap_hrtf_right_impulses[i+8][k] = stbuf[1-reverse40[i]][k];
-        }
-    }
-    // Azimuth = 80
-    for (int i=0; i<2; i++) {
-        stbuf = getSamplesFromWavFile(HRTFFolder80Path + "H80e090a.wav");
-        for (int k=0; k<128; k++) {
-            this->vbap_hrtf_left_impulses[i+14][k] = stbuf[1-i][k];
-            this->vbap_hrtf_right_impulses[i+14][k] = stbuf[i][k];
-        }
     }
 
-    this->resetHRTF();
-
-    // Initialize STEREO data.
-    for (unsigned int i=0; i < MaxInputs; ++i) {
-        this->last_azi[i] = 0.0f;
-    }
+    // The BINAURAL virtual speakers come with their speaker setup.
+    this->hoaBinaural = nullptr;
+    this->hrirBank = nullptr;
 
     // Initialize LBAP data.
-    this->lbap_speaker_field = lbap_field_init();
-    for (unsigned int i=0; i<MaxInputs; i++) {
-        this->listSourceIn[i].lbap_last_pos.azi = -1;
-        this->listSourceIn[i].lbap_last_pos.ele = -1;
-        this->listSourceIn[i].lbap_last_pos.rad = -1;
-        for (unsigned int o=0; o<MaxOutputs; o++) {
-            this->listSourceIn[i].lbap_gains[o] = this->listSourceIn[i].lbap_y[o] = 0.0;
-        }
-    }
+    this->lbapPool = new ThreadPool(SystemStats::getNumCpus());
+    this->vbapSpreadDirs = VBAP_SPREAD_DIRS;
+    this->lbapResolution = LBAP_MATRIX_SIZE;
+    this->lbapHugePages = false;
+    this->lbapReport = lbap_field_report();
+    this->layoutCache = nullptr;
+    this->pendingVbapLayout = nullptr;
+    this->pendingLbapField = nullptr;
+    this->retiredLbapField = nullptr;
+    this->pendingBinaural = nullptr;
+    this->retiredBinaural = nullptr;
+    this->binauralLatency = 0;
+    this->layoutSwapState = LayoutSwapIdle;
+
+    // Silent until a speaker setup is loaded.
+    this->plan = this->createRenderPlan(VBAP);
+    this->fadingPlan = nullptr;
+    this->newPlan = nullptr;
+    this->planSerial = 0;
+    this->pendingPlan = nullptr;
+    for (int i = 0; i < RetiredPlanSlots; i++) {
+        this->retiredPlans[i] = nullptr;
+    }
+    this->crossfadeTime = 0.05f;
+    this->crossfadeBuffer = new float[(MaxOutputs + 2) * MaxBufferFrames]();
+    this->crossfadeFrames = MaxBufferFrames;
+    this->crossfadePosition = 0;
+    this->crossfadeLength = 0;
 
     // Initialize highpass filter delay samples.
     for (unsigned int i=0; i<MaxOutputs; i++) {
@@ -744,6 +1248,9 @@ jackClientGris::jackClientGris() {
 
     this->inputsPort = vector<jack_port_t *>();
     this->outputsPort = vector<jack_port_t *>();
+    // Never reallocated while the audio thread reads them.
+    this->outputsPort.reserve(MaxOutputs);
+    this->numOutputPorts = 0;
     this->interMaster = 0.8f;
     this->maxOutputPatch = 0;
 
@@ -783,6 +1290,9 @@ jackClientGris::jackClientGris() {
     jack_set_port_registration_callback     (this->client, port_registration_callback, this);
     jack_set_graph_order_callback           (this->client, graph_order_callback, this);
     jack_set_xrun_callback                  (this->client, xrun_callback, this);
+    jack_set_thread_init_callback           (this->client, thread_init_callback, this);
+    jack_set_buffer_size_callback           (this->client, buffer_size_callback, this);
+    jack_set_latency_callback               (this->client, latency_callback, this);
 
     sampleRate = jack_get_sample_rate(this->client);
     bufferSize = jack_get_buffer_size(this->client);
@@ -825,25 +1335,234 @@ jackClientGris::jackClientGris() {
     jack_free(ports);
     jack_client_log("\nNumber of output ports: %d\n\n", this->numberOutputs);
     
+    // The monitor outputs are always there, silent until a monitor mix is selected.
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        for (unsigned int i = 0; i < MonitorChannels; i++) {
+            String nameMonitor = "monitor" + String(m * MonitorChannels + i + 1);
+            this->monitors[m].ports[i] = jack_port_register(this->client, nameMonitor.toUTF8(), JACK_DEFAULT_AUDIO_TYPE,
+                                                            JackPortIsOutput, 0);
+        }
+    }
+
     // Activate client and connect the ports.
     // Playback ports are "input" to the backend, and capture ports are "output" from it.
     if (jack_activate(this->client)) {
         jack_client_log("\n\n Jack cannot activate client.");
         return;
     }
+    this->clientActive = true;
     
+    // Ports of the other clients are looked up in the graph from now on.
+    this->graph.scan(this->client);
+    this->clientPortsChanged = true;
+
     jack_client_log("\nJack Client Run\n");
     jack_client_log("=============== \n");
     
     this->clientReady = true;
 }
 
-void jackClientGris::resetHRTF() {
-    for (unsigned int i=0; i<16; i++) {
-        this->hrtf_count[i] = 0;
-        for (int j = 0; j<128; j++) {
-            this->hrtf_input_tmp[i][j] = 0.0f;
-        }
+bool jackClientGris::setupBinauralSpeakers(vector<Speaker *>  listSpk) {
+    if (this->maxOutputPatch == 0 || this->maxOutputPatch > MaxOutputs) {
+        return false;
+    }
+    if (this->hrirBank == nullptr || ! this->hrirBank->open()) {
+        jack_client_log("No impulse responses for the binaural mode\n");
+        return false;
+    }
+
+    BinauralSetup *setup = newBinauralSetup(this->maxOutputPatch);
+    for (unsigned int i = 0; i < listSpk.size(); i++) {
+        int o = listSpk[i]->getOutputPatch() - 1;
+        if (o < 0 || (unsigned int)o >= setup->numSpeakers) {
+            continue;
+        }
+        this->hrirBank->getNearest(listSpk[i]->getAziZenRad().x, listSpk[i]->getAziZenRad().y,
+                                   setup->impulses + (o * 2) * HRIRLength, setup->impulses + (o * 2 + 1) * HRIRLength);
+    }
+    prepareBinauralSetup(setup, this->bufferSize);
+    if (setup->conv != nullptr) {
+        jack_client_log("Binaural: %d virtual speakers, %d partitions of %d frames\n", setup->numSpeakers,
+                        partconv_get_num_partitions(setup->conv), partconv_get_block_size(setup->conv));
+    }
+    bool ready = setup->conv != nullptr;
+
+    // A new setup comes with its plan, moved speakers replace the ones in use.
+    if (this->newPlan != nullptr) {
+        if (this->newPlan->binaural != nullptr) {
+            freeBinauralSetup(this->newPlan->binaural);
+        }
+        this->newPlan->binaural = setup;
+        return ready;
+    }
+
+    this->pendingBinaural = setup;
+    this->swapPendingLayout();
+    if (this->retiredBinaural != nullptr) {
+        freeBinauralSetup(this->retiredBinaural);
+        this->retiredBinaural = nullptr;
+    }
+    this->updateBinauralLatency();
+
+    return ready;
+}
+
+bool jackClientGris::setupHoaBinaural() {
+    if (this->newPlan == nullptr || ! this->buildHoaBinauralFilters()) {
+        return false;
+    }
+
+    if (this->newPlan->binaural != nullptr) {
+        freeBinauralSetup(this->newPlan->binaural);
+    }
+    this->newPlan->binaural = copyBinauralSetup(this->hoaBinaural, this->bufferSize);
+
+    return this->newPlan->binaural->conv != nullptr;
+}
+
+bool jackClientGris::buildHoaBinauralFilters() {
+    // The filters only depend on the measurements.
+    if (this->hoaBinaural != nullptr) {
+        return true;
+    }
+    if (this->hrirBank == nullptr || ! this->hrirBank->open()) {
+        jack_client_log("No impulse responses for the binaural mode\n");
+        return false;
+    }
+
+    // Both sides of the measured set, the median plane only once.
+    int count = this->hrirBank->getNumMeasurements(), num = 0;
+    vector<float> azimuths(count * 2), elevations(count * 2);
+    vector<float> impulses(count * 2 * 2 * HRIRLength);
+    for (int i = 0; i < count; i++) {
+        for (int side = 0; side < 2; side++) {
+            float *left = &impulses[(num * 2) * HRIRLength], *right = &impulses[(num * 2 + 1) * HRIRLength];
+            if (! this->hrirBank->getMeasurement(i, side == 1, azimuths[num], elevations[num], left, right)) {
+                continue;
+            }
+            if (side == 1 && (azimuths[num] == 180.0f || azimuths[num] == 360.0f)) {
+                continue;
+            }
+            num++;
+        }
+    }
+
+    // Each ambisonic channel is rendered by the measured impulses weighted
+    // by the decoder, which spreads it over the measured directions.
+    vector<float> decoder(num * HoaBinauralChannels);
+    if (hoa_decoder_matrix(HoaBinauralOrder, azimuths.data(), elevations.data(), num,
+                           HoaBinauralRegularization, decoder.data()) != 0) {
+        jack_client_log("HOA binaural decoder failed\n");
+        return false;
+    }
+
+    BinauralSetup *setup = newBinauralSetup(HoaBinauralChannels);
+    for (int l = 0; l < num; l++) {
+        for (unsigned int c = 0; c < HoaBinauralChannels; c++) {
+            float weight = decoder[l * HoaBinauralChannels + c];
+            for (unsigned int k = 0; k < 2 * HRIRLength; k++) {
+                setup->impulses[c * 2 * HRIRLength + k] += weight * impulses[l * 2 * HRIRLength + k];
+            }
+        }
+    }
+    jack_client_log("HOA binaural: order %d from %d directions\n", HoaBinauralOrder, num);
+
+    // Only a template, the plans render their own copies.
+    this->hoaBinaural = setup;
+
+    return true;
+}
+
+bool jackClientGris::setMonitorMode(unsigned int index, int mode) {
+    RenderPlan *monitor = nullptr;
+
+    if (index >= MaxMonitors) {
+        return false;
+    }
+    if (mode != STEREO && mode != HOA_BINAURAL) {
+        mode = MonitorOff;
+    }
+    if (mode == HOA_BINAURAL && ! this->buildHoaBinauralFilters()) {
+        mode = MonitorOff;
+    }
+    if (mode != MonitorOff) {
+        monitor = this->createRenderPlan((ModeSpatEnum)mode);
+        if (mode == HOA_BINAURAL) {
+            monitor->binaural = copyBinauralSetup(this->hoaBinaural, this->bufferSize);
+        }
+    }
+
+    // Swapped at a period boundary, the monitor outputs are not crossfaded.
+    this->freeRetiredPlans();
+    this->monitors[index].pendingPlan = monitor;
+    this->monitors[index].pendingSwap = true;
+    this->swapPendingLayout();
+    this->freeRetiredPlans();
+    this->updateBinauralLatency();
+
+    this->monitors[index].mode.store(mode, memory_order_release);
+    return mode != MonitorOff;
+}
+
+bool jackClientGris::isMonitorMode(int mode) const {
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        if (this->monitors[m].mode.load() == mode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void jackClientGris::bufferSizeChanged(unsigned int nframes) {
+    // Called on the notification thread, the setups in use are only
+    // replaced on the message thread. They are muted until then.
+    this->bufferSize = nframes;
+    this->triggerAsyncUpdate();
+}
+
+void jackClientGris::handleAsyncUpdate() {
+    unsigned int nframes = this->bufferSize;
+    bool swap = false;
+
+    if (this->plan->binaural != nullptr && this->plan->binaural->periodFrames != nframes) {
+        this->pendingBinaural = copyBinauralSetup(this->plan->binaural, nframes);
+        swap = true;
+    }
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        RenderPlan *monitor = this->monitors[m].plan;
+        if (monitor != nullptr && monitor->binaural != nullptr && monitor->binaural->periodFrames != nframes) {
+            this->monitors[m].pendingPlan = this->createRenderPlan(monitor->mode);
+            this->monitors[m].pendingPlan->binaural = copyBinauralSetup(monitor->binaural, nframes);
+            this->monitors[m].pendingSwap = true;
+            swap = true;
+        }
+    }
+
+    if (swap) {
+        this->freeRetiredPlans();
+        this->swapPendingLayout();
+        this->freeRetiredPlans();
+        if (this->retiredBinaural != nullptr) {
+            freeBinauralSetup(this->retiredBinaural);
+            this->retiredBinaural = nullptr;
+        }
+    }
+    this->updateBinauralLatency();
+}
+
+void jackClientGris::updateBinauralLatency() {
+    unsigned int latency = 0;
+    if (this->plan->binaural != nullptr) {
+        latency = this->plan->binaural->latency;
+    }
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        RenderPlan *monitor = this->monitors[m].plan;
+        if (monitor != nullptr && monitor->binaural != nullptr) {
+            latency = jmax(latency, monitor->binaural->latency);
+        }
+    }
+    if (this->binauralLatency.exchange(latency) != latency && this->clientActive.load()) {
+        jack_recompute_total_latencies(this->client);
     }
 }
 
@@ -873,7 +1592,7 @@ void jackClientGris::prepareToRecord() {
                 this->outputFilenames.add(fileC);
             }
         }
-    } else if (this->modeSelected == VBAP_HRTF || this->modeSelected == STEREO) {
+    } else if (this->modeSelected == VBAP_HRTF || this->modeSelected == STEREO || this->modeSelected == HOA_BINAURAL) {
         num_of_channels = 2;
         for (int i  = 0; i < num_of_channels; ++i) {
             channelName = parent + "/" + fname + "_" + String(i+1).paddedLeft('0', 3) + extF;
@@ -901,31 +1620,12 @@ void jackClientGris::addRemoveInput(unsigned int number) {
     connectedGristoSystem();
 }
 
-void jackClientGris::clearOutput() {
-    int outS = (int)this->outputsPort.size();
-    for (int i = 0; i < outS; i++) {
-        jack_port_unregister(client, this->outputsPort.back());
-        this->outputsPort.pop_back();
-    }
-}
-
 bool jackClientGris::addOutput(unsigned int outputPatch) {
     if (outputPatch > this->maxOutputPatch)
         this->maxOutputPatch = outputPatch;
-    String nameOut = "output";
-    nameOut += String(this->outputsPort.size() + 1);
-
-    jack_port_t *newPort = jack_port_register(this->client, nameOut.toUTF8(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-    this->outputsPort.push_back(newPort);
-    connectedGristoSystem();
     return true;
 }
 
-void jackClientGris::removeOutput(int number) {
-    jack_port_unregister(client, this->outputsPort.at(number));
-    this->outputsPort.erase(this->outputsPort.begin() + number);
-}
-
 vector<int> jackClientGris::getDirectOutOutputPatches() {
     vector<int> directOutOutputPatches;
     for (auto&& it : listSpeakerOut) {
@@ -936,53 +1636,8 @@ vector<int> jackClientGris::getDirectOutOutputPatches() {
 }
 
 void jackClientGris::connectedGristoSystem() {
-    String nameOut;
-    this->clearOutput();
-    for (unsigned int i = 0; i < this->maxOutputPatch; i++) {
-        nameOut = "output";
-        nameOut += String(this->outputsPort.size() + 1);
-        jack_port_t *newPort = jack_port_register(this->client, nameOut.toUTF8(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-        this->outputsPort.push_back(newPort);
-    }
-
-    const char **portsOut = jack_get_ports(this->client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput);
-    const char **portsIn = jack_get_ports(this->client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput);
-    
-    int i=0;
-    int j=0;
-
-    // DisConnect jackClientGris to system.
-    while (portsOut[i]) {
-        if (getClientName(portsOut[i]) == ClientName) { // jackClient
-            j = 0;
-            while (portsIn[j]) {
-                if (getClientName(portsIn[j]) == ClientNameSys && // system
-                   jack_port_connected_to(jack_port_by_name(this->client, portsOut[i]), portsIn[j])) {
-                    jack_disconnect(this->client, portsOut[i], portsIn[j]);
-                }
-                j += 1;
-            }
-        }
-        i += 1;
-    }
-
-    i=0;
-    j=0;
-
-    // Connect jackClientGris to system.
-    while (portsOut[i]) {
-        if (getClientName(portsOut[i]) == ClientName) { // jackClient
-            while (portsIn[j]) {
-                if (getClientName(portsIn[j]) == ClientNameSys) { // system
-                    jack_connect(this->client, portsOut[i], portsIn[j]);
-                    j += 1;
-                    break;
-                }
-                j += 1;
-            }
-        }
-        i += 1;
-    }
+    this->updateOutputPorts();
+    this->connectOutputsToSystem();
 
     // Build output patch list.
     this->outputPatches.clear();
@@ -991,22 +1646,65 @@ void jackClientGris::connectedGristoSystem() {
             this->outputPatches.push_back(this->listSpeakerOut[i].outputPatch);
         }
     }
+}
 
-    jack_free(portsIn);
-    jack_free(portsOut);
+void jackClientGris::updateOutputPorts() {
+    // The ports are named after their position, only the ones past the
+    // current or the new count change.
+    if (this->outputsPort.size() > this->maxOutputPatch) {
+        // The audio thread lets go of the ports first.
+        this->numOutputPorts.store(this->maxOutputPatch, memory_order_release);
+        this->swapPendingLayout();
+    }
+    while (this->outputsPort.size() > this->maxOutputPatch) {
+        jack_port_unregister(this->client, this->outputsPort.back());
+        this->outputsPort.pop_back();
+    }
+    while (this->outputsPort.size() < this->maxOutputPatch && this->outputsPort.size() < MaxOutputs) {
+        String nameOut = "output";
+        nameOut += String(this->outputsPort.size() + 1);
+        jack_port_t *newPort = jack_port_register(this->client, nameOut.toUTF8(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (newPort == nullptr) {
+            jack_client_log("Can't register port %s\n", nameOut.toRawUTF8());
+            break;
+        }
+        this->outputsPort.push_back(newPort);
+    }
+    this->numOutputPorts.store((unsigned int)this->outputsPort.size(), memory_order_release);
 }
 
-bool jackClientGris::initSpeakersTripplet(vector<Speaker *>  listSpk,
-                                          int dimensions, bool needToComputeVbap) {
-    int j;
-    if (listSpk.size() <= 0) {
-        return false;
+void jackClientGris::connectOutputsToSystem() {
+    StringArray playback = this->graph.getPorts(ClientNameSys, true);
+    vector<pair<String, String>> conns = this->graph.getConnections(ClientName, ClientNameSys);
+
+    // Output i goes to the i-th system playback port. Only the connections
+    // to the system that differ are changed, the other ones are kept.
+    for (unsigned int i = 0; i < this->outputsPort.size(); i++) {
+        String target = (int)i < playback.size() ? playback[i] : String();
+        String name = jack_port_name(this->outputsPort[i]);
+        bool connected = false;
+        for (auto&& conn : conns) {
+            if (conn.first != name) {
+                continue;
+            }
+            if (conn.second == target) {
+                connected = true;
+            } else {
+                jack_disconnect(this->client, name.toRawUTF8(), conn.second.toRawUTF8());
+            }
+        }
+        if (target.isNotEmpty() && !connected) {
+            jack_connect(this->client, name.toRawUTF8(), target.toRawUTF8());
+        }
     }
+}
 
+VBAP_DATA * jackClientGris::computeVbapLayout(vector<Speaker *> &listSpk, int dimensions) {
+    int j, count = (int)listSpk.size();
     ls lss[MAX_LS_AMOUNT];
     int outputPatches[MAX_LS_AMOUNT];
 
-    for (unsigned int i = 0; i < listSpk.size(); i++) {
+    for (int i = 0; i < count; i++) {
         for (j = 0; j < MAX_LS_AMOUNT; j++) {
             if (listSpk[i]->getOutputPatch() == listSpeakerOut[j].outputPatch && !listSpeakerOut[j].directOut) {
                 break;
@@ -1021,21 +1719,36 @@ bool jackClientGris::initSpeakersTripplet(vector<Speaker *>  listSpk,
         outputPatches[i] = listSpeakerOut[j].outputPatch;
     }
 
-    if (needToComputeVbap) {
-        this->paramVBap = init_vbap_from_speakers(lss, (int)listSpk.size(),
-                                                  dimensions, outputPatches,
-                                                  this->maxOutputPatch, NULL);
-        if (this->paramVBap == NULL) {
-            return false;
+    VBAP_DATA *data = nullptr;
+    String key;
+    if (this->layoutCache != nullptr) {
+        MemoryBlock geometry;
+        geometry.append(&dimensions, sizeof(int));
+        geometry.append(&count, sizeof(int));
+        geometry.append(&this->maxOutputPatch, sizeof(unsigned int));
+        geometry.append(lss, sizeof(ls) * count);
+        geometry.append(outputPatches, sizeof(int) * count);
+        key = LayoutCache::makeKey(LayoutCache::VbapLayout, geometry);
+        this->layoutCache->load(key, LayoutCache::VbapLayout, [&data] (const void *buffer, size_t size) {
+            data = vbap_layout_deserialize(buffer, size);
+            return data != nullptr;
+        });
+    }
+    if (data == nullptr) {
+        data = init_vbap_from_speakers(lss, count, dimensions, outputPatches,
+                                       this->maxOutputPatch, NULL);
+        if (data != nullptr && this->layoutCache != nullptr) {
+            MemoryBlock payload(vbap_layout_serialize(data, nullptr, 0));
+            vbap_layout_serialize(data, payload.getData(), payload.getSize());
+            this->layoutCache->store(key, LayoutCache::VbapLayout, payload);
         }
     }
+    return data;
+}
 
-    for (unsigned int i = 0; i < MaxInputs; i++) {
-        listSourceIn[i].paramVBap = copy_vbap_data(this->paramVBap);
-    }
-
+void jackClientGris::updateVbapTriplets() {
     int **triplets;
-    int num = vbap_get_triplets(listSourceIn[0].paramVBap, &triplets);
+    int num = vbap_get_triplets(this->paramVBap, &triplets);
     vbap_triplets.clear();
     for (int i=0; i<num; i++) {
         vector <int> row;
@@ -1049,23 +1762,70 @@ bool jackClientGris::initSpeakersTripplet(vector<Speaker *>  listSpk,
         free(triplets[i]);
     }
     free(triplets);
+}
+
+bool jackClientGris::initSpeakersTripplet(vector<Speaker *>  listSpk,
+                                          int dimensions, bool needToComputeVbap) {
+    if (listSpk.size() <= 0 || this->newPlan == nullptr) {
+        return false;
+    }
+
+    if (needToComputeVbap) {
+        VBAP_DATA *data = this->computeVbapLayout(listSpk, dimensions);
+        if (data == NULL) {
+            return false;
+        }
+        if (this->paramVBap != nullptr) {
+            free_vbap_data(this->paramVBap);
+        }
+        this->paramVBap = data;
+    }
+    if (this->paramVBap == nullptr) {
+        return false;
+    }
+
+    // Sources only hold their own direction and gains, the layout is shared.
+    for (unsigned int i = 0; i < MaxInputs; i++) {
+        if (this->newPlan->vbap[i] != nullptr) {
+            free_vbap_data(this->newPlan->vbap[i]);
+        }
+        this->newPlan->vbap[i] = copy_vbap_data(this->paramVBap);
+        vbap_set_spread_dirs(this->newPlan->vbap[i], this->vbapSpreadDirs);
+    }
+    this->newPlan->vbapDimensions = dimensions;
+
+    this->updateVbapTriplets();
 
     this->connectedGristoSystem();
 
     return true;
 }
 
-bool jackClientGris::lbapSetupSpeakerField(vector<Speaker *>  listSpk) {
-    int j;
-    if (listSpk.size() <= 0) {
+bool jackClientGris::updateVbapLayout(vector<Speaker *>  listSpk, int dimensions) {
+    if (listSpk.size() <= 0 || this->paramVBap == nullptr || this->plan->vbap[0] == nullptr) {
         return false;
     }
 
-    float azimuth[MaxOutputs];
-    float elevation[MaxOutputs];
-    float radius[MaxOutputs];
-    int outputPatch[MaxOutputs];
+    VBAP_DATA *data = this->computeVbapLayout(listSpk, dimensions);
+    if (data == nullptr) {
+        return false;
+    }
+
+    // The sources of the plan keep their gains and move to the new layout. The
+    // previous one is still referenced by paramVBap, it is only freed here.
+    this->pendingVbapLayout = data;
+    this->swapPendingLayout();
+    free_vbap_data(this->paramVBap);
+    this->paramVBap = data;
+
+    this->updateVbapTriplets();
+
+    return true;
+}
 
+void jackClientGris::getLbapSpeakers(vector<Speaker *> &listSpk, float *azimuth, float *elevation,
+                                     float *radius, int *outputPatch) {
+    int j;
     for (unsigned int i = 0; i < listSpk.size(); i++) {
         for (j = 0; j < MAX_LS_AMOUNT; j++) {
             if (listSpk[i]->getOutputPatch() == listSpeakerOut[j].outputPatch && !listSpeakerOut[j].directOut) {
@@ -1077,149 +1837,652 @@ bool jackClientGris::lbapSetupSpeakerField(vector<Speaker *>  listSpk) {
         radius[i] = listSpeakerOut[j].radius;
         outputPatch[i] = listSpeakerOut[j].outputPatch - 1;
     }
+}
+
+void jackClientGris::setupLbapField(lbap_field *field, float *azimuth, float *elevation,
+                                    float *radius, int *outputPatch, int count) {
+    int resolution = lbap_field_get_resolution(field);
+    String key;
+    if (this->layoutCache != nullptr) {
+        MemoryBlock geometry;
+        geometry.append(&resolution, sizeof(int));
+        geometry.append(&count, sizeof(int));
+        geometry.append(azimuth, sizeof(float) * count);
+        geometry.append(elevation, sizeof(float) * count);
+        geometry.append(radius, sizeof(float) * count);
+        geometry.append(outputPatch, sizeof(int) * count);
+        key = LayoutCache::makeKey(LayoutCache::LbapField, geometry);
+        if (this->layoutCache->load(key, LayoutCache::LbapField, [field] (const void *buffer, size_t size) {
+                return lbap_field_deserialize(field, buffer, size) == 0;
+            })) {
+            return;
+        }
+        // A failed read leaves the field reset, at its resolution.
+        lbap_field_set_resolution(field, resolution);
+    }
 
-    lbap_speaker *speakers = lbap_speakers_from_positions(azimuth, elevation, radius, outputPatch, (int)listSpk.size());
+    lbap_speaker *speakers = lbap_speakers_from_positions(azimuth, elevation, radius, outputPatch, count);
 
-    lbap_field_reset(this->lbap_speaker_field);
-    lbap_field_setup(this->lbap_speaker_field, speakers, (int)listSpk.size());
+    lbap_field_reset(field);
+    lbap_field_setup(field, speakers, count);
 
     free(speakers);
 
+    if (this->layoutCache != nullptr) {
+        MemoryBlock payload(lbap_field_serialize(field, nullptr, 0));
+        lbap_field_serialize(field, payload.getData(), payload.getSize());
+        this->layoutCache->store(key, LayoutCache::LbapField, payload);
+    }
+}
+
+bool jackClientGris::lbapSetupSpeakerField(vector<Speaker *>  listSpk) {
+    if (listSpk.size() <= 0 || this->newPlan == nullptr || this->newPlan->lbapField == nullptr) {
+        return false;
+    }
+
+    float azimuth[MaxOutputs];
+    float elevation[MaxOutputs];
+    float radius[MaxOutputs];
+    int outputPatch[MaxOutputs];
+
+    this->getLbapSpeakers(listSpk, azimuth, elevation, radius, outputPatch);
+    this->setupLbapField(this->newPlan->lbapField, azimuth, elevation, radius, outputPatch, (int)listSpk.size());
+    this->updateLbapReport(this->newPlan->lbapField);
+
     this->connectedGristoSystem();
 
     return true;
 }
 
-void jackClientGris::setAttenuationDB(float value) {
-    this->attenuationLinearGain[0] = value;
+bool jackClientGris::updateLbapLayout(vector<Speaker *>  listSpk) {
+    int count = (int)listSpk.size();
+    if (count <= 0 || this->plan->lbapField == nullptr) {
+        return false;
+    }
+
+    float azimuth[MaxOutputs];
+    float elevation[MaxOutputs];
+    float radius[MaxOutputs];
+    int outputPatch[MaxOutputs];
+
+    this->getLbapSpeakers(listSpk, azimuth, elevation, radius, outputPatch);
+
+    // Only the matrices of the speakers that moved are computed, unless an
+    // elevation changed the layers.
+    lbap_field *field = lbap_field_copy(this->plan->lbapField);
+    lbap_speaker *speakers = lbap_speakers_from_positions(azimuth, elevation, radius, outputPatch, count);
+    bool moved = true;
+    for (int i = 0; i < count && moved; i++) {
+        moved = lbap_field_move_speaker(field, &speakers[i]) == 0;
+    }
+    free(speakers);
+    if (! moved) {
+        this->setupLbapField(field, azimuth, elevation, radius, outputPatch, count);
+    }
+    this->updateLbapReport(field);
+
+    this->pendingLbapField = field;
+    this->swapPendingLayout();
+    lbap_field_free(this->retiredLbapField);
+    this->retiredLbapField = nullptr;
+
+    return true;
 }
 
-void jackClientGris::setAttenuationHz(float value) {
-    this->attenuationLowpassCoeff[0] = value;
+void jackClientGris::installPendingLayout() {
+    RenderPlan *current = this->plan;
+
+    if (this->pendingPlan != nullptr) {
+        // A crossfade still running is cut, publishRenderPlan() waits for it
+        // unless the processing is blocked. canInstallPendingLayout() made
+        // room for every plan retired here.
+        RenderPlan *fading = this->fadingPlan.load(memory_order_relaxed);
+        if (fading != nullptr) {
+            this->retirePlan(fading);
+        }
+        this->plan = this->pendingPlan;
+        this->crossfadePosition = 0;
+        this->crossfadeLength = (unsigned int)(this->crossfadeTime.load() * this->sampleRate);
+        if (this->crossfadeLength == 0) {
+            this->retirePlan(current);
+            current = nullptr;
+        }
+        this->fadingPlan.store(current, memory_order_release);
+        // Gains of the new plan are computed for every source.
+        for (unsigned int i = 0; i < MaxInputs; i++) {
+            this->vbapSourcesToUpdate[i] = 1;
+        }
+        this->updateSoloStates();
+    }
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        RenderTarget &target = this->monitors[m];
+        if (!target.pendingSwap) {
+            continue;
+        }
+        if (target.plan != nullptr) {
+            this->retirePlan(target.plan);
+        }
+        target.plan = target.pendingPlan;
+        for (unsigned int i = 0; i < MaxInputs; i++) {
+            this->vbapSourcesToUpdate[i] = 1;
+        }
+    }
+
+    if (this->pendingVbapLayout != nullptr) {
+        for (unsigned int i = 0; i < MaxInputs; i++) {
+            if (this->plan->vbap[i] != nullptr) {
+                vbap_share_layout(this->plan->vbap[i], this->pendingVbapLayout);
+                this->vbapSourcesToUpdate[i] = 1;
+            }
+        }
+    }
+    if (this->pendingBinaural != nullptr) {
+        this->retiredBinaural = this->plan->binaural;
+        this->plan->binaural = this->pendingBinaural;
+    }
+    if (this->pendingLbapField != nullptr && this->plan->lbap != nullptr) {
+        this->retiredLbapField = this->plan->lbapField;
+        this->plan->lbapField = this->pendingLbapField;
+        for (unsigned int i = 0; i < MaxInputs; i++) {
+            this->plan->lbap[i].pos.azi = -1;
+        }
+    }
 }
 
-void jackClientGris::updateSourceVbap(int idS) {
-    if (this->vbapDimensions == 3) {
-        if (listSourceIn[idS].paramVBap != nullptr) {
-            vbap2_flip_y_z(listSourceIn[idS].azimuth, listSourceIn[idS].zenith,
-                           listSourceIn[idS].aziSpan, listSourceIn[idS].zenSpan,
-                           listSourceIn[idS].paramVBap);
+bool jackClientGris::canInstallPendingLayout() const {
+    int needed = 0, available = 0;
+    if (this->pendingPlan != nullptr) {
+        // The running fade, and the current plan if it isn't faded out.
+        needed += this->fadingPlan.load(memory_order_relaxed) != nullptr ? 2 : 1;
+    }
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        needed += this->monitors[m].pendingSwap && this->monitors[m].plan != nullptr;
+    }
+    // Only the message thread empties the slots meanwhile.
+    for (int i = 0; i < RetiredPlanSlots; i++) {
+        available += this->retiredPlans[i].load(memory_order_relaxed) == nullptr;
+    }
+    return available >= needed;
+}
+
+bool jackClientGris::retirePlan(RenderPlan *old) {
+    for (int i = 0; i < RetiredPlanSlots; i++) {
+        RenderPlan *expected = nullptr;
+        if (this->retiredPlans[i].compare_exchange_strong(expected, old, memory_order_release)) {
+            return true;
         }
-    } else if (this->vbapDimensions == 2) {
-        if (listSourceIn[idS].paramVBap != nullptr) {
-            vbap2(listSourceIn[idS].azimuth, 0.0,
-                  listSourceIn[idS].aziSpan, 0.0,
-                  listSourceIn[idS].paramVBap);
+    }
+    return false;
+}
+
+void jackClientGris::freeRetiredPlans() {
+    for (int i = 0; i < RetiredPlanSlots; i++) {
+        freeRenderPlan(this->retiredPlans[i].exchange(nullptr, memory_order_acquire));
+    }
+}
+
+RenderPlan * jackClientGris::createRenderPlan(ModeSpatEnum mode) {
+    RenderPlan *plan = new RenderPlan;
+    plan->mode = mode;
+    if (mode == LBAP) {
+        plan->lbapField = lbap_field_init();
+        lbap_field_set_runner(plan->lbapField, runLbapTasks, this);
+        lbap_field_set_huge_pages(plan->lbapField, this->lbapHugePages);
+        lbap_field_set_resolution(plan->lbapField, this->lbapResolution);
+        plan->lbap = new LBAP_DATA[MaxInputs];
+        for (unsigned int i = 0; i < MaxInputs; i++) {
+            plan->lbap[i].pos.azi = -1;
+            plan->lbap[i].pos.ele = -1;
+            plan->lbap[i].pos.rad = -1;
+            for (unsigned int o = 0; o < MaxOutputs; o++) {
+                plan->lbap[i].gains[o] = plan->lbap[i].y[o] = 0.0;
+            }
         }
     }
+    return plan;
 }
 
-void jackClientGris::connectionClient(String name, bool connect) {
-    const char **portsOut = jack_get_ports(this->client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput);
-    const char **portsIn = jack_get_ports(this->client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput);
+void jackClientGris::beginRenderPlan(ModeSpatEnum mode) {
+    this->discardRenderPlan();
+    this->newPlan = this->createRenderPlan(mode);
+}
 
-    int i = 0;
-    int j = 0;
-    int startJ = 0;
-    int endJ = 0;
-    bool conn = false;
-    this->updateClientPortAvailable(false);
+void jackClientGris::discardRenderPlan() {
+    freeRenderPlan(this->newPlan);
+    this->newPlan = nullptr;
+}
 
-    // Disconnect client.
-    while (portsOut[i]) {
-        if (getClientName(portsOut[i]) == name) {
-            j = 0;
-            while (portsIn[j]) {
-                if (getClientName(portsIn[j]) == ClientName && // jackClient
-                   jack_port_connected_to(jack_port_by_name(this->client, portsOut[i]), portsIn[j])) {
-                    jack_disconnect(this->client, portsOut[i], portsIn[j]);
+void jackClientGris::publishRenderPlan() {
+    if (this->newPlan == nullptr) {
+        return;
+    }
+    for (unsigned int i = 0; i < MaxOutputs; i++) {
+        this->newPlan->speakers[i] = this->listSpeakerOut[i];
+    }
+
+    // One crossfade at a time, the running one ends first.
+    int timeout = (int)(this->crossfadeTime.load() * 1000.0f) + 200;
+    for (int waited = 0; waited < timeout && this->processBlockOn; waited += 2) {
+        if (this->fadingPlan.load(memory_order_acquire) == nullptr) {
+            break;
+        }
+        Thread::sleep(2);
+    }
+
+    this->freeRetiredPlans();
+    // Output commands sent for the previous plans are dropped.
+    this->newPlan->serial = ++this->planSerial;
+    this->pendingPlan = this->newPlan;
+    this->newPlan = nullptr;
+    this->swapPendingLayout();
+    this->updateBinauralLatency();
+}
+
+void jackClientGris::setSourceMute(unsigned int index, bool mute) {
+    if (index < MaxInputs) {
+        EngineCommand command = {};
+        command.type = CommandSourceMute;
+        command.index = index;
+        command.value = mute;
+        this->sendCommand(command);
+    }
+}
+
+void jackClientGris::setSourceSolo(unsigned int index, bool solo) {
+    if (index < MaxInputs) {
+        EngineCommand command = {};
+        command.type = CommandSourceSolo;
+        command.index = index;
+        command.value = solo;
+        this->sendCommand(command);
+    }
+}
+
+void jackClientGris::setSourceDirectOut(unsigned int index, int chn) {
+    if (index < MaxInputs) {
+        EngineCommand command = {};
+        command.type = CommandSourceDirectOut;
+        command.index = index;
+        command.value = chn;
+        this->sendCommand(command);
+    }
+}
+
+void jackClientGris::applySpeakerOut(unsigned int index) {
+    // A plan being built takes all the outputs when published.
+    if (this->newPlan != nullptr || index >= MaxOutputs) {
+        return;
+    }
+    const SpeakerOut &so = this->listSpeakerOut[index];
+    EngineCommand command = {};
+    command.type = CommandSpeakerOut;
+    command.index = index;
+    command.gain = so.gain;
+    command.hpActive = so.hpActive;
+    command.isMuted = so.isMuted;
+    command.isSolo = so.isSolo;
+    command.coeffs[0] = so.b1;
+    command.coeffs[1] = so.b2;
+    command.coeffs[2] = so.b3;
+    command.coeffs[3] = so.b4;
+    command.coeffs[4] = so.ha0;
+    command.coeffs[5] = so.ha1;
+    command.coeffs[6] = so.ha2;
+    command.plan = this->planSerial;
+    this->sendCommand(command);
+}
+
+bool jackClientGris::pushCommand(const EngineCommand &command) {
+    uint32_t write = this->commandQueue.writeIndex.load(memory_order_relaxed);
+    uint32_t read = this->commandQueue.readIndex.load(memory_order_acquire);
+    if (write - read >= EngineCommandCapacity) {
+        return false;
+    }
+    this->commandQueue.commands[write & (EngineCommandCapacity - 1)] = command;
+    this->commandQueue.writeIndex.store(write + 1, memory_order_release);
+    return true;
+}
+
+void jackClientGris::sendCommand(const EngineCommand &command) {
+    // The commands left over go first, the changes keep their order.
+    this->flushCommands();
+    if (this->overflowCommands.empty() && this->pushCommand(command)) {
+        return;
+    }
+    for (auto&& it : this->overflowCommands) {
+        if (it.type == command.type && it.index == command.index) {
+            it = command;
+            return;
+        }
+    }
+    this->overflowCommands.push_back(command);
+}
+
+void jackClientGris::flushCommands() {
+    unsigned int sent = 0;
+    while (sent < this->overflowCommands.size() && this->pushCommand(this->overflowCommands[sent])) {
+        sent++;
+    }
+    this->overflowCommands.erase(this->overflowCommands.begin(), this->overflowCommands.begin() + sent);
+}
+
+void jackClientGris::drainCommands() {
+    uint32_t read = this->commandQueue.readIndex.load(memory_order_relaxed);
+    uint32_t write = this->commandQueue.writeIndex.load(memory_order_acquire);
+    bool soloChanged = false;
+
+    // Applied in order, the last change of a parameter is the one heard.
+    for (; read != write; read++) {
+        const EngineCommand &command = this->commandQueue.commands[read & (EngineCommandCapacity - 1)];
+        switch (command.type) {
+            case CommandSourceMute:
+                this->listSourceIn[command.index].isMuted = command.value != 0;
+                break;
+            case CommandSourceSolo:
+                this->listSourceIn[command.index].isSolo = command.value != 0;
+                soloChanged = true;
+                break;
+            case CommandSourceDirectOut:
+                this->listSourceIn[command.index].directOut = command.value;
+                break;
+            case CommandSpeakerOut: {
+                if (command.plan != this->plan->serial) {
+                    break;
+                }
+                SpeakerOut &so = this->plan->speakers[command.index];
+                // The crossover starts from silence when it is turned on.
+                if (command.hpActive && !so.hpActive) {
+                    this->x1[command.index] = this->x2[command.index] = 0.0;
+                    this->x3[command.index] = this->x4[command.index] = 0.0;
+                    this->y1[command.index] = this->y2[command.index] = 0.0;
+                    this->y3[command.index] = this->y4[command.index] = 0.0;
                 }
-                j += 1;
+                so.gain = command.gain;
+                so.hpActive = command.hpActive;
+                so.b1 = command.coeffs[0];
+                so.b2 = command.coeffs[1];
+                so.b3 = command.coeffs[2];
+                so.b4 = command.coeffs[3];
+                so.ha0 = command.coeffs[4];
+                so.ha1 = command.coeffs[5];
+                so.ha2 = command.coeffs[6];
+                so.isMuted = command.isMuted;
+                so.isSolo = command.isSolo;
+                soloChanged = true;
+                break;
             }
         }
-        i += 1;
     }
+    this->commandQueue.readIndex.store(read, memory_order_release);
 
-    for (auto&& cli : this->listClient) {
-        if (cli.name == name) {
-            cli.connected = false;
+    if (soloChanged) {
+        this->updateSoloStates();
+    }
+}
+
+void jackClientGris::updateSoloStates() {
+    this->soloIn = false;
+    for (unsigned int i = 0; i < MaxInputs; i++) {
+        if (this->listSourceIn[i].isSolo) {
+            this->soloIn = true;
+            break;
+        }
+    }
+    this->soloOut = false;
+    for (unsigned int i = 0; i < MaxOutputs; i++) {
+        if (this->plan->speakers[i].isSolo) {
+            this->soloOut = true;
+            break;
         }
     }
+}
 
-    connectedGristoSystem();
+void jackClientGris::swapPendingLayout() {
+    if (!this->clientActive.load(memory_order_acquire)) {
+        // No process callback runs, nothing else uses the layouts.
+        this->installPendingLayout();
+    } else {
+        // Taken by the audio thread at the start of its next period, once
+        // the plans it retires fit.
+        this->layoutSwapState.store(LayoutSwapPending, memory_order_release);
+        while (this->layoutSwapState.load(memory_order_acquire) != LayoutSwapDone) {
+            this->freeRetiredPlans();
+            Thread::sleep(1);
+        }
+    }
 
-    if (!connect) { return; }
+    this->layoutSwapState.store(LayoutSwapIdle, memory_order_relaxed);
+    this->pendingVbapLayout = nullptr;
+    this->pendingLbapField = nullptr;
+    this->pendingBinaural = nullptr;
+    this->pendingPlan = nullptr;
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        this->monitors[m].pendingPlan = nullptr;
+        this->monitors[m].pendingSwap = false;
+    }
+}
 
-    // Connect other client to jackClientGris
-    this->autoConnection = true;
+void jackClientGris::setLayoutCacheDirectory(const File &directory) {
+    delete this->layoutCache;
+    this->layoutCache = new LayoutCache(directory);
+}
 
-    for (auto&& cli : this->listClient) {
-        i = 0;
-        j = 0;
-        String nameClient = cli.name;
-        startJ = cli.portStart - 1;
-        endJ = cli.portEnd;
-
-        while (portsOut[i]) {
-            if (nameClient == name && nameClient.compare(getClientName(portsOut[i])) == 0) {
-                while (portsIn[j]) {
-                    if (getClientName(portsIn[j]) == ClientName) {
-                        if (j>= startJ && j<endJ) {
-                            jack_connect(this->client, portsOut[i], portsIn[j]);
-                            conn = true;
-                            j += 1;
-                            break;
-                        } else {
-                            j += 1;
-                        }
-                    } else {
-                        j += 1;
-                        startJ += 1;
-                        endJ += 1;
-                    }
-                }
-                cli.connected = conn;
+void jackClientGris::setHrirBankFile(const File &file) {
+    delete this->hrirBank;
+    this->hrirBank = new HrirBank(file, File(HRTFFolderPath), HRIRLength);
+}
+
+void jackClientGris::setLbapResolution(int size) {
+    this->lbapResolution = size;
+}
+
+bool jackClientGris::setAudioCores(const Array<int> &cores) {
+    this->workerCores.clear();
+    if (!cores.isEmpty()) {
+        for (int i = 0; i < SystemStats::getNumCpus(); i++) {
+            if (!cores.contains(i)) {
+                this->workerCores.add(i);
             }
-            i += 1;
         }
     }
 
-    this->autoConnection = false;
-    
-    jack_free(portsIn);
-    jack_free(portsOut);
+    if (!this->clientReady) {
+        return false;
+    }
+    if (!RealtimeProfile::setThreadAffinity(jack_client_thread_id(this->client), cores)) {
+        jack_client_log("Can't pin the process thread on cores %s\n",
+                        RealtimeProfile::formatCores(cores).toRawUTF8());
+        return false;
+    }
+    return true;
+}
+
+Array<int> jackClientGris::getAudioThreadCores() {
+    if (!this->clientReady) {
+        return Array<int>();
+    }
+    return RealtimeProfile::getThreadAffinity(jack_client_thread_id(this->client));
+}
+
+lbap_field_report jackClientGris::getLbapReport() {
+    if (this->plan->lbapField == nullptr) {
+        return lbap_field_report();
+    }
+    const ScopedLock lock(this->lbapReportLock);
+    return this->lbapReport;
+}
+
+void jackClientGris::updateLbapReport(lbap_field *field) {
+    lbap_field_report report;
+    lbap_field_get_report(field, &report);
+    const ScopedLock lock(this->lbapReportLock);
+    this->lbapReport = report;
+}
+
+void jackClientGris::setAttenuationDB(float value) {
+    this->attenuationLinearGain[0] = value;
+}
+
+void jackClientGris::setAttenuationHz(float value) {
+    this->attenuationLowpassCoeff[0] = value;
 }
 
-string jackClientGris::getClientName(const char *port) {
-    if (port) {
-        jack_port_t *tt = jack_port_by_name(this->client, port);
-        if (tt) {
-            string nameClient = jack_port_name(tt);
-            string tempN = jack_port_short_name(tt);
-            return nameClient.substr(0, nameClient.size() - (tempN.size() + 1));
+void jackClientGris::updateSourcesVbap(RenderPlan &plan, const int *ids, const float *azimuths,
+                                       const float *zeniths, int num) {
+    VBAP_DATA *data[MaxInputs];
+    float azi[MaxInputs], ele[MaxInputs], aziSpan[MaxInputs], zenSpan[MaxInputs];
+    int count = 0;
+
+    if (plan.vbapDimensions != 2 && plan.vbapDimensions != 3) {
+        return;
+    }
+    for (int n = 0; n < num; n++) {
+        SourceIn &si = this->listSourceIn[ids[n]];
+        if (plan.vbap[ids[n]] != nullptr) {
+            data[count] = plan.vbap[ids[n]];
+            azi[count] = azimuths[n];
+            aziSpan[count] = si.aziSpan;
+            if (plan.vbapDimensions == 3) {
+                ele[count] = zeniths[n];
+                zenSpan[count++] = si.zenSpan;
+            } else {
+                ele[count] = 0.0;
+                zenSpan[count++] = 0.0;
+            }
         }
     }
-    return "";
+    vbap_compute_batch(data, azi, ele, aziSpan, zenSpan, count, plan.vbapDimensions == 3);
 }
 
-void jackClientGris::updateClientPortAvailable(bool fromJack) {
-    const char **portsOut = jack_get_ports(this->client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput);
-    int i = 0;
+void jackClientGris::updateSourcesHoa(RenderPlan &plan, const int *ids, const float *azimuths,
+                                      const float *zeniths, int num) {
+    float *gains[MaxInputs];
 
-    for (auto&& cli : this->listClient) {
-        cli.portAvailable = 0;
+    for (int n = 0; n < num; n++) {
+        gains[n] = plan.hoaGains[ids[n]];
     }
-    
-    while (portsOut[i]) {
-        string nameCli = getClientName(portsOut[i]);
-        if (nameCli != ClientName &&  nameCli != ClientNameSys) {
-            for (auto&& cli : this->listClient) {
-                if (cli.name.compare(nameCli) == 0) {
-                    cli.portAvailable += 1;
-                }
+    hoa_evaluate_batch(HoaBinauralOrder, azimuths, zeniths, num, gains);
+}
+
+void jackClientGris::setDeadReckoning(bool state) {
+    if (state != this->deadReckoning) {
+        // Positions received while disabled were not tracked.
+        for (unsigned int i = 0; i < MaxInputs; ++i) {
+            this->listSourceIn[i].dr_next.valid = false;
+            publishSourceMotion(this->listSourceIn[i]);
+        }
+        this->deadReckoning = state;
+    }
+}
+
+void jackClientGris::setSourceMotion(int idS, float azi, float ele) {
+    SourceMotion *m = &this->listSourceIn[idS].dr_next;
+    float p[3] = {cosf(ele) * cosf(azi), cosf(ele) * sinf(azi), sinf(ele)};
+    jack_nframes_t now = jack_frame_time(this->client);
+    jack_nframes_t interval = now - m->time;
+
+    if (!m->valid || interval > DeadReckoningMaxGap * this->sampleRate) {
+        // First position or stream resumed: no motion estimate yet.
+        m->omega = 0.0f;
+    } else if (interval > 0) {
+        // Great circle from the previous received direction to the new one.
+        float *q = m->pos;
+        float axis[3] = {q[1] * p[2] - q[2] * p[1],
+                         q[2] * p[0] - q[0] * p[2],
+                         q[0] * p[1] - q[1] * p[0]};
+        float sine = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        float cosine = q[0] * p[0] + q[1] * p[1] + q[2] * p[2];
+        if (sine > 1e-6f) {
+            for (int j = 0; j < 3; j++) {
+                m->axis[j] = axis[j] / sine;
+            }
+            m->omega = atan2f(sine, cosine) / interval;
+        } else {
+            m->omega = 0.0f;
+        }
+        jack_nframes_t horizon = (jack_nframes_t)(DeadReckoningMaxHorizon * this->sampleRate);
+        m->horizon = 2 * interval < horizon ? 2 * interval : horizon;
+    }
+
+    for (int j = 0; j < 3; j++) {
+        m->pos[j] = p[j];
+    }
+    m->time = now;
+    m->valid = true;
+    publishSourceMotion(this->listSourceIn[idS]);
+}
+
+void jackClientGris::connectionClient(String name, bool connect) {
+    this->updateClientPortAvailable(false);
+
+    // The k-th output of the client goes to our input portStart + k, up to
+    // portEnd. Only the connections that differ are changed.
+    StringArray portsOut = this->graph.getPorts(name, false);
+    StringArray targets;
+    Client *cli = nullptr;
+    for (auto&& it : this->listClient) {
+        if (it.name == name) {
+            cli = &it;
+        }
+    }
+    for (int i = 0; i < portsOut.size(); i++) {
+        String target;
+        if (connect && cli != nullptr) {
+            unsigned int j = cli->portStart - 1 + i;
+            if (cli->portStart > 0 && j < cli->portEnd && j < this->inputsPort.size()) {
+                target = jack_port_name(this->inputsPort[j]);
             }
         }
-        i++;
+        targets.add(target);
+    }
+
+    // Disconnect client.
+    vector<bool> done(portsOut.size(), false);
+    for (auto&& conn : this->graph.getConnections(name, ClientName)) {
+        int i = portsOut.indexOf(conn.first);
+        if (i >= 0 && targets[i] == conn.second) {
+            done[i] = true;
+        } else {
+            jack_disconnect(this->client, conn.first.toRawUTF8(), conn.second.toRawUTF8());
+        }
+    }
+
+    connectedGristoSystem();
+
+    // Connect other client to jackClientGris
+    bool conn = false;
+    this->lockExpectedConnections.lock();
+    this->expectedConnections.clear();
+    for (int i = 0; i < portsOut.size(); i++) {
+        if (targets[i].isNotEmpty() && !done[i]) {
+            this->expectedConnections.push_back(make_pair(portsOut[i], targets[i]));
+        }
+    }
+    this->lockExpectedConnections.unlock();
+
+    for (int i = 0; i < portsOut.size(); i++) {
+        if (targets[i].isEmpty()) {
+            continue;
+        }
+        if (!done[i]) {
+            jack_connect(this->client, portsOut[i].toRawUTF8(), targets[i].toRawUTF8());
+        }
+        conn = true;
+    }
+
+    if (cli != nullptr) {
+        cli->connected = conn;
+    }
+    this->clientsVersion++;
+}
+
+void jackClientGris::updateClientPortAvailable(bool fromJack) {
+    for (auto&& cli : this->listClient) {
+        if (cli.name != ClientName && cli.name != ClientNameSys) {
+            cli.portAvailable = (unsigned int)this->graph.getPorts(cli.name, false).size();
+        } else {
+            cli.portAvailable = 0;
+        }
     }
 
     unsigned int start = 1;
@@ -1286,15 +2549,36 @@ void jackClientGris::updateClientPortAvailable(bool fromJack) {
         }
     }
 
-    jack_free(portsOut);
+    this->clientsVersion++;
 }
 
 jackClientGris::~jackClientGris() {
-    // TOFIX: this->paramVBap and this->listSourceIn->paramVBap are never deallocated.
-
-    lbap_field_free(this->lbap_speaker_field);
-
+    this->cancelPendingUpdate();
     jack_deactivate(this->client);
+    this->clientActive = false;
+
+    freeRenderPlan(this->plan);
+    freeRenderPlan(this->fadingPlan);
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        freeRenderPlan(this->monitors[m].plan);
+    }
+    freeRenderPlan(this->newPlan);
+    this->freeRetiredPlans();
+    delete[] this->crossfadeBuffer;
+    delete this->lbapPool;
+    delete this->layoutCache;
+    delete this->hrirBank;
+
+    if (this->hoaBinaural != nullptr) {
+        freeBinauralSetup(this->hoaBinaural);
+    }
+    for (unsigned int m = 0; m < MaxMonitors; m++) {
+        for (unsigned int i = 0; i < MonitorChannels; i++) {
+            if (this->monitors[m].ports[i] != nullptr) {
+                jack_port_unregister(this->client, this->monitors[m].ports[i]);
+            }
+        }
+    }
     for (unsigned int i = 0; i < this->inputsPort.size(); i++) {
         jack_port_unregister(this->client, this->inputsPort[i]);
     }
@@ -1303,4 +2587,8 @@ jackClientGris::~jackClientGris() {
         jack_port_unregister(this->client, this->outputsPort[i]);
     }
     jack_client_close(this->client);
+
+    if (this->paramVBap != nullptr) {
+        free_vbap_data(this->paramVBap);
+    }
 }
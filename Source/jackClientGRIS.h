@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <atomic>
 
 #if defined(WIN32) || defined(_WIN64)
 #include <stdint.h>
@@ -46,13 +47,48 @@
 
 #include "vbap.h"
 #include "lbap.h"
+#include "partconv.h"
+#include "hoa.h"
+#include "LayoutCache.h"
+#include "HrirBank.h"
+#include "JackGraph.h"
+#include "RealtimeProfile.h"
 
 class Speaker;
 using namespace std;
 
+// States of a layout handed to the audio thread.
+static const int LayoutSwapIdle    = 0;
+static const int LayoutSwapPending = 1;
+static const int LayoutSwapTaken   = 2;
+static const int LayoutSwapDone    = 3;
+
+// Replaced render plans waiting to be freed by the message thread.
+static const int RetiredPlanSlots = 4;
+
+// Largest and smallest partitions of the binaural convolution, in frames.
+static const unsigned int HRTFPartitionSize = 128;
+static const unsigned int HRTFMinPartitionSize = 32;
+// Length of the impulse responses of the binaural convolution.
+static const unsigned int HRIRLength = 128;
+// Ambisonic order of the HOA BINAURAL mode and its number of channels.
+static const int HoaBinauralOrder = 3;
+static const unsigned int HoaBinauralChannels = 16;
+// Render target of the monitor outputs when no monitor mix is selected.
+static const int MonitorOff = -1;
+// Monitor mixes rendered besides the speaker feed, and ports of each one.
+static const unsigned int MaxMonitors = 2;
+static const unsigned int MonitorChannels = 2;
+
+// Regularization of the HOA BINAURAL decoder, relative to the mean energy
+// of the harmonics over the measured directions.
+static const float HoaBinauralRegularization = 0.01f;
+
 // Limits of SpatGRIS2 In/Out.
 static unsigned int const MaxInputs  = 256;
 static unsigned int const MaxOutputs = 256;
+// Largest period of jack (BUFFER_SIZE_MAX), the crossfade holds one.
+static unsigned int const MaxBufferFrames = 8192;
 
 typedef struct {
     lbap_pos pos;
@@ -70,6 +106,16 @@ struct Client {
     bool         connected     = false;
 };
 
+// Received motion of a source, handed to the audio thread as one snapshot.
+struct SourceMotion {
+    float pos[3] = {1.0f, 0.0f, 0.0f};   // Last received direction.
+    float axis[3] = {0.0f, 0.0f, 1.0f};  // Rotation axis of the estimated motion.
+    float omega = 0.0f;                   // Angular speed in radians per frame.
+    jack_nframes_t time = 0;              // Frame time of the last received position.
+    jack_nframes_t horizon = 0;           // Maximum extrapolation in frames.
+    bool valid = false;
+};
+
 struct SourceIn {
     unsigned int id;
     float x = 0.0f;
@@ -84,17 +130,20 @@ struct SourceIn {
     float aziSpan = 0.0f;
     float zenSpan = 0.0f;
 
-    float lbap_gains[MaxOutputs];
-    float lbap_y[MaxOutputs];
-    lbap_pos lbap_last_pos;
-
     bool  isMuted = false;
     bool  isSolo = false;
     float gain;            // Not used yet.
 
     int directOut = 0;
-    
-    VBAP_DATA * paramVBap;
+
+    // Dead reckoning state (directions are unit vectors). The writers, serialized
+    // by the inputs lock, update dr_next and publish it in dr_shared under the
+    // dr_seq sequence lock. The audio thread copies it in dr_motion.
+    SourceMotion dr_next;
+    SourceMotion dr_shared;
+    std::atomic<uint32_t> dr_seq { 0 };
+    SourceMotion dr_motion;
+    float dr_cur[3] = {1.0f, 0.0f, 0.0f};   // Direction used by the gain stage.
 };
 
 struct SpeakerOut {
@@ -126,14 +175,112 @@ struct SpeakerOut {
     bool directOut = false;
 };
 
+// Virtual speakers of the BINAURAL mode, rendered by a convolution of
+// their feeds with the impulse responses of both ears. The HOA BINAURAL
+// render uses the same structure, its "speakers" are the ambisonic channels.
+struct BinauralSetup {
+    unsigned int numSpeakers;   // Fed by the output patches 1 to numSpeakers.
+    float *impulses;            // [speaker][ear][HRIRLength]
+    float *feeds;               // Virtual speaker signals, [speaker][feedFrames].
+    unsigned int feedFrames;
+    unsigned int periodFrames;  // Period the convolution is prepared for.
+    partconv *conv;             // Null if the speakers can't be filtered.
+    // Periods the partitions don't divide go through a FIFO of one block,
+    // [speaker + ear][block], which delays the signal by `latency` frames.
+    float *fifo;
+    unsigned int fifoFill;
+    unsigned int latency;
+};
+
+// Sources that moved during the current period and the directions (degrees)
+// to render, shared by the speaker feed and the monitor mix.
+struct SourceMoves {
+    int ids[MaxInputs];
+    float azimuths[MaxInputs];
+    float zeniths[MaxInputs];
+    int num = 0;
+};
+
 // Spatialization modes.
 typedef enum {
     VBAP = 0,
     LBAP,
     VBAP_HRTF,
-    STEREO
+    STEREO,
+    HOA_BINAURAL
 } ModeSpatEnum;
 
+// Everything the audio thread needs to render a speaker setup in a mode.
+// A plan is built whole on the message thread, handed to the audio thread
+// at the start of a period and freed by the message thread once replaced.
+struct RenderPlan {
+    ModeSpatEnum mode = VBAP;
+    unsigned int vbapDimensions = 0;
+    unsigned int serial = 0;            // Set when published.
+
+    // Gain, crossover, mute and solo of the outputs.
+    SpeakerOut speakers[MaxOutputs];
+
+    VBAP_DATA *vbap[MaxInputs] = {};     // VBAP and BINAURAL, sharing one layout.
+    lbap_field *lbapField = nullptr;     // LBAP.
+    LBAP_DATA *lbap = nullptr;           // LBAP, [MaxInputs].
+    BinauralSetup *binaural = nullptr;   // BINAURAL virtual speakers or HOA BINAURAL filters.
+
+    // Ambisonic encoding gains of HOA BINAURAL.
+    float hoaGains[MaxInputs][HoaBinauralChannels] = {};
+    float hoaY[MaxInputs][HoaBinauralChannels] = {};
+
+    // STEREO data.
+    float lastAzi[MaxInputs] = {};
+
+    // LBAP distance attenuation state.
+    float lastAttenuationGain[MaxInputs] = {};
+    float lastAttenuationCoef[MaxInputs] = {};
+    float attenuationLowpassY[MaxInputs] = {};
+    float attenuationLowpassZ[MaxInputs] = {};
+};
+
+// Render target besides the speaker feed, heard on its own group of ports
+// (monitor1, monitor2... across the targets). The source directions, mute,
+// solo and input levels are the ones of the speaker feed.
+struct RenderTarget {
+    RenderPlan *plan = nullptr;         // Null when no mix is selected.
+    RenderPlan *pendingPlan = nullptr;  // Installed with the next layout swap.
+    bool pendingSwap = false;
+    std::atomic<int> mode { MonitorOff };  // MonitorOff, STEREO or HOA_BINAURAL.
+    jack_port_t *ports[MonitorChannels] = {};
+};
+
+// Control changes sent by the message thread to the audio thread.
+typedef enum {
+    CommandSourceMute = 0,
+    CommandSourceSolo,
+    CommandSourceDirectOut,
+    CommandSpeakerOut       // Gain, crossover, mute and solo of an output.
+} EngineCommandType;
+
+struct EngineCommand {
+    EngineCommandType type;
+    unsigned int index;     // Source or output, from 0.
+    int value;              // Mute, solo or direct out of a source.
+    float gain;
+    bool hpActive;
+    bool isMuted;
+    bool isSolo;
+    double coeffs[7];       // b1..b4, ha0..ha2.
+    unsigned int plan;      // Serial of the plan an output command applies to.
+};
+
+// Single-producer/single-consumer ring of commands (same indexing scheme as
+// the ShmControl ring), drained by the audio thread at the start of a period.
+static const uint32_t EngineCommandCapacity = 1024;     // Commands, power of two.
+
+struct EngineCommandQueue {
+    alignas(64) std::atomic<uint32_t> writeIndex { 0 };  // Only written by the message thread.
+    alignas(64) std::atomic<uint32_t> readIndex { 0 };   // Only written by the audio thread.
+    alignas(64) EngineCommand commands[EngineCommandCapacity];
+};
+
 // Audio recorder class used to write a monophonic soundfile on disk.
 class AudioRecorder
 {
@@ -212,7 +359,7 @@ private:
     std::atomic<AudioFormatWriter::ThreadedWriter*> activeWriter { nullptr };
 };
 
-class jackClientGris {
+class jackClientGris : private AsyncUpdater {
 public:
     // class variables.
     //-----------------
@@ -227,12 +374,14 @@ public:
     jack_client_t *client;
     vector<jack_port_t *> inputsPort;
     vector<jack_port_t *> outputsPort;
+    // Output ports used by the audio thread, lowered before a port goes.
+    std::atomic<unsigned int> numOutputPorts;
 
     // Interpolation and master gain values.
     float interMaster;
     float masterGainOut;
 
-    // Global solo states.
+    // Global solo states, kept by the audio thread.
     bool soloIn;
     bool soloOut;
 
@@ -265,12 +414,21 @@ public:
     vector<Client> listClient;
     mutex          lockListClient;
 
+    // Ports and connections of the JACK graph, from the notifications.
+    JackGraph graph;
+    // Bumped whenever the clients, their ports or connections change.
+    std::atomic<unsigned int> clientsVersion;
+    // Set when ports come or go, the available ports are counted again.
+    std::atomic<bool> clientPortsChanged;
+
     // Source and output lists.
     SourceIn   listSourceIn   [MaxInputs];
     SpeakerOut listSpeakerOut [MaxOutputs];
 
     // Enable/disable jack process callback.
-    bool         processBlockOn;
+    std::atomic<bool> processBlockOn;
+    // True while jack calls process_audio, between activation and deactivation.
+    std::atomic<bool> clientActive;
 
     // True when jack reports an xrun.
     bool overload;
@@ -278,24 +436,62 @@ public:
     // Which spatialization mode is selected.
     ModeSpatEnum modeSelected;
     
-    bool autoConnection; // not sure this one is necessary ?
+    // Connections requested by connectionClient() and not notified yet.
+    // Any other connection notified is undone.
+    vector<pair<String, String>> expectedConnections;
+    mutex lockExpectedConnections;
 
     // VBAP data.
     unsigned int vbapDimensions;
     vector<vector<int>> vbap_triplets;
     int vbapSourcesToUpdate[MaxInputs];
 
-    // BINAURAL data.
-    unsigned int hrtf_count[16];
-    float hrtf_input_tmp[16][128];
-    float vbap_hrtf_left_impulses[16][128];
-    float vbap_hrtf_right_impulses[16][128];
+    // Monitor mixes, each one rendering its plan on its own group of ports.
+    RenderTarget monitors[MaxMonitors];
 
-    // STEREO data.
-    float last_azi[MaxInputs];
+    // Plan rendered by the audio thread. The replaced one is still rendered
+    // until the end of the crossfade, then retired.
+    RenderPlan *plan;
+    std::atomic<RenderPlan *> fadingPlan;
+    // Replaced plans, freed by the message thread.
+    std::atomic<RenderPlan *> retiredPlans[RetiredPlanSlots];
+
+    // Equal power crossfade from the replaced plan to the new one.
+    std::atomic<float> crossfadeTime;   // Seconds.
+    float *crossfadeBuffer;             // Replaced plan's outputs, then the fade gains.
+    unsigned int crossfadeFrames;       // MaxBufferFrames.
+    unsigned int crossfadePosition;
+    unsigned int crossfadeLength;
+
+    // HOA BINAURAL filters, copied in the plans that render them. Null until
+    // a render target needs them.
+    BinauralSetup *hoaBinaural;
+    HrirBank *hrirBank;     // Measured impulse responses, opened on first use.
 
     // LBAP data.
-    lbap_field *lbap_speaker_field;
+    ThreadPool *lbapPool;   // Computes the field matrices.
+    Array<int> workerCores; // Cores of the LBAP workers, any if empty.
+
+    // Compiled VBAP and LBAP layouts of the known speaker setups, may be null.
+    LayoutCache *layoutCache;
+
+    // Layout handed to the audio thread by updateVbapLayout() or
+    // updateLbapLayout(), installed in the current plan at the start of its
+    // next period.
+    VBAP_DATA *pendingVbapLayout;
+    lbap_field *pendingLbapField;
+    lbap_field *retiredLbapField;   // Replaced field, freed by the message thread.
+    BinauralSetup *pendingBinaural;
+    BinauralSetup *retiredBinaural;
+    // Plan handed to the audio thread, the monitor ones are in monitors.
+    RenderPlan *pendingPlan;
+    std::atomic<int> layoutSwapState;
+
+    // Extrapolate source motion between received positions.
+    bool deadReckoning;
+
+    // Updated once per period for all the render targets.
+    SourceMoves movedSources;
 
     // Recording parameters.
     AudioRecorder recorder[MaxOutputs];
@@ -306,10 +502,6 @@ public:
     // LBAP distance attenuation values.
     float attenuationLinearGain[1];
     float attenuationLowpassCoeff[1];
-    float lastAttenuationGain[MaxInputs];
-    float lastAttenuationCoef[MaxInputs];
-    float attenuationLowpassY[MaxInputs];
-    float attenuationLowpassZ[MaxInputs];
 
     // Class methods.
     //---------------
@@ -325,15 +517,19 @@ public:
 
     // Manage Inputs / Outputs.
     void addRemoveInput(unsigned int number);
-    void clearOutput();
+    // Raises the number of outputs, applied by connectedGristoSystem().
     bool addOutput(unsigned int outputPatch);
-    void removeOutput(int number);
     vector<int> getDirectOutOutputPatches();
 
     // Manage clients.
     void connectionClient(String name, bool connect = true);
     void updateClientPortAvailable(bool fromJack);
-    string getClientName(const char *port);
+    unsigned int getClientsVersion() const { return this->clientsVersion; }
+
+    // Registers output1 to output<maxOutputPatch>, only the ports that are
+    // missing or extra, and connects them to the system's inputs. The other
+    // connections of the kept ports are left alone.
+    void connectedGristoSystem();
 
     // Recording.
     void prepareToRecord();
@@ -347,21 +543,115 @@ public:
     String getRecordingPath() { return this->recordPath; }
     bool isSavingRun() { return this->recording; };
 
+    // A new speaker setup or mode is built in a plan opened by
+    // beginRenderPlan(), by initSpeakersTripplet(), lbapSetupSpeakerField(),
+    // setupBinauralSpeakers() or setupHoaBinaural(). publishRenderPlan()
+    // takes the outputs from listSpeakerOut and crossfades to the new plan.
+    void beginRenderPlan(ModeSpatEnum mode);
+    void publishRenderPlan();
+    void discardRenderPlan();
+    // Frees the plans the audio thread is done with.
+    void freeRetiredPlans();
+
+    // Control changes, applied by the audio thread at the start of its next
+    // period. Only the message thread calls them.
+    void setSourceMute(unsigned int index, bool mute);
+    void setSourceSolo(unsigned int index, bool solo);
+    void setSourceDirectOut(unsigned int index, int chn);
+    // Sends the gain, crossover, mute and solo of listSpeakerOut[index].
+    void applySpeakerOut(unsigned int index);
+    // Sends the commands left over when the queue was full.
+    void flushCommands();
+    // Called by the audio thread.
+    void drainCommands();
+
+    // Memory locking and heap prefaulting of the process.
+    RealtimeProfile realtimeProfile;
+    // Pins the JACK process thread on `cores`, any core if empty. The LBAP
+    // workers then run on the other cores.
+    bool setAudioCores(const Array<int> &cores);
+    // Cores the process thread may run on, empty if unknown.
+    Array<int> getAudioThreadCores();
+
+    // Length of the crossfade between two plans.
+    void setCrossfadeTime(float seconds) { this->crossfadeTime = seconds; }
+
     // Initialize VBAP algorithm.
     bool initSpeakersTripplet(vector<Speaker *>  listSpk, int dimensions, bool needToComputeVbap);
 
     // Initialize LBAP algorithm.
     bool lbapSetupSpeakerField(vector<Speaker *>  listSpk);
 
+    // Apply new speaker positions to the VBAP or LBAP algorithm while the
+    // audio runs. The speakers must be the ones of the current setup.
+    bool updateVbapLayout(vector<Speaker *>  listSpk, int dimensions);
+    bool updateLbapLayout(vector<Speaker *>  listSpk);
+
+    // Called by the audio thread when a layout is pending, once there are
+    // enough free retired plan slots for the plans it replaces.
+    bool canInstallPendingLayout() const;
+    void installPendingLayout();
+    // Hands a replaced plan to the message thread, false if it can't take it yet.
+    bool retirePlan(RenderPlan *old);
+
+    // Directory of the compiled layouts cache, used by initSpeakersTripplet()
+    // and lbapSetupSpeakerField() to skip the geometry of known setups.
+    void setLayoutCacheDirectory(const File &directory);
+
+    // Packed impulse responses of the binaural mode, converted from the
+    // KEMAR WAV files the first time setupBinauralSpeakers() needs them.
+    void setHrirBankFile(const File &file);
+
+    // Directions sampled by the VBAP spread, used by the next initSpeakersTripplet().
+    void setVbapSpreadDirs(int count) { this->vbapSpreadDirs = count; }
+    int getVbapSpreadDirs() const { return this->vbapSpreadDirs; }
+
+    // LBAP field resolution, used by the next lbapSetupSpeakerField().
+    void setLbapResolution(int size);
+    int getLbapResolution() const { return this->lbapResolution; }
+    // Maps the matrices of the next LBAP fields on huge pages.
+    void setLbapHugePages(bool enable) { this->lbapHugePages = enable; }
+    bool getLbapHugePages() const { return this->lbapHugePages; }
+    // Report of the last LBAP field set up, measured once per setup.
+    lbap_field_report getLbapReport();
+
     // LBAP distance attenuation functions.
     void setAttenuationDB(float value);
     void setAttenuationHz(float value);
 
-    // Need to update a source VBAP data.
-    void updateSourceVbap(int idS);
-
-    // Reinit HRTF delay lines.
-    void resetHRTF();
+    // Need to update sources VBAP data of a plan.
+    void updateSourcesVbap(RenderPlan &plan, const int *ids, const float *azimuths, const float *zeniths, int num);
+
+    // Need to update sources ambisonic encoding gains of a plan.
+    void updateSourcesHoa(RenderPlan &plan, const int *ids, const float *azimuths, const float *zeniths, int num);
+
+    // Dead reckoning. setSourceMotion() is called for every received position
+    // (azimuth and elevation in radians) to estimate the source's angular velocity.
+    // Both are called with the inputs lock held.
+    void setDeadReckoning(bool state);
+    void setSourceMotion(int idS, float azi, float ele);
+
+    // Loads the impulse responses of the virtual speakers of the BINAURAL
+    // mode, the nearest measured directions of the KEMAR set.
+    bool setupBinauralSpeakers(vector<Speaker *>  listSpk);
+
+    // Gives the plan being built the ambisonic to binaural filters of the
+    // HOA BINAURAL render.
+    bool setupHoaBinaural();
+
+    // Selects the render target of a monitor's outputs.
+    bool setMonitorMode(unsigned int monitor, int mode);
+    int getMonitorMode(unsigned int monitor) const { return this->monitors[monitor].mode.load(); }
+    // True if a monitor renders in this mode.
+    bool isMonitorMode(int mode) const;
+
+    // Rebuilds the binaural convolutions in use for the current period,
+    // on the message thread after a buffer size change.
+    void handleAsyncUpdate() override;
+    void bufferSizeChanged(unsigned int nframes);
+    // Delay of the binaural convolutions in use, reported to JACK.
+    std::atomic<unsigned int> binauralLatency;
+    void updateBinauralLatency();
     
 private:
     // Tells if an error occured while setting up the client.
@@ -372,11 +662,56 @@ private:
     int recordFileConfig = 0;   // 0 = Multiple Mono Files, 1 = Single Interleaved
     String recordPath = "";
 
-    // This structure is used to compute the VBAP algorithm only once. Each source only gets a copy.
+    // This structure is used to compute the VBAP algorithm only once. Each source gets
+    // a copy sharing its loudspeaker layout.
     VBAP_DATA *paramVBap;
 
-    // Connect the server's outputs to the system's inputs.
-    void connectedGristoSystem();
+    // Plan opened by beginRenderPlan().
+    RenderPlan *newPlan;
+    // Serial of the last published plan.
+    unsigned int planSerial;
+
+    // Spread resolution of the VBAP sources.
+    int vbapSpreadDirs;
+
+    // Resolution of the LBAP fields.
+    int lbapResolution;
+    bool lbapHugePages;
+    lbap_field_report lbapReport;
+    CriticalSection lbapReportLock;
+
+    // Render plans.
+    RenderPlan * createRenderPlan(ModeSpatEnum mode);
+
+    // Output port management.
+    void updateOutputPorts();
+    void connectOutputsToSystem();
+
+    // VBAP and LBAP setup helpers, using the layout cache.
+    VBAP_DATA * computeVbapLayout(vector<Speaker *> &listSpk, int dimensions);
+    void updateVbapTriplets();
+    void getLbapSpeakers(vector<Speaker *> &listSpk, float *azimuth, float *elevation,
+                         float *radius, int *outputPatch);
+    void updateLbapReport(lbap_field *field);
+    void setupLbapField(lbap_field *field, float *azimuth, float *elevation,
+                        float *radius, int *outputPatch, int count);
+
+    // Derives the ambisonic to binaural filters of the HOA BINAURAL render
+    // from all the measured directions of the KEMAR set, once.
+    bool buildHoaBinauralFilters();
+
+    // Hands the pending layout to the audio thread and waits until it is installed,
+    // or installs it if the client is not active.
+    void swapPendingLayout();
+
+    // Control changes to the audio thread. Commands that don't fit are kept,
+    // the last one per parameter, and sent by flushCommands().
+    EngineCommandQueue commandQueue;
+    vector<EngineCommand> overflowCommands;
+    void sendCommand(const EngineCommand &command);
+    bool pushCommand(const EngineCommand &command);
+    // Global solo states from the sources and the outputs of the plan.
+    void updateSoloStates();
 };
 
 #endif /* JACKCLIENTGRIS_H */
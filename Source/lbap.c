@@ -1,12 +1,42 @@
+/* mmap flags and madvise are extensions to strict C99. */
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include "lbap.h"
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 #ifndef M_PI
 #define M_PI    (3.14159265358979323846264338327950288)
 #endif
 
+/* Number of sources processed together by lbap_field_compute_batch. */
+#define LBAP_BATCH_SIZE 64
+
+/* Alignment, in bytes, of the layer matrices. */
+#define LBAP_MATRIX_ALIGNMENT 64
+
+/* Largest supported resolution. */
+#define LBAP_MAX_MATRIX_SIZE 256
+
+/* Number of matrix rows computed by a task. */
+#define LBAP_ROWS_PER_TASK 8
+
+/* Size of a huge page, the matrices mapped on them are rounded to it. */
+#define LBAP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Pages holding the matrices of a layer. */
+#define LBAP_PAGES_NORMAL 0
+#define LBAP_PAGES_TRANSPARENT 1   /* Transparent huge pages, if the kernel finds some. */
+#define LBAP_PAGES_HUGE 2          /* Reserved huge pages (hugetlbfs). */
+
 /* =================================================================================
 Opaque data type declarations.
 ================================================================================= */
@@ -16,7 +46,14 @@ struct lbap_layer {
     int num_of_speakers;    /**< Number of speakers into the layer. */
     float ele;              /**< Elevation of the layer in the range 0 .. pi/2. */
     float expon;            /**< Speaker gain exponent for 4+ speakers. */ 
-    float ***matrix;        /**< Arrays of amplitude values [spk][x][y]. */
+    int size;               /**< Resolution of the matrices. */
+    int stride;             /**< Values per matrix point (speakers, padded). */
+    float *matrix;          /**< Amplitude values [x][y][spk], aligned. */
+    void *matrix_mem;       /**< Allocated block holding the matrix. */
+    size_t matrix_bytes;    /**< Size of the allocated block. */
+    size_t matrix_mapped;   /**< Size of the mapping, 0 if allocated by calloc. */
+    int matrix_pages;       /**< LBAP_PAGES_* of the block. */
+    void (*interp)(lbap_layer *layer, float x, float y, float *gains); /**< Matrix lookup. */
     lbap_pos *speakers;     /**< Array of speakers. */
 };
 
@@ -24,7 +61,11 @@ struct lbap_field {
     int num_of_speakers;    /**< Total number of speakers in the field. */
     int num_of_layers;      /**< Number of layers into the field. */
     int *out_order;         /**< Physical output order as a list of int. */
+    int resolution;         /**< Resolution of the next lbap_field_setup. */
     lbap_layer **layers;    /**< Array of layers. */
+    lbap_runner runner;     /**< Runs the matrix computations, may be NULL. */
+    void *runner_context;   /**< Context given to the runner. */
+    int huge_pages;         /**< Maps the layer matrices on huge pages. */
 };
 
 /* =================================================================================
@@ -38,22 +79,6 @@ lbap_poltocar(lbap_pos *pos) {
     pos->y = pos->rad * sinf(pos->azi);
 }
 
-/* Bilinear interpolation to retrieve the value at position (x, y) in a 2D matrix. */
-static float
-lbap_lookup(float **matrix, float x, float y) {
-    int xi = (int)x;
-    int yi = (int)y;
-    float xf = x - xi;
-    float yf = y - yi;
-    float v1 = matrix[xi][yi];
-    float v2 = matrix[xi+1][yi];
-    float v3 = matrix[xi][yi+1];
-    float v4 = matrix[xi+1][yi+1];
-    float xv1 = v1 + (v2 - v1) * xf;
-    float xv2 = v3 + (v4 - v3) * xf;
-    return xv1 + (xv2 - xv1) * yf;
-}
-
 /* Compare two speaker positions based on elevation. */
 static int
 lbap_speaker_compare(const void *pa, const void *pb) {
@@ -109,16 +134,89 @@ lbap_pos_from_speakers(lbap_speaker *speakers, int num) {
 lbap_layer utility functions.
 ================================================================================= */
 
+/* Bilinear interpolation of the matrices at position (x, y), for all the
+ * speakers of the layer. The four surrounding points are contiguous runs
+ * of `stride` values. */
+static inline void
+lbap_layer_interp(lbap_layer *layer, float x, float y, const int size, float *gains) {
+    int i, xi = (int)x, yi = (int)y;
+    float xf = x - xi, yf = y - yi, xv1, xv2;
+    const float *v1 = layer->matrix + (xi * (size + 1) + yi) * layer->stride;
+    const float *v2 = v1 + (size + 1) * layer->stride;
+    const float *v3 = v1 + layer->stride;
+    const float *v4 = v2 + layer->stride;
+    for (i=0; i<layer->num_of_speakers; i++) {
+        xv1 = v1[i] + (v2[i] - v1[i]) * xf;
+        xv2 = v3[i] + (v4[i] - v3[i]) * xf;
+        gains[i] = xv1 + (xv2 - xv1) * yf;
+    }
+}
+
+/* One lookup function per supported resolution, with constant index math. */
+#define LBAP_LAYER_INTERP(SIZE) \
+static void \
+lbap_layer_interp_##SIZE(lbap_layer *layer, float x, float y, float *gains) { \
+    lbap_layer_interp(layer, x, y, SIZE, gains); \
+}
+
+LBAP_LAYER_INTERP(32)
+LBAP_LAYER_INTERP(64)
+LBAP_LAYER_INTERP(128)
+LBAP_LAYER_INTERP(256)
+
+/* Allocates the zeroed matrix block of a layer, on huge pages if asked
+ * and available. Falls back to calloc. */
+static void
+lbap_layer_alloc_matrix(lbap_layer *layer, int huge_pages) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    size_t len;
+    void *mem;
+
+    if (huge_pages) {
+        len = (layer->matrix_bytes + LBAP_HUGE_PAGE_SIZE - 1) & ~(size_t)(LBAP_HUGE_PAGE_SIZE - 1);
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            layer->matrix_mem = mem;
+            layer->matrix_mapped = len;
+            layer->matrix_pages = LBAP_PAGES_HUGE;
+            return;
+        }
+#ifdef MADV_HUGEPAGE
+        /* No reserved huge pages, asks for transparent ones. */
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            layer->matrix_mem = mem;
+            layer->matrix_mapped = len;
+            layer->matrix_pages = madvise(mem, len, MADV_HUGEPAGE) == 0 ?
+                                  LBAP_PAGES_TRANSPARENT : LBAP_PAGES_NORMAL;
+            return;
+        }
+#endif
+    }
+#endif
+    layer->matrix_mem = calloc(1, layer->matrix_bytes);
+    layer->matrix_mapped = 0;
+    layer->matrix_pages = LBAP_PAGES_NORMAL;
+}
+
 /* Initialize a newly created layer for `num` speakers. */
 static lbap_layer *
-lbap_layer_init(int id, float ele, lbap_pos *speakers, int num) {
-    int i, x, y, size1 = LBAP_MATRIX_SIZE + 1;
+lbap_layer_init(int id, float ele, lbap_pos *speakers, int num, int size, int huge_pages) {
+    int i, size1 = size + 1, align = LBAP_MATRIX_ALIGNMENT / sizeof(float);
 
     lbap_layer *layer = (lbap_layer *)malloc(sizeof(lbap_layer));
 
     layer->id = id;
     layer->ele = ele;
     layer->num_of_speakers = num;
+    layer->size = size;
+    switch (size) {
+        case 32: layer->interp = lbap_layer_interp_32; break;
+        case 128: layer->interp = lbap_layer_interp_128; break;
+        case 256: layer->interp = lbap_layer_interp_256; break;
+        default: layer->interp = lbap_layer_interp_64; break;
+    }
 
     if (num <= 4)
         layer->expon = 1.0;
@@ -128,43 +226,98 @@ lbap_layer_init(int id, float ele, lbap_pos *speakers, int num) {
     layer->speakers = (lbap_pos *)malloc(sizeof(lbap_pos) * num);
     for (i=0; i<num; i++) {
         layer->speakers[i].azi = speakers[i].azi;
+        layer->speakers[i].ele = speakers[i].ele;
         layer->speakers[i].rad = speakers[i].rad;
         lbap_poltocar(&layer->speakers[i]);
     }
 
-    layer->matrix = (float ***)malloc(sizeof(float *) * num);
-    for (i=0; i<num; i++) {
-        layer->matrix[i] = (float **)malloc(sizeof(float *) * size1);
-        for (x=0; x<size1; x++) {
-            layer->matrix[i][x] = (float *)malloc(sizeof(float) * size1);
-            for (y=0; y<size1; y++) {
-                layer->matrix[i][x][y] = 0.0;
+    /* All the matrices in one block, the values of every speaker for a
+     * point are contiguous so the gains of a layer are read together. */
+    layer->stride = (num + align - 1) / align * align;
+    layer->matrix_bytes = sizeof(float) * size1 * size1 * layer->stride + LBAP_MATRIX_ALIGNMENT;
+    lbap_layer_alloc_matrix(layer, huge_pages);
+    layer->matrix = (float *)(((uintptr_t)layer->matrix_mem + LBAP_MATRIX_ALIGNMENT - 1) &
+                              ~(uintptr_t)(LBAP_MATRIX_ALIGNMENT - 1));
+
+    return layer;
+}
+
+/* Pre-compute the rows `first` to `last` (excluded) of the matrices of
+ * amplitude for the layer's speakers `spk_first` to `spk_last` (excluded).
+ * Rows are independent, they can be computed concurrently. */
+static void
+lbap_layer_compute_rows(lbap_layer *layer, int first, int last, int spk_first, int spk_last) {
+    int i, x, y, size = layer->size, hsize = size / 2, size1 = size + 1;
+    int stride = layer->stride;
+    float px, py, dx2, dy;
+    float dist[LBAP_MAX_MATRIX_SIZE];
+    float *row;
+
+    for (x=first; x<last; x++) {
+        row = layer->matrix + x * size1 * stride;
+        for (i=spk_first; i<spk_last; i++) {
+            px = layer->speakers[i].x * hsize + hsize;
+            py = layer->speakers[i].y * hsize + hsize;
+            dx2 = (x - px) * (x - px);
+            /* Contiguous loop over the row, written to the matrix after. */
+            for (y=0; y<size; y++) {
+                dy = y - py;
+                dist[y] = sqrtf(dx2 + dy * dy) / size;
+                dist[y] = dist[y] < 0.0f ? 0.0f : dist[y] > 1.0f ? 1.0f : dist[y];
             }
+            for (y=0; y<size; y++) {
+                row[y * stride + i] = 1 - dist[y];
+            }
+            row[size * stride + i] = row[i];
         }
     }
+}
 
-    return layer;
+/* Copy the first row of the layer's matrices to the last one, which wraps
+ * around. */
+static void
+lbap_layer_wrap_matrix(lbap_layer *layer) {
+    int size1 = layer->size + 1;
+    memcpy(layer->matrix + layer->size * size1 * layer->stride, layer->matrix,
+           sizeof(float) * size1 * layer->stride);
 }
 
-/* Pre-compute the matrices of amplitude for the layer's speakers. */
+/* Task computing a block of rows of a layer. */
 static void
-lbap_layer_compute_matrix(lbap_layer *layer) {
-    int i, x, y, hsize = LBAP_MATRIX_SIZE / 2;
-    float px, py, dist;
+lbap_field_matrix_task(void *arg, int index) {
+    lbap_field *field = (lbap_field *)arg;
+    int l, rows;
+    for (l=0; l<field->num_of_layers; l++) {
+        rows = field->layers[l]->size / LBAP_ROWS_PER_TASK;
+        if (index < rows) {
+            lbap_layer_compute_rows(field->layers[l], index * LBAP_ROWS_PER_TASK,
+                                    (index + 1) * LBAP_ROWS_PER_TASK,
+                                    0, field->layers[l]->num_of_speakers);
+            return;
+        }
+        index -= rows;
+    }
+}
 
-    for (i=0; i<layer->num_of_speakers; i++) {
-        px = layer->speakers[i].x * hsize + hsize;
-        py = layer->speakers[i].y * hsize + hsize;
-        for (x=0; x<LBAP_MATRIX_SIZE; x++) {
-            for (y=0; y<LBAP_MATRIX_SIZE; y++) {
-                dist = sqrtf(powf(x - px, 2) + powf(y - py, 2));
-                dist /= LBAP_MATRIX_SIZE;
-                dist = dist < 0.0f ? 0.0f : dist > 1.0f ? 1.0f : dist;
-                layer->matrix[i][x][y] = 1 - dist;
-            }
-            layer->matrix[i][x][LBAP_MATRIX_SIZE] = layer->matrix[i][x][0];
+/* Pre-compute the matrices of amplitude of all the field's layers, with
+ * the field's runner if there is one. */
+static void
+lbap_field_compute_matrices(lbap_field *field) {
+    int l, tasks = 0;
+
+    for (l=0; l<field->num_of_layers; l++) {
+        tasks += field->layers[l]->size / LBAP_ROWS_PER_TASK;
+    }
+    if (field->runner != NULL) {
+        field->runner(field->runner_context, lbap_field_matrix_task, field, tasks);
+    } else {
+        for (l=0; l<tasks; l++) {
+            lbap_field_matrix_task(field, l);
         }
-        layer->matrix[i][LBAP_MATRIX_SIZE] = layer->matrix[i][0];
+    }
+
+    for (l=0; l<field->num_of_layers; l++) {
+        lbap_layer_wrap_matrix(field->layers[l]);
     }
 }
 
@@ -182,9 +335,8 @@ lbap_layer_create(lbap_field *field, float ele, lbap_pos *speakers, int num) {
         field->layers = (lbap_layer **)realloc(field->layers,
                                                sizeof(lbap_layer *) * field->num_of_layers);
 
-    layer = lbap_layer_init(field->num_of_layers-1, ele, speakers, num);
-
-    lbap_layer_compute_matrix(layer);
+    layer = lbap_layer_init(field->num_of_layers-1, ele, speakers, num, field->resolution,
+                            field->huge_pages);
 
     field->layers[field->num_of_layers-1] = layer;
 }
@@ -192,15 +344,13 @@ lbap_layer_create(lbap_field *field, float ele, lbap_pos *speakers, int num) {
 /* Cleanup the memory used by a layer. */
 static void
 lbap_layer_free(lbap_layer *layer) {
-    int i, x;
-    if (layer->matrix) {
-        for (i=0; i<layer->num_of_speakers; i++) {
-            for (x=0; x<LBAP_MATRIX_SIZE; x++) {
-                free(layer->matrix[i][x]);
-            }
-            free(layer->matrix[i]);
-        }
-        free(layer->matrix);
+    if (layer->matrix_mem) {
+#ifdef __linux__
+        if (layer->matrix_mapped > 0)
+            munmap(layer->matrix_mem, layer->matrix_mapped);
+        else
+#endif
+        free(layer->matrix_mem);
     }
     if (layer->speakers) {
         free(layer->speakers);
@@ -208,24 +358,18 @@ lbap_layer_free(lbap_layer *layer) {
     free(layer);
 }
 
-/* Compute the gain of each layer's speakers, for the given position, and store 
- * the result in the `gains` array.
+/* Compute the gain of each layer's speakers, for the given position in
+ * matrix coordinates (`x`, `y`), and store the result in the `gains` array.
  */
 static void
-lbap_layer_compute_gains(lbap_layer *layer, float azi, float rad, float radspan, float *gains) {
-    int i, hsize = LBAP_MATRIX_SIZE / 2, sizeMinusOne = LBAP_MATRIX_SIZE - 1;
-    float x, y, norm, comp, sum = 0.0;
+lbap_layer_compute_gains(lbap_layer *layer, float x, float y, float rad, float radspan, float *gains) {
+    int i;
+    float norm, comp, sum = 0.0;
     float exponent = layer->expon * (1.0 - radspan) * 2.0;
-    lbap_pos pos;
-    pos.azi = azi;
-    pos.rad = rad;
-    lbap_poltocar(&pos);
-    x = pos.x * (hsize - 1) + hsize;
-    y = pos.y * (hsize - 1) + hsize;
-    x = x < 0 ? 0 : x > sizeMinusOne ? sizeMinusOne : x;
-    y = y < 0 ? 0 : y > sizeMinusOne ? sizeMinusOne : y;
+
+    layer->interp(layer, x, y, gains);
     for (i=0; i<layer->num_of_speakers; i++) {
-        gains[i] = powf(lbap_lookup(layer->matrix[i], x, y), exponent);
+        gains[i] = powf(gains[i], exponent);
         sum += gains[i];
     }
     if (sum > 0.0) {
@@ -237,6 +381,30 @@ lbap_layer_compute_gains(lbap_layer *layer, float azi, float rad, float radspan,
     }
 }
 
+/* Resolution of the field's layers, they all share the one of their setup. */
+static int
+lbap_field_layer_size(lbap_field *field) {
+    return field->num_of_layers > 0 ? field->layers[0]->size : field->resolution;
+}
+
+/* Gain of the layer `i` for a position between the layers `first` and `second`. */
+static float
+lbap_layer_weight(int i, int first, int second, float frac, float elespan) {
+    float gain;
+    if (i < first) {
+        gain = elespan / ((first - i) * 2);
+    } else if (i == first) {
+        gain = (1 - frac) + elespan;
+    } else if (i == second && first != second) {
+        gain = frac + elespan;
+    } else if (i == second && first == second) {
+        gain = elespan;
+    } else {
+        gain = elespan / ((i - second) * 2);
+    }
+    return gain > 1.0 ? 1.0 : gain;
+}
+
 /* =================================================================================
 ====================================================================================
 Layer-Based Amplitude Panning interface implementation.
@@ -250,6 +418,10 @@ lbap_field_init(void) {
     field->num_of_layers = 0;
     field->layers = NULL;
     field->out_order = NULL;
+    field->resolution = LBAP_MATRIX_SIZE;
+    field->runner = NULL;
+    field->runner_context = NULL;
+    field->huge_pages = 0;
     return field;
 }
 
@@ -313,57 +485,326 @@ lbap_field_setup(lbap_field *field, lbap_speaker *speakers, int num) {
         lbap_layer_create(field, mean, spk, howmany);
         free(spk);
     }
+
+    lbap_field_compute_matrices(field);
+}
+
+lbap_field *
+lbap_field_copy(lbap_field *field) {
+    int i, size1;
+    lbap_layer *layer, *src;
+    lbap_field *copy = lbap_field_init();
+
+    copy->runner = field->runner;
+    copy->runner_context = field->runner_context;
+    copy->huge_pages = field->huge_pages;
+    if (field->num_of_speakers > 0) {
+        copy->out_order = (int *)malloc(sizeof(int) * field->num_of_speakers);
+        memcpy(copy->out_order, field->out_order, sizeof(int) * field->num_of_speakers);
+    }
+    for (i=0; i<field->num_of_layers; i++) {
+        src = field->layers[i];
+        copy->resolution = src->size;
+        lbap_layer_create(copy, src->ele, src->speakers, src->num_of_speakers);
+        layer = copy->layers[i];
+        size1 = layer->size + 1;
+        memcpy(layer->matrix, src->matrix, sizeof(float) * size1 * size1 * layer->stride);
+    }
+    copy->resolution = field->resolution;
+
+    return copy;
+}
+
+int
+lbap_field_move_speaker(lbap_field *field, lbap_speaker *speaker) {
+    int i, j, c = 0;
+    lbap_layer *layer;
+
+    for (i=0; i<field->num_of_layers; i++) {
+        layer = field->layers[i];
+        for (j=0; j<layer->num_of_speakers; j++) {
+            if (field->out_order[c+j] != speaker->spkid) {
+                continue;
+            }
+            /* Another elevation changes the layers, and their order. */
+            if (layer->speakers[j].ele != speaker->ele) {
+                return -1;
+            }
+            if (layer->speakers[j].azi != speaker->azi || layer->speakers[j].rad != speaker->rad) {
+                layer->speakers[j].azi = speaker->azi;
+                layer->speakers[j].rad = speaker->rad;
+                lbap_poltocar(&layer->speakers[j]);
+                lbap_layer_compute_rows(layer, 0, layer->size, j, j + 1);
+                lbap_layer_wrap_matrix(layer);
+            }
+            return 0;
+        }
+        c += layer->num_of_speakers;
+    }
+    return -1;
 }
 
 void
 lbap_field_compute(lbap_field *field, lbap_pos *pos, float *gains) {
-    int i, j, c;
-    float frac = 0.0, gain = 0.0, elespan = 0.0;
-    float gns[LBAP_MAX_NUMBER_OF_SPEAKERS];
+    lbap_field_compute_batch(field, pos, &gains, 1);
+}
+
+void
+lbap_field_compute_batch(lbap_field *field, lbap_pos *pos, float **gains, int num) {
+    int i, j, n, s, c, count, hsize, sizeMinusOne;
+    int first[LBAP_BATCH_SIZE], second[LBAP_BATCH_SIZE];
+    float x[LBAP_BATCH_SIZE], y[LBAP_BATCH_SIZE], frac[LBAP_BATCH_SIZE], elespan[LBAP_BATCH_SIZE];
+    float gain, gns[LBAP_MAX_NUMBER_OF_SPEAKERS];
+    lbap_layer *layer;
 
     if (field->layers == NULL) {
         return;
     }
 
-    lbap_layer *first = field->layers[0];
-    lbap_layer *second = field->layers[field->num_of_layers-1];
-    for (i=0; i<field->num_of_layers; i++) {
-        if (field->layers[i]->ele > pos->ele) {
-            second = field->layers[i];
-            break;
+    /* The matrices may not have the resolution set since their setup. */
+    hsize = lbap_field_layer_size(field) / 2;
+    sizeMinusOne = lbap_field_layer_size(field) - 1;
+
+    for (n=0; n<num; n+=LBAP_BATCH_SIZE) {
+        count = (num - n) < LBAP_BATCH_SIZE ? (num - n) : LBAP_BATCH_SIZE;
+
+        /* Position of the sources in the layer matrices. */
+        for (s=0; s<count; s++) {
+            x[s] = pos[n+s].rad * cosf(pos[n+s].azi) * (hsize - 1) + hsize;
+            y[s] = pos[n+s].rad * sinf(pos[n+s].azi) * (hsize - 1) + hsize;
+            x[s] = x[s] < 0 ? 0 : x[s] > sizeMinusOne ? sizeMinusOne : x[s];
+            y[s] = y[s] < 0 ? 0 : y[s] > sizeMinusOne ? sizeMinusOne : y[s];
+        }
+
+        /* Layers surrounding the sources. */
+        for (s=0; s<count; s++) {
+            first[s] = 0;
+            second[s] = field->num_of_layers - 1;
+            for (i=0; i<field->num_of_layers; i++) {
+                if (field->layers[i]->ele > pos[n+s].ele) {
+                    second[s] = i;
+                    break;
+                }
+                first[s] = i;
+            }
+            frac[s] = 0.0;
+            if (first[s] != (field->num_of_layers-1))
+                frac[s] = (pos[n+s].ele - field->layers[first[s]]->ele) /
+                          (field->layers[second[s]]->ele - field->layers[first[s]]->ele);
+            elespan[s] = 0.0;
+            if (pos[n+s].elespan != 0.0)
+                elespan[s] = powf(pos[n+s].elespan, 4) * 6;
+        }
+
+        /* Each layer computes the gains of all the sources while its 
+         * matrices are in cache. */
+        c = 0;
+        for (i=0; i<field->num_of_layers; i++) {
+            layer = field->layers[i];
+            for (s=0; s<count; s++) {
+                gain = lbap_layer_weight(i, first[s], second[s], frac[s], elespan[s]);
+                lbap_layer_compute_gains(layer, x[s], y[s], pos[n+s].rad, pos[n+s].radspan, gns);
+                for (j=0; j<layer->num_of_speakers; j++) {
+                    gains[n+s][field->out_order[c+j]] = gns[j] * gain;
+                }
+            }
+            c += layer->num_of_speakers;
         }
-        first = field->layers[i];
     }
+}
+
+int
+lbap_field_set_resolution(lbap_field *field, int size) {
+    if (size != 32 && size != 64 && size != 128 && size != 256) {
+        return -1;
+    }
+    field->resolution = size;
+    return 0;
+}
+
+void
+lbap_field_set_runner(lbap_field *field, lbap_runner runner, void *context) {
+    field->runner = runner;
+    field->runner_context = context;
+}
+
+void
+lbap_field_set_huge_pages(lbap_field *field, int enable) {
+    field->huge_pages = enable;
+}
+
+int
+lbap_field_get_resolution(lbap_field *field) {
+    return field->resolution;
+}
+
+void
+lbap_field_get_report(lbap_field *field, lbap_field_report *report) {
+    int i, n, runs = 0;
+    struct timespec start, now, cpu_start, cpu_end;
+    double elapsed;
+    lbap_pos pos[LBAP_BATCH_SIZE];
+    float gns[LBAP_BATCH_SIZE][LBAP_MAX_NUMBER_OF_SPEAKERS];
+    float *gains[LBAP_BATCH_SIZE];
+
+    report->resolution = lbap_field_layer_size(field);
+    report->num_of_layers = field->num_of_layers;
+    report->num_of_speakers = field->num_of_speakers;
+    report->bytes = 0;
+    report->largest_layer_bytes = 0;
+    report->huge_page_layers = 0;
+    report->transparent_huge_page_layers = 0;
+    report->lookup_usec = 0.0;
+
+    if (field->layers == NULL) {
+        return;
+    }
+
+    for (i=0; i<field->num_of_layers; i++) {
+        report->bytes += field->layers[i]->matrix_bytes;
+        if (field->layers[i]->matrix_bytes > report->largest_layer_bytes)
+            report->largest_layer_bytes = field->layers[i]->matrix_bytes;
+        if (field->layers[i]->matrix_pages == LBAP_PAGES_HUGE)
+            report->huge_page_layers++;
+        else if (field->layers[i]->matrix_pages == LBAP_PAGES_TRANSPARENT)
+            report->transparent_huge_page_layers++;
+    }
+
+    /* Positions spread over the whole field, the timing runs for at
+     * least 20 ms of wall time and counts the CPU time of this thread only. */
+    for (n=0; n<LBAP_BATCH_SIZE; n++) {
+        lbap_pos_init_from_radians(&pos[n], n * 2.39996323f,
+                                   (n % 8) * M_PI / 16.0, (n % 16) / 10.0f);
+        gains[n] = gns[n];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    do {
+        lbap_field_compute_batch(field, pos, gains, LBAP_BATCH_SIZE);
+        runs++;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+    } while (elapsed < 0.02);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    elapsed = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) * 1e-9;
+    report->lookup_usec = elapsed * 1e6 / (runs * LBAP_BATCH_SIZE);
+}
+
+/* Sequential access to a serialized field. Writes are only counted when
+ * there is no buffer, reads past the end of the buffer set `error`. */
+typedef struct {
+    unsigned char *buf;
+    size_t size;
+    size_t pos;
+    int error;
+} lbap_stream;
+
+static void
+lbap_stream_put(lbap_stream *s, const void *src, size_t bytes) {
+    if (s->buf != NULL)
+        memcpy(s->buf + s->pos, src, bytes);
+    s->pos += bytes;
+}
 
-    if (first->id != (field->num_of_layers-1))
-        frac = (pos->ele - first->ele) / (second->ele - first->ele);
+static int
+lbap_stream_get(lbap_stream *s, void *dst, size_t bytes) {
+    if (s->error || bytes > s->size - s->pos) {
+        s->error = 1;
+        return 0;
+    }
+    memcpy(dst, s->buf + s->pos, bytes);
+    s->pos += bytes;
+    return 1;
+}
 
-    if (pos->elespan != 0.0)
-        elespan = powf(pos->elespan, 4) * 6;
+static int
+lbap_stream_get_int(lbap_stream *s, int min, int max) {
+    int value = min;
+    if (lbap_stream_get(s, &value, sizeof(int)) && (value < min || value > max))
+        s->error = 1;
+    return value;
+}
 
-    c = 0;
+size_t
+lbap_field_serialize(lbap_field *field, void *buffer, size_t size) {
+    int i, j, size1, resolution;
+    lbap_layer *layer;
+    lbap_stream s;
+
+    if (buffer != NULL && size < lbap_field_serialize(field, NULL, 0))
+        buffer = NULL;
+    s.buf = (unsigned char *)buffer;
+    s.size = size;
+    s.pos = 0;
+    s.error = 0;
+
+    resolution = lbap_field_layer_size(field);
+    lbap_stream_put(&s, &resolution, sizeof(int));
+    lbap_stream_put(&s, &field->num_of_speakers, sizeof(int));
+    lbap_stream_put(&s, &field->num_of_layers, sizeof(int));
+    lbap_stream_put(&s, field->out_order, sizeof(int) * field->num_of_speakers);
     for (i=0; i<field->num_of_layers; i++) {
-        if (i < first->id) {
-            gain = elespan / ((first->id - i) * 2);
-        } else if (i == first->id) {
-            gain = (1 - frac) + elespan;
-        } else if (i == second->id && first->id != second->id) {
-            gain = frac + elespan;
-        } else if (i == second->id && first->id == second->id) {
-            gain = elespan;
-        } else {
-            gain = elespan / ((i - second->id) * 2);
+        layer = field->layers[i];
+        size1 = layer->size + 1;
+        lbap_stream_put(&s, &layer->num_of_speakers, sizeof(int));
+        lbap_stream_put(&s, &layer->ele, sizeof(float));
+        for (j=0; j<layer->num_of_speakers; j++) {
+            lbap_stream_put(&s, &layer->speakers[j].azi, sizeof(float));
+            lbap_stream_put(&s, &layer->speakers[j].ele, sizeof(float));
+            lbap_stream_put(&s, &layer->speakers[j].rad, sizeof(float));
+        }
+        lbap_stream_put(&s, layer->matrix, sizeof(float) * size1 * size1 * layer->stride);
+    }
+
+    return s.pos;
+}
+
+int
+lbap_field_deserialize(lbap_field *field, const void *buffer, size_t size) {
+    int i, j, num, size1, resolution, num_of_speakers, num_of_layers;
+    float ele;
+    lbap_pos speakers[LBAP_MAX_NUMBER_OF_SPEAKERS];
+    lbap_layer *layer;
+    lbap_stream s = { (unsigned char *)buffer, size, 0, 0 };
+
+    lbap_field_reset(field);
+
+    resolution = lbap_stream_get_int(&s, 32, LBAP_MAX_MATRIX_SIZE);
+    num_of_speakers = lbap_stream_get_int(&s, 1, LBAP_MAX_NUMBER_OF_SPEAKERS);
+    num_of_layers = lbap_stream_get_int(&s, 1, LBAP_MAX_NUMBER_OF_SPEAKERS);
+    if (s.error || lbap_field_set_resolution(field, resolution) != 0) {
+        return -1;
+    }
+
+    field->out_order = (int *)malloc(sizeof(int) * num_of_speakers);
+    for (i=0; i<num_of_speakers && !s.error; i++) {
+        field->out_order[i] = lbap_stream_get_int(&s, 0, LBAP_MAX_NUMBER_OF_SPEAKERS - 1);
+    }
+
+    /* Layers are created as lbap_field_setup does, then their matrices
+     * are read instead of computed. */
+    for (i=0; i<num_of_layers && !s.error; i++) {
+        num = lbap_stream_get_int(&s, 1, num_of_speakers - field->num_of_speakers);
+        lbap_stream_get(&s, &ele, sizeof(float));
+        for (j=0; j<num && !s.error; j++) {
+            lbap_stream_get(&s, &speakers[j].azi, sizeof(float));
+            lbap_stream_get(&s, &speakers[j].ele, sizeof(float));
+            lbap_stream_get(&s, &speakers[j].rad, sizeof(float));
         }
-        gain = gain > 1.0 ? 1.0 : gain;
-        lbap_layer_compute_gains(field->layers[i], pos->azi, pos->rad, pos->radspan, &gns[c]);
-        for (j=0; j<field->layers[i]->num_of_speakers; j++) {
-            gns[c++] *= gain;
+        if (s.error) {
+            break;
         }
+        lbap_layer_create(field, ele, speakers, num);
+        layer = field->layers[field->num_of_layers-1];
+        size1 = layer->size + 1;
+        lbap_stream_get(&s, layer->matrix, sizeof(float) * size1 * size1 * layer->stride);
     }
 
-    for (i=0; i<field->num_of_speakers; i++) {
-        gains[field->out_order[i]] = gns[i];
+    if (s.error || s.pos != size || field->num_of_speakers != num_of_speakers) {
+        lbap_field_reset(field);
+        return -1;
     }
+    return 0;
 }
 
 lbap_speaker *
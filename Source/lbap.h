@@ -26,12 +26,14 @@
 #ifndef __LBAP_H
 #define __LBAP_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus 
 extern "C" {
 #endif
 
 #define LBAP_MAX_NUMBER_OF_SPEAKERS 256
-#define LBAP_MATRIX_SIZE 64
+#define LBAP_MATRIX_SIZE 64     /* Default resolution of the fields. */
 
 /* Opaque data types. */
 typedef struct lbap_layer lbap_layer;
@@ -81,6 +83,34 @@ typedef struct {
     float elespan;
 } lbap_pos;
 
+/** \brief A function called by a runner for each of its tasks.
+ */
+typedef void (*lbap_task)(void *arg, int index);
+
+/** \brief A function running tasks, possibly in parallel.
+ *
+ * The runner must call `task(arg, index)` once for every `index` from 0 to
+ * `count - 1`, in any order and from any thread, and return when all the 
+ * calls are done. `context` is the pointer given to `lbap_field_set_runner`.
+ */
+typedef void (*lbap_runner)(void *context, lbap_task task, void *arg, int count);
+
+/** \brief A structure reporting the cost of a field.
+ *
+ * This structure is filled by `lbap_field_get_report` to help choosing a
+ * resolution whose matrices fit in the processor's cache.
+ */
+typedef struct {
+    int resolution;             /**< Resolution of the layer matrices. */
+    int num_of_layers;          /**< Number of layers into the field. */
+    int num_of_speakers;        /**< Total number of speakers in the field. */
+    size_t bytes;               /**< Memory used by the matrices of all layers. */
+    size_t largest_layer_bytes; /**< Memory used by the largest layer. */
+    int huge_page_layers;       /**< Layers whose matrices are on reserved huge pages. */
+    int transparent_huge_page_layers; /**< Layers advised to use transparent huge pages. */
+    double lookup_usec;         /**< Time to compute a source's gains, in microseconds. */
+} lbap_field_report;
+
 /** \brief Initializes a new spatialization field.
  *
  * This function creates and initializes a new spatialization field.
@@ -113,6 +143,30 @@ void lbap_field_reset(lbap_field *field);
  */
 void lbap_field_setup(lbap_field *field, lbap_speaker *speakers, int num);
 
+/** \brief Returns a copy of a field.
+ *
+ * This function creates a new field with the layers, matrices, resolution
+ * and runner of `field`. It can be modified, then used in place of the 
+ * original one.
+ *
+ * It's the reponsibility of the user to call `lbap_field_free(field)`
+ * when done with it.
+ */
+lbap_field * lbap_field_copy(lbap_field *field);
+
+/** \brief Moves a speaker of the field.
+ *
+ * This function gives a new azimuth and radius to the speaker of the field
+ * whose `spkid` is the one of `speaker`, and computes again the matrices
+ * of this speaker only. The result is the same as setting up the field
+ * again with the new position.
+ *
+ * \return 0 on success, -1 if the speaker is not in the field or if its
+ * elevation changed. The layers depend on the elevations, the field must 
+ * then be set up again with `lbap_field_setup`.
+ */
+int lbap_field_move_speaker(lbap_field *field, lbap_speaker *speaker);
+
 /** \brief Calculates the gain of the outputs for a source's position.
  *
  * This function uses the position `pos` to retrieve the gain for every 
@@ -123,6 +177,82 @@ void lbap_field_setup(lbap_field *field, lbap_speaker *speakers, int num);
  */
 void lbap_field_compute(lbap_field *field, lbap_pos *pos, float *gains);
 
+/** \brief Calculates the gain of the outputs for several sources' positions.
+ *
+ * This function does the same as `lbap_field_compute` for the `num` 
+ * positions of the array `pos`. The gains of the position `i` are written
+ * in the array `gains[i]`. Computing all the sources that moved in one 
+ * call is faster, every layer processes the sources while its matrices 
+ * are in cache.
+ */
+void lbap_field_compute_batch(lbap_field *field, lbap_pos *pos, float **gains, int num);
+
+/** \brief Sets the resolution of the field's layer matrices.
+ *
+ * The gain matrices are `size` x `size` points, `size` being one of 32, 64,
+ * 128 or 256 (`LBAP_MATRIX_SIZE` by default). Lower resolutions use less
+ * memory, higher ones give smoother gains. The new resolution is used by 
+ * the next call to `lbap_field_setup`, the current layers keep theirs and
+ * can still be computed meanwhile.
+ *
+ * \return 0 on success, -1 if the resolution is not supported.
+ */
+int lbap_field_set_resolution(lbap_field *field, int size);
+
+/** \brief Sets the function used to compute the field's matrices.
+ *
+ * `lbap_field_setup` splits the computation of the layer matrices in 
+ * independent tasks and gives them to `runner`, which can run them on a 
+ * thread pool. Without a runner (NULL, the default), the tasks are run
+ * one after the other.
+ */
+void lbap_field_set_runner(lbap_field *field, lbap_runner runner, void *context);
+
+/** \brief Maps the field's matrices on huge pages.
+ *
+ * With `enable` non-zero, the layers created afterwards get their matrices
+ * on reserved huge pages (hugetlbfs) or, if there are none, on memory
+ * advised to use transparent huge pages. Other platforms than Linux, or a
+ * failed mapping, use regular memory. Disabled by default.
+ */
+void lbap_field_set_huge_pages(lbap_field *field, int enable);
+
+/** \brief Returns the resolution set for the next `lbap_field_setup`.
+ */
+int lbap_field_get_resolution(lbap_field *field);
+
+/** \brief Reports the memory footprint and lookup time of a field.
+ *
+ * This function fills `report` with the memory used by the field's
+ * matrices and the average time needed to compute the gains of a source,
+ * measured by running lookups for a few milliseconds. It must not be
+ * called from the audio thread.
+ */
+void lbap_field_get_report(lbap_field *field, lbap_field_report *report);
+
+
+/** \brief Writes the layers of a field, with their matrices, in a buffer.
+ *
+ * This function serializes the state of a field set up by 
+ * `lbap_field_setup` so it can be restored later, for instance from a 
+ * file, without computing the matrices again. The data is in the byte 
+ * order of the machine.
+ *
+ * \return The number of bytes needed. Nothing is written if `buffer` is
+ * NULL or smaller than that.
+ */
+size_t lbap_field_serialize(lbap_field *field, void *buffer, size_t size);
+
+/** \brief Restores the layers of a field from a buffer.
+ *
+ * This function replaces the layers of `field` by the ones serialized in
+ * `buffer` by `lbap_field_serialize`. The resolution of the field is set
+ * to the one of the serialized layers.
+ *
+ * \return 0 on success, -1 if the buffer does not hold a valid field (the
+ * field is then reset).
+ */
+int lbap_field_deserialize(lbap_field *field, const void *buffer, size_t size);
 
 /** \brief Computes an array of lbap_speaker from lists of angular positions.
  *
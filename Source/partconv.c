@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "partconv.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PARTCONV_USE_SSE 1
+#endif
+
+#ifndef M_PI
+#define M_PI    (3.14159265358979323846264338327950288)
+#endif
+
+/* Spectra are padded to a multiple of this number of bins. */
+#define PARTCONV_BIN_ALIGNMENT 4
+
+/* =================================================================================
+Opaque data type declaration.
+================================================================================= */
+
+/* Spectra hold the bins 0 .. block_size (the others are their conjugates),
+ * as separate arrays of real and imaginary parts. */
+struct partconv {
+    int num_inputs;         /**< Number of input channels. */
+    int num_outputs;        /**< Number of output channels. */
+    int block_size;         /**< Frames per block, also the partition size. */
+    int fft_size;           /**< Twice the block size. */
+    int stride;             /**< Values per spectrum (bins, padded). */
+    int num_partitions;     /**< Partitions of the impulse responses. */
+    int fdl_pos;            /**< Slot of the newest input spectra. */
+    int *bitrev;            /**< Bit reversal permutation of the FFT. */
+    float *cos_table;       /**< Twiddle factors (fft_size / 2). */
+    float *sin_table;
+    float *history;         /**< Last two blocks of each input [in][fft_size]. */
+    float *fdl_re;          /**< Past input spectra [in][partition][stride]. */
+    float *fdl_im;
+    float *ir_re;           /**< Impulse spectra [in][out][partition][stride]. */
+    float *ir_im;
+    float *acc_re;          /**< Output spectra [out][stride]. */
+    float *acc_im;
+    float *work_re;         /**< FFT buffer (fft_size). */
+    float *work_im;
+};
+
+/* =================================================================================
+Utility functions.
+================================================================================= */
+
+/* In-place radix-2 complex FFT of `fft_size` points. The inverse transform
+ * is not scaled. */
+static void
+partconv_fft(partconv *conv, float *re, float *im, int inverse) {
+    int i, j, k, len, half, step, n = conv->fft_size;
+    float wr, wi, tr, ti;
+
+    for (i=0; i<n; i++) {
+        j = conv->bitrev[i];
+        if (j > i) {
+            tr = re[i]; re[i] = re[j]; re[j] = tr;
+            ti = im[i]; im[i] = im[j]; im[j] = ti;
+        }
+    }
+    for (len=2; len<=n; len<<=1) {
+        half = len >> 1;
+        step = n / len;
+        for (i=0; i<n; i+=len) {
+            for (k=0; k<half; k++) {
+                wr = conv->cos_table[k * step];
+                wi = inverse ? conv->sin_table[k * step] : -conv->sin_table[k * step];
+                j = i + k + half;
+                tr = re[j] * wr - im[j] * wi;
+                ti = re[j] * wi + im[j] * wr;
+                re[j] = re[i+k] - tr;
+                im[j] = im[i+k] - ti;
+                re[i+k] += tr;
+                im[i+k] += ti;
+            }
+        }
+    }
+}
+
+/* Complex multiply-accumulate of `n` bins: y += x * h. */
+static void
+partconv_cmac(float *yr, float *yi, const float *xr, const float *xi,
+              const float *hr, const float *hi, int n) {
+    int k = 0;
+#ifdef PARTCONV_USE_SSE
+    __m128 a, b, c, d;
+    for (; k+4<=n; k+=4) {
+        a = _mm_loadu_ps(xr + k);
+        b = _mm_loadu_ps(xi + k);
+        c = _mm_loadu_ps(hr + k);
+        d = _mm_loadu_ps(hi + k);
+        _mm_storeu_ps(yr + k, _mm_add_ps(_mm_loadu_ps(yr + k),
+                                         _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d))));
+        _mm_storeu_ps(yi + k, _mm_add_ps(_mm_loadu_ps(yi + k),
+                                         _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c))));
+    }
+#endif
+    for (; k<n; k++) {
+        yr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+        yi[k] += xr[k] * hi[k] + xi[k] * hr[k];
+    }
+}
+
+/* =================================================================================
+====================================================================================
+Partitioned convolution interface implementation.
+====================================================================================
+================================================================================= */
+
+partconv *
+partconv_init(int num_inputs, int num_outputs, int block_size, int ir_length) {
+    int i, j, bits, n;
+    partconv *conv;
+
+    if (block_size < 1 || (block_size & (block_size - 1)) != 0 ||
+        num_inputs < 1 || num_outputs < 1 || ir_length < 1) {
+        return NULL;
+    }
+
+    conv = (partconv *)malloc(sizeof(partconv));
+    conv->num_inputs = num_inputs;
+    conv->num_outputs = num_outputs;
+    conv->block_size = block_size;
+    conv->fft_size = n = block_size * 2;
+    conv->stride = (block_size + PARTCONV_BIN_ALIGNMENT) / PARTCONV_BIN_ALIGNMENT * PARTCONV_BIN_ALIGNMENT;
+    conv->num_partitions = (ir_length + block_size - 1) / block_size;
+    conv->fdl_pos = 0;
+
+    conv->bitrev = (int *)malloc(sizeof(int) * n);
+    for (bits=0; (1 << bits) < n; bits++);
+    for (i=0; i<n; i++) {
+        conv->bitrev[i] = 0;
+        for (j=0; j<bits; j++) {
+            if (i & (1 << j))
+                conv->bitrev[i] |= 1 << (bits - 1 - j);
+        }
+    }
+    conv->cos_table = (float *)malloc(sizeof(float) * n / 2);
+    conv->sin_table = (float *)malloc(sizeof(float) * n / 2);
+    for (i=0; i<n/2; i++) {
+        conv->cos_table[i] = (float)cos(2.0 * M_PI * i / n);
+        conv->sin_table[i] = (float)sin(2.0 * M_PI * i / n);
+    }
+
+    conv->history = (float *)calloc(num_inputs * n, sizeof(float));
+    conv->fdl_re = (float *)calloc(num_inputs * conv->num_partitions * conv->stride, sizeof(float));
+    conv->fdl_im = (float *)calloc(num_inputs * conv->num_partitions * conv->stride, sizeof(float));
+    conv->ir_re = (float *)calloc(num_inputs * num_outputs * conv->num_partitions * conv->stride, sizeof(float));
+    conv->ir_im = (float *)calloc(num_inputs * num_outputs * conv->num_partitions * conv->stride, sizeof(float));
+    conv->acc_re = (float *)calloc(num_outputs * conv->stride, sizeof(float));
+    conv->acc_im = (float *)calloc(num_outputs * conv->stride, sizeof(float));
+    conv->work_re = (float *)calloc(n, sizeof(float));
+    conv->work_im = (float *)calloc(n, sizeof(float));
+
+    return conv;
+}
+
+void
+partconv_free(partconv *conv) {
+    free(conv->bitrev);
+    free(conv->cos_table);
+    free(conv->sin_table);
+    free(conv->history);
+    free(conv->fdl_re);
+    free(conv->fdl_im);
+    free(conv->ir_re);
+    free(conv->ir_im);
+    free(conv->acc_re);
+    free(conv->acc_im);
+    free(conv->work_re);
+    free(conv->work_im);
+    free(conv);
+}
+
+void
+partconv_set_impulse(partconv *conv, int input, int output, const float *ir, int length) {
+    int p, k, first, count, bs = conv->block_size, n = conv->fft_size;
+    float scale = 1.0f / n;     /* Scaling of the inverse FFT, applied once here. */
+    float *hr, *hi;
+
+    for (p=0; p<conv->num_partitions; p++) {
+        first = p * bs;
+        count = length - first;
+        count = count < 0 ? 0 : count > bs ? bs : count;
+        memset(conv->work_re, 0, sizeof(float) * n);
+        memset(conv->work_im, 0, sizeof(float) * n);
+        for (k=0; k<count; k++) {
+            conv->work_re[k] = ir[first + k] * scale;
+        }
+        partconv_fft(conv, conv->work_re, conv->work_im, 0);
+
+        hr = conv->ir_re + ((input * conv->num_outputs + output) * conv->num_partitions + p) * conv->stride;
+        hi = conv->ir_im + ((input * conv->num_outputs + output) * conv->num_partitions + p) * conv->stride;
+        memcpy(hr, conv->work_re, sizeof(float) * (bs + 1));
+        memcpy(hi, conv->work_im, sizeof(float) * (bs + 1));
+    }
+}
+
+void
+partconv_reset(partconv *conv) {
+    memset(conv->history, 0, sizeof(float) * conv->num_inputs * conv->fft_size);
+    memset(conv->fdl_re, 0, sizeof(float) * conv->num_inputs * conv->num_partitions * conv->stride);
+    memset(conv->fdl_im, 0, sizeof(float) * conv->num_inputs * conv->num_partitions * conv->stride);
+    conv->fdl_pos = 0;
+}
+
+int
+partconv_get_block_size(partconv *conv) {
+    return conv->block_size;
+}
+
+int
+partconv_get_num_partitions(partconv *conv) {
+    return conv->num_partitions;
+}
+
+void
+partconv_process(partconv *conv, float **ins, float **outs) {
+    int i, o, p, k, j, slot, bs = conv->block_size, n = conv->fft_size, stride = conv->stride;
+    int parts = conv->num_partitions;
+    float *hist, *xr, *xi, *yr, *yi, *re = conv->work_re, *im = conv->work_im;
+    float ar, ai, cr, ci;
+
+    conv->fdl_pos = (conv->fdl_pos + 1) % parts;
+
+    /* Spectra of the last two blocks of the inputs. Two real inputs are
+     * transformed with one complex FFT, then separated. */
+    for (i=0; i<conv->num_inputs; i+=2) {
+        hist = conv->history + i * n;
+        memmove(hist, hist + bs, sizeof(float) * bs);
+        memcpy(hist + bs, ins[i], sizeof(float) * bs);
+        memcpy(re, hist, sizeof(float) * n);
+        if (i + 1 < conv->num_inputs) {
+            hist += n;
+            memmove(hist, hist + bs, sizeof(float) * bs);
+            memcpy(hist + bs, ins[i+1], sizeof(float) * bs);
+            memcpy(im, hist, sizeof(float) * n);
+        } else {
+            memset(im, 0, sizeof(float) * n);
+        }
+        partconv_fft(conv, re, im, 0);
+
+        xr = conv->fdl_re + (i * parts + conv->fdl_pos) * stride;
+        xi = conv->fdl_im + (i * parts + conv->fdl_pos) * stride;
+        for (k=0; k<=bs; k++) {
+            j = (n - k) & (n - 1);
+            ar = re[k]; ai = im[k];
+            cr = re[j]; ci = im[j];
+            xr[k] = 0.5f * (ar + cr);
+            xi[k] = 0.5f * (ai - ci);
+            if (i + 1 < conv->num_inputs) {
+                xr[k + parts * stride] = 0.5f * (ai + ci);
+                xi[k + parts * stride] = 0.5f * (cr - ar);
+            }
+        }
+    }
+
+    /* Every partition of the impulses filters the input spectra of as
+     * many blocks ago. */
+    memset(conv->acc_re, 0, sizeof(float) * conv->num_outputs * stride);
+    memset(conv->acc_im, 0, sizeof(float) * conv->num_outputs * stride);
+    for (o=0; o<conv->num_outputs; o++) {
+        yr = conv->acc_re + o * stride;
+        yi = conv->acc_im + o * stride;
+        for (i=0; i<conv->num_inputs; i++) {
+            for (p=0; p<parts; p++) {
+                slot = (conv->fdl_pos - p + parts) % parts;
+                partconv_cmac(yr, yi,
+                              conv->fdl_re + (i * parts + slot) * stride,
+                              conv->fdl_im + (i * parts + slot) * stride,
+                              conv->ir_re + ((i * conv->num_outputs + o) * parts + p) * stride,
+                              conv->ir_im + ((i * conv->num_outputs + o) * parts + p) * stride,
+                              stride);
+            }
+        }
+    }
+
+    /* Two real outputs are the real and imaginary parts of one inverse
+     * FFT. The second half of the result is the new block. */
+    for (o=0; o<conv->num_outputs; o+=2) {
+        xr = conv->acc_re + o * stride;
+        xi = conv->acc_im + o * stride;
+        yr = o + 1 < conv->num_outputs ? xr + stride : NULL;
+        yi = o + 1 < conv->num_outputs ? xi + stride : NULL;
+        for (k=0; k<=bs; k++) {
+            re[k] = xr[k] - (yi ? yi[k] : 0.0f);
+            im[k] = xi[k] + (yr ? yr[k] : 0.0f);
+        }
+        for (k=bs+1; k<n; k++) {
+            j = n - k;
+            re[k] = xr[j] + (yi ? yi[j] : 0.0f);
+            im[k] = (yr ? yr[j] : 0.0f) - xi[j];
+        }
+        partconv_fft(conv, re, im, 1);
+        memcpy(outs[o], re + bs, sizeof(float) * bs);
+        if (o + 1 < conv->num_outputs) {
+            memcpy(outs[o+1], im + bs, sizeof(float) * bs);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/** \file partconv.h
+ *  \brief Uniformly partitioned convolution.
+ *
+ * A bank of FIR filters computed in the frequency domain with the
+ * overlap-save method. Every input is filtered by one impulse response
+ * per output and the results are summed on the outputs. The impulse 
+ * responses are split in partitions of the block size, so the 
+ * convolution adds no latency when blocks of `block_size` frames are
+ * processed.
+ */
+
+#ifndef __PARTCONV_H
+#define __PARTCONV_H
+
+#ifdef __cplusplus 
+extern "C" {
+#endif
+
+/* Opaque data type. */
+typedef struct partconv partconv;
+
+/** \brief Initializes a new convolver.
+ *
+ * This function creates a convolver for `num_inputs` inputs and
+ * `num_outputs` outputs, with impulse responses of up to `ir_length`
+ * samples, processing blocks of `block_size` frames. `block_size` must
+ * be a power of two.
+ *
+ * It's the reponsibility of the user to call `partconv_free(conv)`
+ * when done with it.
+ *
+ * \return partconv pointer, or NULL if the block size is not supported.
+ */
+partconv * partconv_init(int num_inputs, int num_outputs, int block_size, int ir_length);
+
+/** \brief Frees memory used by a convolver.
+ */
+void partconv_free(partconv *conv);
+
+/** \brief Sets the impulse response from an input to an output.
+ *
+ * This function computes the spectrum of every partition of the 
+ * `length` samples of `ir` (up to the `ir_length` of the convolver).
+ * It must not be called while a block is processed.
+ */
+void partconv_set_impulse(partconv *conv, int input, int output, const float *ir, int length);
+
+/** \brief Clears the memory of past input blocks.
+ */
+void partconv_reset(partconv *conv);
+
+/** \brief Returns the number of frames processed by `partconv_process`.
+ */
+int partconv_get_block_size(partconv *conv);
+
+/** \brief Returns the number of partitions of the impulse responses.
+ */
+int partconv_get_num_partitions(partconv *conv);
+
+/** \brief Processes one block.
+ *
+ * This function filters `block_size` frames of each of the arrays of 
+ * `ins` and writes the sums in the arrays of `outs`, replacing their 
+ * content.
+ */
+void partconv_process(partconv *conv, float **ins, float **outs);
+
+#ifdef __cplusplus 
+}
+#endif
+
+#endif /* __PARTCONV_H */
@@ -25,9 +25,40 @@ typedef struct ls_triplet_chain {
     struct ls_triplet_chain *next;  /* Next triplet */
 } ls_triplet_chain;
 
+/* Gains of a loudspeaker set for a given direction. */
+typedef struct {
+    float set_gains[3];
+    float smallest_wt;
+    int neg_g_am;
+} SET_GAINS;
+
+/* Directions of a spread source, panned as one batch. The directions are
+ * stored as arrays of coordinates so every lane goes through the same
+ * computations. The first lane is the source direction itself. */
+#define SPREAD_BATCH_SIZE (VBAP_MAX_SPREAD_DIRS * 2 + 1)
+
+/* Number of sources converted together by vbap_compute_batch. */
+#define VBAP_BATCH_SIZE 64
+typedef struct {
+    int count;
+    float azi[SPREAD_BATCH_SIZE];
+    float ele[SPREAD_BATCH_SIZE];
+    float x[SPREAD_BATCH_SIZE];
+    float y[SPREAD_BATCH_SIZE];
+    float z[SPREAD_BATCH_SIZE];
+    float wt[SPREAD_BATCH_SIZE];    /* Weight of the direction gains. */
+} SPREAD_BATCH;
+
+/* Loudspeakers given a gain by a spread batch. */
+typedef struct {
+    int count;
+    int ls[MAX_LS_AMOUNT];
+    unsigned char mark[MAX_LS_AMOUNT];
+} SPARSE_GAINS;
+
 /* Fast-forward declarations. */
-void compute_gains(int ls_set_am, LS_SET *sets, float *gains,
-                   int ls_amount, CART_VEC cart_dir, int dim);
+void compute_gains(VBAP_LAYOUT *layout, float *gains, CART_VEC cart_dir);
+static int select_set(VBAP_LAYOUT *layout, float vec[3], float gains[3]);
 
 /* Returns 1 if there is loudspeaker(s) inside given ls triplet. */
 static int any_ls_inside_triplet(int a, int b, int c, 
@@ -185,10 +216,9 @@ static int vec_angles_are_on_same_ele(ANG_VEC v1, ANG_VEC v2) {
 }
 
 /* Calculate volume of the parallelepiped defined by the loudspeaker
- * direction vectors and divide it with total length of the triangle sides. 
- * This is used when removing too narrow triangles. */
-static float vol_p_side_lgth(int i, int j, int k, ls lss[MAX_LS_AMOUNT]) {
-    int same_ele;
+ * direction vectors and divide it with total length of the triangle
+ * sides, without any elevation constraint. */
+static float vol_p_side_lgth_raw(int i, int j, int k, ls lss[MAX_LS_AMOUNT]) {
     float volper, lgth;
     CART_VEC xprod;
     cross_prod(lss[i].coords, lss[j].coords, &xprod);
@@ -196,13 +226,24 @@ static float vol_p_side_lgth(int i, int j, int k, ls lss[MAX_LS_AMOUNT]) {
     lgth = (fabsf(vec_angle(lss[i].coords, lss[j].coords)) +
             fabsf(vec_angle(lss[i].coords, lss[k].coords)) +
             fabsf(vec_angle(lss[j].coords, lss[k].coords)));
+    if (lgth > 0.00001)
+        return volper / lgth;
+    else
+        return 0.0;
+}
+
+/* Calculate volume of the parallelepiped defined by the loudspeaker
+ * direction vectors and divide it with total length of the triangle sides.
+ * This is used when removing too narrow triangles. */
+static float vol_p_side_lgth(int i, int j, int k, ls lss[MAX_LS_AMOUNT]) {
+    int same_ele;
     /* At least, two speakers should be on the same elevation plane.
        This fix wrong triplet in the Dome32Sub2UdeM template. */
     same_ele = vec_angles_are_on_same_ele(lss[i].angles, lss[j].angles) +
                vec_angles_are_on_same_ele(lss[i].angles, lss[k].angles) +
                vec_angles_are_on_same_ele(lss[j].angles, lss[k].angles);
-    if (lgth > 0.00001 && same_ele > 0)
-        return volper / lgth;
+    if (same_ele > 0)
+        return vol_p_side_lgth_raw(i, j, k, lss);
     else
         return 0.0;
 }
@@ -298,6 +339,75 @@ static void new_spread_base(CART_VEC spreaddir, CART_VEC vscartdir,
   	spread_base->z /= power;
 }
 
+/* Accumulates the gains of every direction of a batch. Only the
+ * loudspeakers of the selected sets are given a gain, they are listed in
+ * `touched` so the batch can be normalized without visiting the whole
+ * layout. `gains` must be cleared by the caller. */
+static void spread_batch_pan(VBAP_LAYOUT *layout, SPREAD_BATCH *batch,
+                             float *gains, SPARSE_GAINS *touched) {
+    int i, j, n, ind, dim = layout->dimension;
+    float vec[3], g[3];
+
+    touched->count = 0;
+    memset(touched->mark, 0, layout->ls_am);
+
+    for (n=0; n<batch->count; n++) {
+        vec[0] = batch->x[n];
+        vec[1] = batch->y[n];
+        vec[2] = batch->z[n];
+        j = select_set(layout, vec, g);
+        for (i=0; i<dim; i++) {
+            ind = layout->ls_sets[j].ls_nos[i] - 1;
+            gains[ind] += g[i] * batch->wt[n];
+            if (!touched->mark[ind]) {
+                touched->mark[ind] = 1;
+                touched->ls[touched->count++] = ind;
+            }
+        }
+    }
+}
+
+/* Converts the angles of the batch directions, from `first`, to
+ * cartesian coordinates. */
+static void spread_batch_to_cart(SPREAD_BATCH *batch, int first,
+                                 int flip_y_z) {
+    int n;
+    float cele, *y, *z;
+
+    if (flip_y_z) {
+        y = batch->z; z = batch->y;
+    } else {
+        y = batch->y; z = batch->z;
+    }
+    for (n=first; n<batch->count; n++) {
+        cele = cosf(batch->ele[n] * ang_to_rad);
+        batch->x[n] = cosf(batch->azi[n] * ang_to_rad) * cele;
+        y[n] = sinf(batch->azi[n] * ang_to_rad) * cele;
+        z[n] = sinf(batch->ele[n] * ang_to_rad);
+    }
+}
+
+/* Adds a direction given in cartesian coordinates to the batch. */
+static void spread_batch_add(SPREAD_BATCH *batch, CART_VEC dir, float wt) {
+    batch->x[batch->count] = dir.x;
+    batch->y[batch->count] = dir.y;
+    batch->z[batch->count] = dir.z;
+    batch->wt[batch->count++] = wt;
+}
+
+/* Normalizes the gains of the touched loudspeakers. */
+static void normalize_sparse_gains(float *gains, SPARSE_GAINS *touched) {
+    int i;
+    float sum = 0.0;
+    for (i=0; i<touched->count; i++) {
+        sum += (gains[touched->ls[i]] * gains[touched->ls[i]]);
+    }
+    sum = sqrtf(sum);
+    for (i=0; i<touched->count; i++) {
+        gains[touched->ls[i]] /= sum;
+    }
+}
+
 /*
  * apply the sound signal to multiple panning directions
  * that causes some spreading.
@@ -305,21 +415,18 @@ static void new_spread_base(CART_VEC spreaddir, CART_VEC vscartdir,
  * virtual sources" in WASPAA 99
  */
 static void spreadit(float azi, float spread, VBAP_DATA *data) {
-    int j;
-	CART_VEC spreaddir[16];
+	CART_VEC spreaddir;
 	CART_VEC spreadbase[16];
 	int i, spreaddirnum = 16;
-    int cnt = data->ls_am;
-    float tmp_gains[MAX_LS_AMOUNT];
-    for (i=0; i<cnt; i++) {
-        tmp_gains[i] = 0.0;
-    }
+    int cnt = data->layout->ls_am;
 	float sum = 0.0;
+    SPREAD_BATCH batch;
+    SPARSE_GAINS touched;
 
     /* four orthogonal dirs */
-	new_spread_dir(&spreaddir[0], data->cart_dir, data->spread_base,
+	new_spread_dir(&spreaddir, data->cart_dir, data->spread_base,
                    azi, spread);
-	new_spread_base(spreaddir[0], data->cart_dir, spread,
+	new_spread_base(spreaddir, data->cart_dir, spread,
                     &data->spread_base);
     cross_prod(data->spread_base, data->cart_dir, &spreadbase[1]); 
     cross_prod(spreadbase[1], data->cart_dir, &spreadbase[2]);
@@ -343,43 +450,45 @@ static void spreadit(float azi, float spread, VBAP_DATA *data) {
     vec_mean(data->cart_dir, spreadbase[10], &spreadbase[14]);
     vec_mean(data->cart_dir, spreadbase[11], &spreadbase[15]);
 
+    /* The source direction and the spread directions. */
+    batch.count = 0;
+    spread_batch_add(&batch, data->cart_dir, 1.0);
     for(i=1; i<spreaddirnum; i++){
-	    new_spread_dir(&spreaddir[i], data->cart_dir, spreadbase[i],
+	    new_spread_dir(&spreaddir, data->cart_dir, spreadbase[i],
                        azi, spread);
-        compute_gains(data->ls_set_am, data->ls_sets, tmp_gains,
-                      data->ls_am, spreaddir[i], data->dimension);
-        for (j=0; j<cnt; j++) {
-            data->gains[j] += tmp_gains[j];
-        }
+        spread_batch_add(&batch, spreaddir, 1.0);
 	}
+    spread_batch_pan(data->layout, &batch, data->gains, &touched);
 
 	if (spread > 70.0) {
         for (i=0; i<cnt; i++) {
             data->gains[i] += (spread - 70.0) / 30.0 *
                               (spread - 70.0) / 30.0 * 20.0;
         }
+        for (i=0; i<cnt; i++){
+            sum += (data->gains[i] * data->gains[i]);
+        }
+        sum = sqrtf(sum);
+        for(i=0; i<cnt; i++){
+            data->gains[i] /= sum;
+        }
+    } else {
+        normalize_sparse_gains(data->gains, &touched);
     }
-	for (i=0; i<cnt; i++){
-		sum += (data->gains[i] * data->gains[i]);
-    }
-    sum = sqrtf(sum);
-	for(i=0; i<cnt; i++){
-		data->gains[i] /= sum;
-	}
 }	
 
-static void spreadit_azi_ele(float azi, float ele, float sp_azi,
-                             float sp_ele, VBAP_DATA *data) {
-	int i, j, k, ind, num = 4, knum = 4;
+/* Spreads the source over rings of directions around it. There is one
+ * ring per 4 spread directions, the rings always cover the same angles. */
+static void spreadit_azi_ele(float sp_azi, float sp_ele, int flip_y_z,
+                             VBAP_DATA *data) {
+    static const float azisign[8] = { 1, -1, 1, -1, 0, 0, 1, -1 };
+    static const float elesign[8] = { 1, -1, -1, 1, 1, -1, 0, 0 };
+	int i, k, ind, knum = 4, num = data->spread_dirs / 4;
     float azidev, eledev, newazi, newele, comp;
-	ANG_VEC spreadang;
-	CART_VEC spreadcart;
-    int cnt = data->ls_am;
-    float tmp_gains[MAX_LS_AMOUNT];
-    for (i=0; i<cnt; i++) {
-        tmp_gains[i] = 0.0;
-    }
+    float step = 4.0f / num;
 	float sum = 0.0;
+    SPREAD_BATCH batch;
+    SPARSE_GAINS touched;
 
     if (sp_azi < 0.0) { sp_azi = 0.0; }
     else if (sp_azi > 1.0) { sp_azi = 1.0; }
@@ -394,275 +503,99 @@ static void spreadit_azi_ele(float azi, float ele, float sp_azi,
         knum = 4;
     }
 
+    batch.count = 0;
+    spread_batch_add(&batch, data->cart_dir, 1.0);
     for (i=0; i<num; i++) {
-        comp = powf(10.0f, (i+1) * -3.0f * 0.05f);
-        azidev = (i+1) * sp_azi * 45.0;
-        eledev = (i+1) * sp_ele * 22.5;
+        comp = powf(10.0f, (i+1) * step * -3.0f * 0.05f);
+        azidev = (i+1) * step * sp_azi * 45.0;
+        eledev = (i+1) * step * sp_ele * 22.5;
         for (k=0; k<knum; k++) {
-            if (k == 0) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 1) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 2) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 3) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 4) {
-                newazi = data->ang_dir.azi;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 5) {
-                newazi = data->ang_dir.azi;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 6) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele;
-            }
-            else if (k == 7) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele;
-            }
+            newazi = data->ang_dir.azi + azisign[k] * azidev;
+            newele = data->ang_dir.ele + elesign[k] * eledev;
             if (newazi > 180) { newazi -= 360; }
             else if (newazi < -180) { newazi += 360; }
             if (newele > 90) { newele = 90; }
             else if (newele < 0) { newele = 0; }
-            spreadang.azi = newazi;
-            spreadang.ele = newele;
-            spreadang.length = 1.0;
-            vec_angle_to_cart(&spreadang, &spreadcart);
-            compute_gains(data->ls_set_am, data->ls_sets, tmp_gains,
-                          data->ls_am, spreadcart, data->dimension);
-            for (j=0; j<cnt; j++) {
-                data->gains[j] += (tmp_gains[j] * comp);
-            }
+            batch.azi[batch.count] = newazi;
+            batch.ele[batch.count] = newele;
+            batch.wt[batch.count++] = comp;
 	    }
     }
+    spread_batch_to_cart(&batch, 1, flip_y_z);
+    spread_batch_pan(data->layout, &batch, data->gains, &touched);
 
 	if (sp_azi > 0.8 && sp_ele > 0.8) {
         comp = (sp_azi - 0.8) / 0.2 * (sp_ele - 0.8) / 0.2 * 10.0;
-        for (i=0; i<data->ls_out; i++) {
-            data->gains[data->out_patches[i]-1] += comp;
+        for (i=0; i<data->layout->ls_out; i++) {
+            data->gains[data->layout->out_patches[i]-1] += comp;
         }
-    }
-
-	for (i=0; i<data->ls_out; i++) {
-        ind = data->out_patches[i]-1;
-		sum += (data->gains[ind] * data->gains[ind]);
-    }
-    sum = sqrtf(sum);
-	for (i=0; i<data->ls_out; i++) {
-        ind = data->out_patches[i]-1;
-		data->gains[ind] /= sum;
-	}
-}	
-
-static void spreadit_azi_ele_flip_y_z(float azi, float ele, float sp_azi,
-                                      float sp_ele, VBAP_DATA *data) {
-	int i, j, k, ind, num = 4, knum = 4;
-    float azidev, eledev, newazi, newele, comp, tmp;
-	ANG_VEC spreadang;
-	CART_VEC spreadcart;
-    int cnt = data->ls_am;
-    float tmp_gains[MAX_LS_AMOUNT];
-    for (i=0; i<cnt; i++) {
-        tmp_gains[i] = 0.0;
-    }
-	float sum = 0.0;
-
-    if (sp_azi < 0.0) { sp_azi = 0.0; }
-    else if (sp_azi > 1.0) { sp_azi = 1.0; }
-    if (sp_ele < 0.0) { sp_ele = 0.0; }
-    else if (sp_ele > 1.0) { sp_ele = 1.0; }
-
-    // If both sp_azi and sp_ele are active, we want to put a virtual source at
-    // (azi, ele +/- eledev) and (azi +/- azidev, ele) locations.
-    if (sp_azi > 0.0 && sp_ele > 0.0) {
-        knum = 8;
-    } else {
-        knum = 4;
-    }
-
-    for (i=0; i<num; i++) {
-        comp = powf(10.0f, (i+1) * -3.0f * 0.05f);
-        azidev = (i+1) * sp_azi * 45.0;
-        eledev = (i+1) * sp_ele * 22.5;
-        for (k=0; k<knum; k++) {
-            if (k == 0) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 1) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 2) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 3) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 4) {
-                newazi = data->ang_dir.azi;
-                newele = data->ang_dir.ele + eledev;
-            }
-            else if (k == 5) {
-                newazi = data->ang_dir.azi;
-                newele = data->ang_dir.ele - eledev;
-            }
-            else if (k == 6) {
-                newazi = data->ang_dir.azi + azidev;
-                newele = data->ang_dir.ele;
-            }
-            else if (k == 7) {
-                newazi = data->ang_dir.azi - azidev;
-                newele = data->ang_dir.ele;
-            }
-            if (newazi > 180) { newazi -= 360; }
-            else if (newazi < -180) { newazi += 360; }
-            if (newele > 90) { newele = 90; }
-            else if (newele < 0) { newele = 0; }
-            spreadang.azi = newazi;
-            spreadang.ele = newele;
-            spreadang.length = 1.0;
-            vec_angle_to_cart(&spreadang, &spreadcart);
-            tmp = spreadcart.z;
-            spreadcart.z = spreadcart.y;
-            spreadcart.y = tmp;
-            compute_gains(data->ls_set_am, data->ls_sets, tmp_gains,
-                          data->ls_am, spreadcart, data->dimension);
-            for (j=0; j<cnt; j++) {
-                data->gains[j] += (tmp_gains[j] * comp);
-            }
-	    }
-    }
-
-	if (sp_azi > 0.8 && sp_ele > 0.8) {
-        comp = (sp_azi - 0.8) / 0.2 * (sp_ele - 0.8) / 0.2 * 10.0;
-        for (i=0; i<data->ls_out; i++) {
-            data->gains[data->out_patches[i]-1] += comp;
+        for (i=0; i<data->layout->ls_out; i++) {
+            ind = data->layout->out_patches[i]-1;
+            sum += (data->gains[ind] * data->gains[ind]);
         }
+        sum = sqrtf(sum);
+        for (i=0; i<data->layout->ls_out; i++) {
+            ind = data->layout->out_patches[i]-1;
+            data->gains[ind] /= sum;
+        }
+    } else {
+        normalize_sparse_gains(data->gains, &touched);
     }
+}	
 
-	for (i=0; i<data->ls_out; i++) {
-        ind = data->out_patches[i]-1;
-		sum += (data->gains[ind] * data->gains[ind]);
-    }
-    sum = sqrtf(sum);
-	for (i=0; i<data->ls_out; i++) {
-        ind = data->out_patches[i]-1;
-		data->gains[ind] /= sum;
-	}
-}
-
-static void spreadit_azi(float azi, float sp_azi, VBAP_DATA *data) {
-	int i, j, k, num = 4;
+/* Spreads the source over pairs of directions around it, one pair per
+ * 4 spread directions. */
+static void spreadit_azi(float sp_azi, int flip_y_z, VBAP_DATA *data) {
+	int i, k, num = data->spread_dirs / 4;
     float azidev, newazi, comp;
-	ANG_VEC spreadang;
-	CART_VEC spreadcart;
-    int cnt = data->ls_am;
-    float tmp_gains[MAX_LS_AMOUNT];
-    for (i=0; i<cnt; i++) {
-        tmp_gains[i] = 0.0;
-    }
-	float sum = 0.0;
+    float step = 4.0f / num;
+    SPREAD_BATCH batch;
+    SPARSE_GAINS touched;
 
     if (sp_azi < 0.0) { sp_azi = 0.0; }
     else if (sp_azi > 1.0) { sp_azi = 1.0; }
 
+    batch.count = 0;
+    spread_batch_add(&batch, data->cart_dir, 1.0);
     for (i=0; i<num; i++) {
-        comp = powf(10.0f, (i+1) * -3.0f * 0.05f);
-        azidev = (i+1) * sp_azi * 45.0;
+        comp = powf(10.0f, (i+1) * step * -3.0f * 0.05f);
+        azidev = (i+1) * step * sp_azi * 45.0;
         for (k=0; k<2; k++) {
             if (k == 0) {
                 newazi = data->ang_dir.azi + azidev;
             }
-            else if (k == 1) {
+            else {
                 newazi = data->ang_dir.azi - azidev;
             }
             if (newazi > 180) { newazi -= 360; }
             else if (newazi < -180) { newazi += 360; }
-            spreadang.azi = newazi;
-            spreadang.ele = 0.0;
-            spreadang.length = 1.0;
-            vec_angle_to_cart(&spreadang, &spreadcart);
-            compute_gains(data->ls_set_am, data->ls_sets, tmp_gains,
-                          data->ls_am, spreadcart, data->dimension);
-            for (j=0; j<cnt; j++) {
-                data->gains[j] += (tmp_gains[j] * comp);
-            }
+            batch.azi[batch.count] = newazi;
+            batch.ele[batch.count] = 0.0;
+            batch.wt[batch.count++] = comp;
 	    }
     }
-
-	for (i=0; i<cnt; i++) {
-		sum += (data->gains[i] * data->gains[i]);
-    }
-    sum = sqrtf(sum);
-	for (i=0; i<cnt; i++) {
-		data->gains[i] /= sum;
-	}
+    spread_batch_to_cart(&batch, 1, flip_y_z);
+    spread_batch_pan(data->layout, &batch, data->gains, &touched);
+    normalize_sparse_gains(data->gains, &touched);
 }
 
-static void spreadit_azi_flip_y_z(float azi, float sp_azi, VBAP_DATA *data) {
-	int i, j, k, num = 4;
-    float azidev, newazi, comp, tmp;
-	ANG_VEC spreadang;
-	CART_VEC spreadcart;
-    int cnt = data->ls_am;
-    float tmp_gains[MAX_LS_AMOUNT];
-    for (i=0; i<cnt; i++) {
-        tmp_gains[i] = 0.0;
-    }
-	float sum = 0.0;
-
-    if (sp_azi < 0.0) { sp_azi = 0.0; }
-    else if (sp_azi > 1.0) { sp_azi = 1.0; }
-
-    for (i=0; i<num; i++) {
-        comp = powf(10.0f, (i+1) * -3.0f * 0.05f);
-        azidev = (i+1) * sp_azi * 45.0;
-        for (k=0; k<2; k++) {
-            if (k == 0) {
-                newazi = data->ang_dir.azi + azidev;
-            }
-            else if (k == 1) {
-                newazi = data->ang_dir.azi - azidev;
-            }
-            if (newazi > 180) { newazi -= 360; }
-            else if (newazi < -180) { newazi += 360; }
-            spreadang.azi = newazi;
-            spreadang.ele = 0.0;
-            spreadang.length = 1.0;
-            vec_angle_to_cart(&spreadang, &spreadcart);
-            tmp = spreadcart.z;
-            spreadcart.z = spreadcart.y;
-            spreadcart.y = tmp;
-            compute_gains(data->ls_set_am, data->ls_sets, tmp_gains,
-                          data->ls_am, spreadcart, data->dimension);
-            for (j=0; j<cnt; j++) {
-                data->gains[j] += (tmp_gains[j] * comp);
-            }
-	    }
-    }
-
-	for (i=0; i<cnt; i++) {
-		sum += (data->gains[i] * data->gains[i]);
+/* Gains of vbap2 and vbap2_flip_y_z, the direction is already set. */
+static void spread_gains(float sp_azi, float sp_ele, int flip_y_z,
+                         VBAP_DATA *data) {
+    int i;
+    if (data->layout->dimension == 3 ? (sp_azi > 0 || sp_ele > 0) :
+                                       (sp_azi > 0)) {
+        for (i=0; i<data->layout->ls_am; i++) {
+            data->gains[i] = 0.0;
+        }
+        if (data->layout->dimension == 3)
+            spreadit_azi_ele(sp_azi, sp_ele, flip_y_z, data);
+        else
+            spreadit_azi(sp_azi, flip_y_z, data);
+    } else {
+        compute_gains(data->layout, data->gains, data->cart_dir);
     }
-    sum = sqrtf(sum);
-	for (i=0; i<cnt; i++) {
-		data->gains[i] /= sum;
-	}
-}	
+}
 
 void free_speakers_setup(SPEAKERS_SETUP *setup) {
     free(setup->azimuth);
@@ -1024,6 +957,428 @@ void choose_ls_triplets(ls lss[MAX_LS_AMOUNT],
     }
 }
 
+/* Convex hull (quickhull) triangulation of the loudspeaker directions.
+ *
+ * Every loudspeaker lies on the unit sphere, so the faces of the convex
+ * hull of their direction vectors form a non-intersecting triangulation,
+ * obtained in O(n log n) instead of the O(n^4) connection sweep above.
+ * Faces lying in a plane through the origin (e.g. the bottom of a dome)
+ * are discarded with the same MIN_VOL_P_SIDE_LGTH threshold.
+ */
+
+#define HULL_EPSILON 1e-6
+
+typedef struct {
+    int v[3];           /* Vertices, counter-clockwise seen from outside. */
+    int adj[3];         /* Neighbour face across edge v[i] -> v[(i+1)%3]. */
+    double n[3];        /* Outward unit normal. */
+    double d;           /* Plane offset (n . x = d). */
+    int outside;        /* Head of the outside points list (-1 if empty). */
+    int alive;
+    int visible;
+} hull_face;
+
+typedef struct {
+    int p_am;           /* Number of points. */
+    double (*p)[3];     /* Normalized loudspeaker directions. */
+    int *next;          /* Outside points list links. */
+    int *horizon_from;  /* New face whose horizon edge starts at a vertex. */
+    int *horizon_to;    /* New face whose horizon edge ends at a vertex. */
+    int *pending;       /* Points to reassign after adding a vertex. */
+    int *stack;         /* Faces to visit while searching the horizon. */
+    int stack_cap;
+    hull_face *faces;
+    int face_am;
+    int face_cap;
+} hull_data;
+
+static double hull_dist(hull_data *h, int f, int i) {
+    hull_face *face = &h->faces[f];
+    return face->n[0] * h->p[i][0] + face->n[1] * h->p[i][1] + 
+           face->n[2] * h->p[i][2] - face->d;
+}
+
+/* Returns the index of a new face, or -1 if it is degenerated. */
+static int hull_add_face(hull_data *h, int a, int b, int c) {
+    double e1[3], e2[3], len;
+    hull_face *face;
+
+    if (h->face_am == h->face_cap) {
+        hull_face *tmp;
+        h->face_cap *= 2;
+        tmp = (hull_face *)realloc(h->faces, sizeof(hull_face) * h->face_cap);
+        if (tmp == NULL)
+            return -1;
+        h->faces = tmp;
+    }
+    face = &h->faces[h->face_am];
+    face->v[0] = a;
+    face->v[1] = b;
+    face->v[2] = c;
+    face->adj[0] = face->adj[1] = face->adj[2] = -1;
+    face->outside = -1;
+    face->alive = 1;
+    face->visible = 0;
+
+    e1[0] = h->p[b][0] - h->p[a][0];
+    e1[1] = h->p[b][1] - h->p[a][1];
+    e1[2] = h->p[b][2] - h->p[a][2];
+    e2[0] = h->p[c][0] - h->p[a][0];
+    e2[1] = h->p[c][1] - h->p[a][1];
+    e2[2] = h->p[c][2] - h->p[a][2];
+    face->n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    face->n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    face->n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    len = sqrt(face->n[0] * face->n[0] + face->n[1] * face->n[1] + 
+               face->n[2] * face->n[2]);
+    if (len < HULL_EPSILON)
+        return -1;
+    face->n[0] /= len;
+    face->n[1] /= len;
+    face->n[2] /= len;
+    face->d = face->n[0] * h->p[a][0] + face->n[1] * h->p[a][1] +
+              face->n[2] * h->p[a][2];
+    return h->face_am++;
+}
+
+/* Links face f, across its edge (a, b), to face g. */
+static void hull_link(hull_data *h, int f, int a, int b, int g) {
+    int i;
+    hull_face *face = &h->faces[f];
+    for (i=0; i<3; i++) {
+        if (face->v[i] == a && face->v[(i+1)%3] == b) {
+            face->adj[i] = g;
+            return;
+        }
+    }
+}
+
+/* Gives point i to the first face in [first, last[ it is outside of. */
+static void hull_assign_point(hull_data *h, int i, int first, int last) {
+    int f;
+    for (f=first; f<last; f++) {
+        if (h->faces[f].alive && hull_dist(h, f, i) > HULL_EPSILON) {
+            h->next[i] = h->faces[f].outside;
+            h->faces[f].outside = i;
+            return;
+        }
+    }
+}
+
+/* Builds the initial tetrahedron. Returns 0 if all points are coplanar. */
+static int hull_init_simplex(hull_data *h) {
+    int i, j, f, s[4];
+    double dist, maxdist, e[3], c[3], tmp[3];
+
+    /* Two points far apart. */
+    s[0] = 0;
+    for (i=1; i<h->p_am; i++) {
+        if (h->p[i][0] < h->p[s[0]][0])
+            s[0] = i;
+    }
+    s[1] = -1;
+    maxdist = 0.0;
+    for (i=0; i<h->p_am; i++) {
+        for (j=0, dist=0.0; j<3; j++)
+            dist += (h->p[i][j] - h->p[s[0]][j]) * (h->p[i][j] - h->p[s[0]][j]);
+        if (dist > maxdist) {
+            maxdist = dist;
+            s[1] = i;
+        }
+    }
+    if (s[1] < 0)
+        return 0;
+
+    /* Farthest point from the line. */
+    for (j=0; j<3; j++)
+        e[j] = h->p[s[1]][j] - h->p[s[0]][j];
+    s[2] = -1;
+    maxdist = HULL_EPSILON;
+    for (i=0; i<h->p_am; i++) {
+        for (j=0; j<3; j++)
+            c[j] = h->p[i][j] - h->p[s[0]][j];
+        tmp[0] = e[1] * c[2] - e[2] * c[1];
+        tmp[1] = e[2] * c[0] - e[0] * c[2];
+        tmp[2] = e[0] * c[1] - e[1] * c[0];
+        dist = tmp[0] * tmp[0] + tmp[1] * tmp[1] + tmp[2] * tmp[2];
+        if (dist > maxdist) {
+            maxdist = dist;
+            s[2] = i;
+        }
+    }
+    if (s[2] < 0)
+        return 0;
+
+    /* Farthest point from the plane. */
+    f = hull_add_face(h, s[0], s[1], s[2]);
+    if (f < 0)
+        return 0;
+    s[3] = -1;
+    maxdist = HULL_EPSILON;
+    for (i=0; i<h->p_am; i++) {
+        dist = fabs(hull_dist(h, f, i));
+        if (dist > maxdist) {
+            maxdist = dist;
+            s[3] = i;
+        }
+    }
+    if (s[3] < 0)
+        return 0;
+
+    /* Orient the base so that the fourth point is behind it. */
+    h->face_am = 0;
+    if (hull_dist(h, f, s[3]) > 0.0) {
+        i = s[1];
+        s[1] = s[2];
+        s[2] = i;
+    }
+    if (hull_add_face(h, s[0], s[1], s[2]) < 0 ||
+        hull_add_face(h, s[0], s[3], s[1]) < 0 ||
+        hull_add_face(h, s[1], s[3], s[2]) < 0 ||
+        hull_add_face(h, s[2], s[3], s[0]) < 0)
+        return 0;
+
+    /* Adjacency of the tetrahedron. */
+    for (f=0; f<4; f++) {
+        for (i=0; i<3; i++) {
+            for (j=0; j<4; j++) {
+                if (j != f) {
+                    int a = h->faces[f].v[i], b = h->faces[f].v[(i+1)%3];
+                    int k, found = 0;
+                    for (k=0; k<3; k++) {
+                        if (h->faces[j].v[k] == b && h->faces[j].v[(k+1)%3] == a)
+                            found = 1;
+                    }
+                    if (found)
+                        h->faces[f].adj[i] = j;
+                }
+            }
+        }
+    }
+
+    for (i=0; i<h->p_am; i++) {
+        if (i != s[0] && i != s[1] && i != s[2] && i != s[3])
+            hull_assign_point(h, i, 0, 4);
+    }
+    return 1;
+}
+
+/* Adds the farthest outside point of face f to the hull. Returns 0 on a
+ * topological error, in which case the triangulation must be rejected. */
+static int hull_add_vertex(hull_data *h, int f) {
+    int i, k, g, eye, sp, pend_am, first, nf, hz_am;
+    double dist, maxdist;
+
+    /* Farthest outside point. */
+    eye = -1;
+    maxdist = 0.0;
+    for (i=h->faces[f].outside; i>=0; i=h->next[i]) {
+        dist = hull_dist(h, f, i);
+        if (dist > maxdist) {
+            maxdist = dist;
+            eye = i;
+        }
+    }
+    if (eye < 0)
+        return 0;
+
+    /* Visible faces and horizon edges. */
+    if (h->stack_cap < h->face_am) {
+        int *tmp = (int *)realloc(h->stack, sizeof(int) * h->face_cap);
+        if (tmp == NULL)
+            return 0;
+        h->stack = tmp;
+        h->stack_cap = h->face_cap;
+    }
+    pend_am = 0;
+    hz_am = 0;
+    first = h->face_am;
+    sp = 0;
+    h->faces[f].visible = 1;
+    h->stack[sp++] = f;
+    while (sp > 0) {
+        g = h->stack[--sp];
+        h->faces[g].alive = 0;
+        for (i=h->faces[g].outside; i>=0; i=h->next[i]) {
+            if (i != eye)
+                h->pending[pend_am++] = i;
+        }
+        h->faces[g].outside = -1;
+        for (k=0; k<3; k++) {
+            int a = h->faces[g].v[k], b = h->faces[g].v[(k+1)%3];
+            int o = h->faces[g].adj[k];
+            if (o < 0)
+                return 0;
+            if (h->faces[o].visible)
+                continue;
+            if (hull_dist(h, o, eye) > HULL_EPSILON) {
+                h->faces[o].visible = 1;
+                h->stack[sp++] = o;
+            } else {
+                /* Horizon edge (a, b), seen from the dead face g. */
+                nf = hull_add_face(h, a, b, eye);
+                if (nf < 0 || h->horizon_from[a] >= first || 
+                    h->horizon_to[b] >= first)
+                    return 0;
+                h->faces[nf].adj[0] = o;
+                hull_link(h, o, b, a, nf);
+                h->horizon_from[a] = nf;
+                h->horizon_to[b] = nf;
+                hz_am++;
+            }
+        }
+    }
+    if (hz_am < 3)
+        return 0;
+
+    /* Stitch the cone of new faces. */
+    for (nf=first; nf<h->face_am; nf++) {
+        int a = h->faces[nf].v[0], b = h->faces[nf].v[1];
+        if (h->horizon_from[b] < first || h->horizon_to[a] < first)
+            return 0;
+        h->faces[nf].adj[1] = h->horizon_from[b];
+        h->faces[nf].adj[2] = h->horizon_to[a];
+    }
+
+    for (i=0; i<pend_am; i++)
+        hull_assign_point(h, h->pending[i], first, h->face_am);
+    return 1;
+}
+
+/* Returns 1 if points i and j have the same direction. */
+static int hull_coincident(hull_data *h, int i, int j) {
+    double dx = h->p[i][0] - h->p[j][0];
+    double dy = h->p[i][1] - h->p[j][1];
+    double dz = h->p[i][2] - h->p[j][2];
+    return (dx * dx + dy * dy + dz * dz) < 1e-4;
+}
+
+static int compare_triplets(const void *a, const void *b) {
+    const int *t1 = (const int *)a, *t2 = (const int *)b;
+    if (t1[0] != t2[0])
+        return t1[0] - t2[0];
+    if (t1[1] != t2[1])
+        return t1[1] - t2[1];
+    return t1[2] - t2[2];
+}
+
+/* Selects the loudspeaker triplets from the faces of the convex hull.
+ * Returns 1 on success, or 0 (with an empty chain) if the setup must be
+ * handled by choose_ls_triplets instead: coplanar setups, numerical 
+ * failures or speakers left out of the hull without being duplicates.
+ */
+int choose_ls_triplets_hull(ls lss[MAX_LS_AMOUNT],
+                            ls_triplet_chain **ls_triplets,
+                            int ls_amount) {
+    int i, j, k, f, ok, tri_am = 0;
+    int *used = NULL, *tris = NULL;
+    double len;
+    hull_data h;
+
+    if (ls_amount < 4 || ls_amount > MAX_LS_AMOUNT)
+        return 0;
+
+    h.p_am = ls_amount;
+    h.face_cap = 8 * ls_amount;
+    h.face_am = 0;
+    h.p = (double (*)[3])malloc(sizeof(double) * 3 * ls_amount);
+    h.next = (int *)malloc(sizeof(int) * ls_amount);
+    h.horizon_from = (int *)malloc(sizeof(int) * ls_amount);
+    h.horizon_to = (int *)malloc(sizeof(int) * ls_amount);
+    h.pending = (int *)malloc(sizeof(int) * ls_amount);
+    h.faces = (hull_face *)malloc(sizeof(hull_face) * h.face_cap);
+    h.stack = NULL;
+    h.stack_cap = 0;
+    used = (int *)calloc(ls_amount, sizeof(int));
+
+    ok = h.p && h.next && h.horizon_from && h.horizon_to && h.pending && 
+         h.faces && used;
+    for (i=0; ok && i<ls_amount; i++) {
+        len = sqrt(lss[i].coords.x * lss[i].coords.x + 
+                   lss[i].coords.y * lss[i].coords.y + 
+                   lss[i].coords.z * lss[i].coords.z);
+        if (len < HULL_EPSILON) {
+            ok = 0;
+            break;
+        }
+        h.p[i][0] = lss[i].coords.x / len;
+        h.p[i][1] = lss[i].coords.y / len;
+        h.p[i][2] = lss[i].coords.z / len;
+        h.next[i] = -1;
+        h.horizon_from[i] = h.horizon_to[i] = -1;
+    }
+
+    if (ok)
+        ok = hull_init_simplex(&h);
+
+    /* New faces are appended, so one pass processes every outside set. */
+    for (f=0; ok && f<h.face_am; f++) {
+        if (h.faces[f].alive && h.faces[f].outside >= 0)
+            ok = hull_add_vertex(&h, f);
+    }
+
+    if (ok) {
+        tris = (int *)malloc(sizeof(int) * 3 * h.face_am);
+        ok = tris != NULL;
+    }
+    for (f=0; ok && f<h.face_am; f++) {
+        if (! h.faces[f].alive)
+            continue;
+        i = h.faces[f].v[0];
+        j = h.faces[f].v[1];
+        k = h.faces[f].v[2];
+        used[i] = used[j] = used[k] = 1;
+
+        /* Faces in a plane through the origin or too narrow. Hull faces
+           never overlap, so the elevation rule of vol_p_side_lgth is not
+           needed here. */
+        if (vol_p_side_lgth_raw(i, j, k, lss) <= MIN_VOL_P_SIDE_LGTH)
+            continue;
+        if (any_ls_inside_triplet(i, j, k, lss, ls_amount) == 1)
+            continue;
+
+        /* Same ordering as choose_ls_triplets. */
+        if (i > j) { int t = i; i = j; j = t; }
+        if (j > k) { int t = j; j = k; k = t; }
+        if (i > j) { int t = i; i = j; j = t; }
+        tris[tri_am*3] = i;
+        tris[tri_am*3+1] = j;
+        tris[tri_am*3+2] = k;
+        tri_am++;
+    }
+    /* A speaker left inside the hull must be a duplicate of a vertex. */
+    for (i=0; ok && i<ls_amount; i++) {
+        if (used[i] == 0) {
+            ok = 0;
+            for (j=0; j<ls_amount; j++) {
+                if (used[j] && hull_coincident(&h, i, j)) {
+                    ok = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (ok && tri_am > 0) {
+        qsort(tris, tri_am, sizeof(int) * 3, compare_triplets);
+        for (i=0; i<tri_am; i++)
+            add_ldsp_triplet(tris[i*3], tris[i*3+1], tris[i*3+2], ls_triplets, lss);
+    } else {
+        ok = 0;
+    }
+
+    free(h.p);
+    free(h.next);
+    free(h.horizon_from);
+    free(h.horizon_to);
+    free(h.pending);
+    free(h.faces);
+    free(h.stack);
+    free(used);
+    free(tris);
+    return ok;
+}
+
 /* Calculates the inverse matrices for 3D.
  *
  * After this call, ls_triplets contains the speakers numbers
@@ -1121,31 +1476,198 @@ void load_ls_triplets(ls lss[MAX_LS_AMOUNT],
     }
 }
 
-VBAP_DATA * init_vbap_data(SPEAKERS_SETUP *setup, int **triplets) {
-    int i, j, ret;
-    ls lss[MAX_LS_AMOUNT];
-    ls_triplet_chain *ls_triplets = NULL;
-    ls_triplet_chain *ls_ptr;
-    VBAP_DATA *data = (VBAP_DATA *)malloc(sizeof(VBAP_DATA));
+/* Lowest gain a candidate set may reach inside a cell. This is the -0.05
+ * threshold of compute_gains for direction vectors down to 0.5 long. */
+#define LS_SET_GRID_THRESHOLD -0.1
+#define LS_SET_GRID_MIN_LENGTH 0.5
+
+/* Direction of the point (u, v) of a cube map face. */
+static void grid_face_dir(int face, float u, float v, float dir[3]) {
+    float len;
+    switch (face) {
+        case 0: dir[0] = 1.0; dir[1] = u; dir[2] = v; break;
+        case 1: dir[0] = -1.0; dir[1] = u; dir[2] = v; break;
+        case 2: dir[0] = u; dir[1] = 1.0; dir[2] = v; break;
+        case 3: dir[0] = u; dir[1] = -1.0; dir[2] = v; break;
+        case 4: dir[0] = u; dir[1] = v; dir[2] = 1.0; break;
+        default: dir[0] = u; dir[1] = v; dir[2] = -1.0; break;
+    }
+    len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    dir[0] /= len;
+    dir[1] /= len;
+    dir[2] /= len;
+}
 
-    build_speakers_list(setup, lss);
+/* Returns the cell containing a direction, or -1 for a null vector. */
+static int grid_cell(LS_SET_GRID *grid, float vec[3], int dim) {
+    int face, iu, iv, res = grid->resolution;
+    float ax, ay, az, m, u, v;
+
+    if (dim == 2) {
+        if (vec[0] == 0.0 && vec[1] == 0.0)
+            return -1;
+        iu = (int)((atan2f(vec[1], vec[0]) + M_PI) / PIx2 * res);
+        return iu < 0 ? 0 : iu >= res ? res - 1 : iu;
+    }
+
+    ax = fabsf(vec[0]);
+    ay = fabsf(vec[1]);
+    az = fabsf(vec[2]);
+    if (ax >= ay && ax >= az) {
+        face = vec[0] > 0.0 ? 0 : 1; m = ax; u = vec[1]; v = vec[2];
+    } else if (ay >= az) {
+        face = vec[1] > 0.0 ? 2 : 3; m = ay; u = vec[0]; v = vec[2];
+    } else {
+        face = vec[2] > 0.0 ? 4 : 5; m = az; u = vec[0]; v = vec[1];
+    }
+    if (m == 0.0)
+        return -1;
+    iu = (int)((u / m + 1.0) * 0.5 * res);
+    iv = (int)((v / m + 1.0) * 0.5 * res);
+    iu = iu < 0 ? 0 : iu >= res ? res - 1 : iu;
+    iv = iv < 0 ? 0 : iv >= res ? res - 1 : iv;
+    return (face * res + iv) * res + iu;
+}
 
-    if (triplets == NULL)
-        choose_ls_triplets(lss, &ls_triplets, setup->count);
-    else
-        load_ls_triplets(lss, &ls_triplets, setup->count, "filename");
+/* Center direction and angular radius of a cell. */
+static void grid_cell_bounds(LS_SET_GRID *grid, int cell, int dim,
+                             float center[3], float *radius) {
+    int i, face, iu, iv, res = grid->resolution;
+    float u0, u1, v0, v1, corner[3], ang;
+    CART_VEC c, k;
+
+    if (dim == 2) {
+        ang = ((cell + 0.5) / res) * PIx2 - M_PI;
+        center[0] = cosf(ang);
+        center[1] = sinf(ang);
+        center[2] = 0.0;
+        *radius = M_PI / res + 0.001;
+        return;
+    }
+
+    face = cell / (res * res);
+    iv = (cell / res) % res;
+    iu = cell % res;
+    u0 = (2.0 * iu / res) - 1.0;
+    u1 = (2.0 * (iu + 1) / res) - 1.0;
+    v0 = (2.0 * iv / res) - 1.0;
+    v1 = (2.0 * (iv + 1) / res) - 1.0;
+    grid_face_dir(face, (u0 + u1) * 0.5, (v0 + v1) * 0.5, center);
+    c.x = center[0]; c.y = center[1]; c.z = center[2];
+
+    /* A spherical cap around the center containing the four corners
+       contains the whole cell. */
+    *radius = 0.0;
+    for (i=0; i<4; i++) {
+        grid_face_dir(face, i & 1 ? u1 : u0, i & 2 ? v1 : v0, corner);
+        k.x = corner[0]; k.y = corner[1]; k.z = corner[2];
+        ang = vec_angle(c, k);
+        if (ang > *radius)
+            *radius = ang;
+    }
+    *radius += 0.001;
+}
 
-    ret = calculate_3x3_matrixes(ls_triplets, lss, setup->count);
-    if (ret == 0) {
-        free(data);
-        return NULL;
+/* Returns 1 if no gain of the set has to go below the grid threshold
+ * for some direction within `radius` of `center`. */
+static int grid_set_reaches(LS_SET *set, int dim, float center[3], float radius) {
+    int j, k;
+    float len, dot, ang, best;
+    for (j=0; j<dim; j++) {
+        len = dot = 0.0;
+        for (k=0; k<dim; k++) {
+            len += set->inv_mx[dim*j+k] * set->inv_mx[dim*j+k];
+            dot += set->inv_mx[dim*j+k] * center[k];
+        }
+        len = sqrtf(len);
+        if (len == 0.0)
+            continue;
+        ang = acosf(clip(dot / len, -1.0, 1.0)) - radius;
+        best = ang <= 0.0 ? len : len * cosf(ang);
+        if (best < LS_SET_GRID_THRESHOLD)
+            return 0;
+    }
+    return 1;
+}
+
+/* Builds the lookup grid of the loudspeaker sets of a VBAP_DATA. */
+static LS_SET_GRID * init_ls_set_grid(LS_SET *sets, int ls_set_am, int dim) {
+    int i, cell, count, pass;
+    float center[3], radius;
+    LS_SET_GRID *grid = (LS_SET_GRID *)malloc(sizeof(LS_SET_GRID));
+
+    grid->resolution = LS_SET_GRID_RESOLUTION;
+    if (dim == 2)
+        grid->resolution *= 4;
+    grid->cell_am = dim == 2 ? grid->resolution :
+                    6 * grid->resolution * grid->resolution;
+    grid->offsets = (int *)malloc(sizeof(int) * (grid->cell_am + 1));
+    grid->sets = NULL;
+
+    /* First pass counts the candidates, second pass stores them. */
+    for (pass=0; pass<2; pass++) {
+        count = 0;
+        for (cell=0; cell<grid->cell_am; cell++) {
+            grid->offsets[cell] = count;
+            grid_cell_bounds(grid, cell, dim, center, &radius);
+            for (i=0; i<ls_set_am; i++) {
+                if (grid_set_reaches(&sets[i], dim, center, radius)) {
+                    if (pass == 1)
+                        grid->sets[count] = i;
+                    count++;
+                }
+            }
+        }
+        grid->offsets[grid->cell_am] = count;
+        if (pass == 0)
+            grid->sets = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
     }
+    return grid;
+}
+
+static void free_ls_set_grid(LS_SET_GRID *grid) {
+    if (grid == NULL)
+        return;
+    free(grid->offsets);
+    free(grid->sets);
+    free(grid);
+}
+
+/* Returns a new VBAP_DATA, in its initial state, using `layout`. */
+static VBAP_DATA * new_vbap_data(VBAP_LAYOUT *layout) {
+    int i;
+    VBAP_DATA *data = (VBAP_DATA *)malloc(sizeof(VBAP_DATA));
 
-    data->dimension = setup->dimension;
-    data->ls_am = setup->count;
+    data->layout = layout;
     for (i=0; i<MAX_LS_AMOUNT; i++) {
         data->gains[i] = data->y[i] = 0.0;
     }
+    data->ang_dir.azi = data->ang_dir.ele = 0.0;
+    data->ang_dir.length = 1.0;
+    data->cart_dir.x = 1.0;
+    data->cart_dir.y = data->cart_dir.z = 0.0;
+    data->spread_base = data->cart_dir;
+    data->spread_dirs = VBAP_SPREAD_DIRS;
+    return data;
+}
+
+/* Builds a VBAP_DATA owning a new layout made of the loudspeaker sets.
+ * The ls_nos of the chain are mapped to physical outputs with 
+ * `outputPatches`, or start at 1 if it is NULL. */
+static VBAP_DATA * init_vbap_layout(ls_triplet_chain *ls_triplets, int dim,
+                                    int ls_out, int outputPatches[MAX_LS_AMOUNT],
+                                    int ls_am, int offset) {
+    int i, j;
+    ls_triplet_chain *ls_ptr;
+    VBAP_LAYOUT *layout = (VBAP_LAYOUT *)malloc(sizeof(VBAP_LAYOUT));
+
+    layout->refcount = 1;
+    layout->dimension = dim;
+    layout->ls_am = ls_am;
+    layout->ls_out = ls_out;
+    for (i=0; i<ls_out; i++) {
+        layout->out_patches[i] = outputPatches != NULL ? outputPatches[i] : i + 1;
+    }
 
     i = 0;
     ls_ptr = ls_triplets;
@@ -1153,22 +1675,52 @@ VBAP_DATA * init_vbap_data(SPEAKERS_SETUP *setup, int **triplets) {
         ls_ptr = ls_ptr->next;
         i++;
     }
-    data->ls_set_am = i;
-    data->ls_sets = (LS_SET *)malloc(sizeof(LS_SET) * i);
+    layout->ls_set_am = i;
+    layout->ls_sets = (LS_SET *)malloc(sizeof(LS_SET) * (i > 0 ? i : 1));
 
     i = 0;
     ls_ptr = ls_triplets;
     while (ls_ptr != NULL) {
-        for (j=0; j<data->dimension; j++) {
-            data->ls_sets[i].ls_nos[j] = ls_ptr->ls_nos[j] + 1;
+        for (j=0; j<dim; j++) {
+            if (outputPatches != NULL)
+                layout->ls_sets[i].ls_nos[j] = outputPatches[ls_ptr->ls_nos[j] + offset - 1];
+            else
+                layout->ls_sets[i].ls_nos[j] = ls_ptr->ls_nos[j] + offset;
         }
-        for (j=0; j<(data->dimension*data->dimension); j++) {
-            data->ls_sets[i].inv_mx[j] = ls_ptr->inv_mx[j];
+        for (j=0; j<(dim*dim); j++) {
+            layout->ls_sets[i].inv_mx[j] = ls_ptr->inv_mx[j];
         }
         ls_ptr = ls_ptr->next;
         i++;
     }
 
+    layout->grid = init_ls_set_grid(layout->ls_sets, layout->ls_set_am, dim);
+
+    return new_vbap_data(layout);
+}
+
+VBAP_DATA * init_vbap_data(SPEAKERS_SETUP *setup, int **triplets) {
+    int ret;
+    ls lss[MAX_LS_AMOUNT];
+    ls_triplet_chain *ls_triplets = NULL;
+    VBAP_DATA *data;
+
+    build_speakers_list(setup, lss);
+
+    if (triplets == NULL) {
+        if (choose_ls_triplets_hull(lss, &ls_triplets, setup->count) == 0)
+            choose_ls_triplets(lss, &ls_triplets, setup->count);
+    } else
+        load_ls_triplets(lss, &ls_triplets, setup->count, "filename");
+
+    ret = calculate_3x3_matrixes(ls_triplets, lss, setup->count);
+    if (ret == 0) {
+        free_ls_triplet_chain(ls_triplets);
+        return NULL;
+    }
+
+    data = init_vbap_layout(ls_triplets, setup->dimension, setup->count,
+                            NULL, setup->count, 1);
     free_ls_triplet_chain(ls_triplets);
 
     return data;
@@ -1177,19 +1729,19 @@ VBAP_DATA * init_vbap_data(SPEAKERS_SETUP *setup, int **triplets) {
 VBAP_DATA * init_vbap_from_speakers(ls lss[MAX_LS_AMOUNT], int count,
                                     int dim, int outputPatches[MAX_LS_AMOUNT],
                                     int maxOutputPatch, int **triplets) {
-    int i, j, ret, offset = 0;
+    int ret, offset = 0;
     ls_triplet_chain *ls_triplets = NULL;
-    ls_triplet_chain *ls_ptr;
-    VBAP_DATA *data = (VBAP_DATA *)malloc(sizeof(VBAP_DATA));
+    VBAP_DATA *data;
 
     if (dim == 3) {
-        if (triplets == NULL)
-            choose_ls_triplets(lss, &ls_triplets, count);
-        else
+        if (triplets == NULL) {
+            if (choose_ls_triplets_hull(lss, &ls_triplets, count) == 0)
+                choose_ls_triplets(lss, &ls_triplets, count);
+        } else
             load_ls_triplets(lss, &ls_triplets, count, "filename");
         ret = calculate_3x3_matrixes(ls_triplets, lss, count);
         if (ret == 0) {
-            free(data);
+            free_ls_triplet_chain(ls_triplets);
             return NULL;
         }
         offset = 1;
@@ -1197,85 +1749,173 @@ VBAP_DATA * init_vbap_from_speakers(ls lss[MAX_LS_AMOUNT], int count,
         choose_ls_tuplets(lss, &ls_triplets, count);
     }
 
-    data->ls_out = count;
-    for (i=0; i<count; i++) {
-        data->out_patches[i] = outputPatches[i];
-    }
-
-    data->dimension = dim;
-    data->ls_am = maxOutputPatch;
-    for (i=0; i<MAX_LS_AMOUNT; i++) {
-        data->gains[i] = data->y[i] = 0.0;
-    }
-
-    i = 0;
-    ls_ptr = ls_triplets;
-    while (ls_ptr != NULL) {
-        ls_ptr = ls_ptr->next;
-        i++;
-    }
-    data->ls_set_am = i;
-    data->ls_sets = (LS_SET *)malloc(sizeof(LS_SET) * i);
-
-    i = 0;
-    ls_ptr = ls_triplets;
-    while (ls_ptr != NULL) {
-        for (j=0; j<data->dimension; j++) {
-            //data->ls_sets[i].ls_nos[j] = ls_ptr->ls_nos[j] + offset;
-            data->ls_sets[i].ls_nos[j] = outputPatches[ls_ptr->ls_nos[j] + offset - 1];
-        }
-        for (j=0; j<(data->dimension*data->dimension); j++) {
-            data->ls_sets[i].inv_mx[j] = ls_ptr->inv_mx[j];
-        }
-        ls_ptr = ls_ptr->next;
-        i++;
-    }
-
+    data = init_vbap_layout(ls_triplets, dim, count, outputPatches,
+                            maxOutputPatch, offset);
     free_ls_triplet_chain(ls_triplets);
 
     return data;
 }
 
 VBAP_DATA * copy_vbap_data(VBAP_DATA *data) {
-    int i, j;
     VBAP_DATA *nw = (VBAP_DATA *)malloc(sizeof(VBAP_DATA));
-    nw->dimension = data->dimension;
-    nw->ls_out = data->ls_out;
-    for (i=0; i<data->ls_out; i++) {
-        nw->out_patches[i] = data->out_patches[i];
-    }
-    nw->ls_am = data->ls_am;
-    nw->ls_set_am = data->ls_set_am;
-    for (i=0; i<MAX_LS_AMOUNT; i++) {
-        nw->gains[i] = data->gains[i];
-        nw->y[i] = data->y[i];
-    }
-    nw->ls_sets = (LS_SET *)malloc(sizeof(LS_SET) * nw->ls_set_am);
-    for (i=0; i<nw->ls_set_am; i++) {
-        for (j=0; j<nw->dimension; j++) {
-            nw->ls_sets[i].ls_nos[j] = data->ls_sets[i].ls_nos[j];
-        }
-        for (j=0; j<nw->dimension*nw->dimension; j++) {
-            nw->ls_sets[i].inv_mx[j] = data->ls_sets[i].inv_mx[j];
-        }
-    }
-    nw->ang_dir.azi = data->ang_dir.azi;
-    nw->ang_dir.ele = data->ang_dir.ele;
-    nw->ang_dir.length = data->ang_dir.length;
-    nw->cart_dir.x = data->cart_dir.x;
-    nw->cart_dir.y = data->cart_dir.y;
-    nw->cart_dir.z = data->cart_dir.z;
-    nw->spread_base.x = data->spread_base.x;
-    nw->spread_base.y = data->spread_base.y;
-    nw->spread_base.z = data->spread_base.z;
+    *nw = *data;
+    nw->layout->refcount++;
     return nw;
 }
 
+/* Releases a reference to a layout, freed with its last VBAP_DATA. */
+static void release_vbap_layout(VBAP_LAYOUT *layout) {
+    if (--layout->refcount == 0) {
+        free_ls_set_grid(layout->grid);
+        free(layout->ls_sets);
+        free(layout);
+    }
+}
+
 void free_vbap_data(VBAP_DATA *data) {
-    free(data->ls_sets);
+    release_vbap_layout(data->layout);
     free(data);
 }
 
+void vbap_share_layout(VBAP_DATA *data, VBAP_DATA *from) {
+    VBAP_LAYOUT *layout = data->layout;
+    if (layout == from->layout)
+        return;
+    from->layout->refcount++;
+    data->layout = from->layout;
+    release_vbap_layout(layout);
+}
+
+/* Sequential access to a serialized layout. Writes are only counted when
+ * there is no buffer, reads past the end of the buffer set `error`. */
+typedef struct {
+    unsigned char *buf;
+    size_t size;
+    size_t pos;
+    int error;
+} LAYOUT_STREAM;
+
+static void stream_put(LAYOUT_STREAM *s, const void *src, size_t bytes) {
+    if (s->buf != NULL)
+        memcpy(s->buf + s->pos, src, bytes);
+    s->pos += bytes;
+}
+
+static int stream_get(LAYOUT_STREAM *s, void *dst, size_t bytes) {
+    if (s->error || bytes > s->size - s->pos) {
+        s->error = 1;
+        return 0;
+    }
+    memcpy(dst, s->buf + s->pos, bytes);
+    s->pos += bytes;
+    return 1;
+}
+
+static int stream_get_int(LAYOUT_STREAM *s, int min, int max) {
+    int value = min;
+    if (stream_get(s, &value, sizeof(int)) && (value < min || value > max))
+        s->error = 1;
+    return value;
+}
+
+size_t vbap_layout_serialize(VBAP_DATA *data, void *buffer, size_t size) {
+    int i, count;
+    VBAP_LAYOUT *layout = data->layout;
+    LS_SET_GRID *grid = layout->grid;
+    LAYOUT_STREAM s;
+
+    if (buffer != NULL && size < vbap_layout_serialize(data, NULL, 0))
+        buffer = NULL;
+    s.buf = (unsigned char *)buffer;
+    s.size = size;
+    s.pos = 0;
+    s.error = 0;
+
+    stream_put(&s, &layout->dimension, sizeof(int));
+    stream_put(&s, &layout->ls_am, sizeof(int));
+    stream_put(&s, &layout->ls_out, sizeof(int));
+    stream_put(&s, &layout->ls_set_am, sizeof(int));
+    stream_put(&s, layout->out_patches, sizeof(int) * layout->ls_out);
+    for (i=0; i<layout->ls_set_am; i++) {
+        stream_put(&s, layout->ls_sets[i].ls_nos, sizeof(int) * layout->dimension);
+        stream_put(&s, layout->ls_sets[i].inv_mx,
+                   sizeof(float) * layout->dimension * layout->dimension);
+    }
+    count = grid->offsets[grid->cell_am];
+    stream_put(&s, &grid->resolution, sizeof(int));
+    stream_put(&s, &grid->cell_am, sizeof(int));
+    stream_put(&s, &count, sizeof(int));
+    stream_put(&s, grid->offsets, sizeof(int) * (grid->cell_am + 1));
+    stream_put(&s, grid->sets, sizeof(int) * count);
+
+    return s.pos;
+}
+
+VBAP_DATA * vbap_layout_deserialize(const void *buffer, size_t size) {
+    int i, j, dim, count;
+    LS_SET_GRID *grid;
+    VBAP_LAYOUT *layout;
+    LAYOUT_STREAM s = { (unsigned char *)buffer, size, 0, 0 };
+
+    dim = stream_get_int(&s, 2, 3);
+    if (s.error)
+        return NULL;
+
+    layout = (VBAP_LAYOUT *)calloc(1, sizeof(VBAP_LAYOUT));
+    grid = (LS_SET_GRID *)calloc(1, sizeof(LS_SET_GRID));
+    layout->refcount = 1;
+    layout->dimension = dim;
+    layout->grid = grid;
+    layout->ls_am = stream_get_int(&s, 1, MAX_LS_AMOUNT);
+    layout->ls_out = stream_get_int(&s, 0, MAX_LS_AMOUNT);
+    layout->ls_set_am = stream_get_int(&s, 0, (int)(size / sizeof(int)));
+    for (i=0; i<layout->ls_out && !s.error; i++) {
+        layout->out_patches[i] = stream_get_int(&s, 1, MAX_LS_AMOUNT);
+    }
+    if (!s.error) {
+        layout->ls_sets = (LS_SET *)calloc(layout->ls_set_am > 0 ? layout->ls_set_am : 1,
+                                           sizeof(LS_SET));
+        for (i=0; i<layout->ls_set_am && !s.error; i++) {
+            for (j=0; j<dim; j++) {
+                layout->ls_sets[i].ls_nos[j] = stream_get_int(&s, 1, MAX_LS_AMOUNT);
+            }
+            stream_get(&s, layout->ls_sets[i].inv_mx, sizeof(float) * dim * dim);
+        }
+    }
+
+    /* The grid must be complete and only refer to existing sets. */
+    grid->resolution = stream_get_int(&s, 1, 1024);
+    grid->cell_am = stream_get_int(&s, 1, 6 * 1024 * 1024);
+    count = stream_get_int(&s, 0, (int)(size / sizeof(int)));
+    if (!s.error && grid->cell_am != (dim == 2 ? grid->resolution :
+                                      6 * grid->resolution * grid->resolution))
+        s.error = 1;
+    if (!s.error) {
+        grid->offsets = (int *)malloc(sizeof(int) * (grid->cell_am + 1));
+        grid->sets = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
+        stream_get(&s, grid->offsets, sizeof(int) * (grid->cell_am + 1));
+        stream_get(&s, grid->sets, sizeof(int) * count);
+    }
+    if (!s.error && (grid->offsets[0] != 0 || grid->offsets[grid->cell_am] != count))
+        s.error = 1;
+    for (i=0; i<grid->cell_am && !s.error; i++) {
+        if (grid->offsets[i] > grid->offsets[i+1])
+            s.error = 1;
+    }
+    for (i=0; i<count && !s.error; i++) {
+        if (grid->sets[i] < 0 || grid->sets[i] >= layout->ls_set_am)
+            s.error = 1;
+    }
+
+    if (s.error || s.pos != size) {
+        free_ls_set_grid(grid);
+        free(layout->ls_sets);
+        free(layout);
+        return NULL;
+    }
+    return new_vbap_data(layout);
+}
+
 void vbap(float azi, float ele, float spread, VBAP_DATA *data) {
     int i;
     data->ang_dir.azi = azi;
@@ -1285,37 +1925,19 @@ void vbap(float azi, float ele, float spread, VBAP_DATA *data) {
     data->spread_base.x = data->cart_dir.x;
     data->spread_base.y = data->cart_dir.y;
     data->spread_base.z = data->cart_dir.z;
-    for (i=0; i<data->ls_am; i++) {
-        data->gains[i] = 0.0;
-    }
-    compute_gains(data->ls_set_am, data->ls_sets, data->gains,
-                  data->ls_am, data->cart_dir, data->dimension);
     if (spread > 0) {
+        for (i=0; i<data->layout->ls_am; i++) {
+            data->gains[i] = 0.0;
+        }
         spreadit(azi, spread, data);
+    } else {
+        compute_gains(data->layout, data->gains, data->cart_dir);
     }
 }
 
 void vbap2(float azi, float ele, float sp_azi,
            float sp_ele, VBAP_DATA *data) {
-    int i;
-    data->ang_dir.azi = azi;
-    data->ang_dir.ele = ele;
-    data->ang_dir.length = 1.0;
-    vec_angle_to_cart(&data->ang_dir, &data->cart_dir);
-    for (i=0; i<data->ls_am; i++) {
-        data->gains[i] = 0.0;
-    }
-    compute_gains(data->ls_set_am, data->ls_sets, data->gains,
-                  data->ls_am, data->cart_dir, data->dimension);
-    if (data->dimension == 3) {
-        if (sp_azi > 0 || sp_ele > 0) {
-            spreadit_azi_ele(azi, ele, sp_azi, sp_ele, data);
-        }
-    } else {
-        if (sp_azi > 0) {
-            spreadit_azi(azi, sp_azi, data);
-        }
-    }
+    vbap_compute_batch(&data, &azi, &ele, &sp_azi, &sp_ele, 1, 0);
 }
 
 void vbap_flip_y_z(float azi, float ele, float spread, VBAP_DATA *data) {
@@ -1331,122 +1953,183 @@ void vbap_flip_y_z(float azi, float ele, float spread, VBAP_DATA *data) {
     data->spread_base.x = data->cart_dir.x;
     data->spread_base.y = data->cart_dir.y;
     data->spread_base.z = data->cart_dir.z;
-    for (i=0; i<data->ls_am; i++) {
-        data->gains[i] = 0.0;
-    }
-    compute_gains(data->ls_set_am, data->ls_sets, data->gains,
-                  data->ls_am, data->cart_dir, data->dimension);
     if (spread > 0) {
+        for (i=0; i<data->layout->ls_am; i++) {
+            data->gains[i] = 0.0;
+        }
         spreadit(azi, spread, data);
+    } else {
+        compute_gains(data->layout, data->gains, data->cart_dir);
     }
 }
 
 void vbap2_flip_y_z(float azi, float ele, float sp_azi,
                     float sp_ele, VBAP_DATA *data) {
-    int i;
-    float tmp;
-    data->ang_dir.azi = azi;
-    data->ang_dir.ele = ele;
-    data->ang_dir.length = 1.0;
-    vec_angle_to_cart(&data->ang_dir, &data->cart_dir);
-    tmp = data->cart_dir.z;
-    data->cart_dir.z = data->cart_dir.y;
-    data->cart_dir.y = tmp;
-    for (i=0; i<data->ls_am; i++) {
-        data->gains[i] = 0.0;
-    }
-    compute_gains(data->ls_set_am, data->ls_sets, data->gains,
-                  data->ls_am, data->cart_dir, data->dimension);
-    if (data->dimension == 3) {
-        if (sp_azi > 0 || sp_ele > 0) {
-            spreadit_azi_ele_flip_y_z(azi, ele, sp_azi, sp_ele, data);
+    vbap_compute_batch(&data, &azi, &ele, &sp_azi, &sp_ele, 1, 1);
+}
+
+void vbap_compute_batch(VBAP_DATA **data, float *azi, float *ele,
+                        float *sp_azi, float *sp_ele, int num, int flip_y_z) {
+    int i, n, count;
+    float cele, x[VBAP_BATCH_SIZE], y[VBAP_BATCH_SIZE], z[VBAP_BATCH_SIZE];
+    float *py = flip_y_z ? z : y, *pz = flip_y_z ? y : z;
+    VBAP_DATA *d;
+
+    for (n=0; n<num; n+=VBAP_BATCH_SIZE) {
+        count = (num - n) < VBAP_BATCH_SIZE ? (num - n) : VBAP_BATCH_SIZE;
+
+        /* Directions of the sources in cartesian coordinates. */
+        for (i=0; i<count; i++) {
+            cele = cosf(ele[n+i] * ang_to_rad);
+            x[i] = cosf(azi[n+i] * ang_to_rad) * cele;
+            py[i] = sinf(azi[n+i] * ang_to_rad) * cele;
+            pz[i] = sinf(ele[n+i] * ang_to_rad);
         }
-    } else {
-        if (sp_azi > 0) {
-            spreadit_azi_flip_y_z(azi, sp_azi, data);
+
+        for (i=0; i<count; i++) {
+            d = data[n+i];
+            d->ang_dir.azi = azi[n+i];
+            d->ang_dir.ele = ele[n+i];
+            d->ang_dir.length = 1.0;
+            d->cart_dir.x = x[i];
+            d->cart_dir.y = y[i];
+            d->cart_dir.z = z[i];
+            spread_gains(sp_azi[n+i], sp_ele[n+i], flip_y_z, d);
         }
     }
 }
 
-/* Selects a vector base of a virtual source.
- * Calculates gain factors in that base. */
-void compute_gains(int ls_set_am, LS_SET *sets, float *gains,
-                   int ls_amount, CART_VEC cart_dir, int dim) {
-    int i, j, k, tmp2;
-    float vec[3], tmp;
-    /* Direction of the virtual source in cartesian coordinates. */
-    vec[0] = cart_dir.x;
-    vec[1] = cart_dir.y;
-    vec[2] = cart_dir.z;
+void vbap_set_spread_dirs(VBAP_DATA *data, int count) {
+    if (count < 4) { count = 4; }
+    else if (count > VBAP_MAX_SPREAD_DIRS) { count = VBAP_MAX_SPREAD_DIRS; }
+    data->spread_dirs = count / 4 * 4;
+}
 
-    for (i=0; i<ls_set_am; i++) {
-        sets[i].set_gains[0] = 0.0;
-        sets[i].set_gains[1] = 0.0;
-        sets[i].set_gains[2] = 0.0;
-        sets[i].smallest_wt  = 1000.0;
-        sets[i].neg_g_am = 0;
+/* Calculates the gain factors of a set for a direction. */
+static void compute_set_gains(LS_SET *set, float vec[3], int dim,
+                              SET_GAINS *res) {
+    int j, k;
+    res->set_gains[0] = 0.0;
+    res->set_gains[1] = 0.0;
+    res->set_gains[2] = 0.0;
+    res->smallest_wt  = 1000.0;
+    res->neg_g_am = 0;
+    for (j=0; j<dim; j++) {
+        for (k=0; k<dim; k++) {
+            res->set_gains[j] += vec[k] * set->inv_mx[((dim*j)+k)];
+        }
+        if (res->smallest_wt > res->set_gains[j])
+            res->smallest_wt = res->set_gains[j];
+        if (res->set_gains[j] < -0.05)
+            res->neg_g_am++;
     }
+}
 
-    for (i=0; i<ls_set_am; i++) {
-        for (j=0; j<dim; j++) {
-            for (k=0; k<dim; k++) {
-                sets[i].set_gains[j] += vec[k] * sets[i].inv_mx[((dim*j)+k)];
-            }
-            if (sets[i].smallest_wt > sets[i].set_gains[j])
-                sets[i].smallest_wt = sets[i].set_gains[j];
-            if (sets[i].set_gains[j] < -0.05)
-                sets[i].neg_g_am++;
-        }
+/* Keeps the best of two sets: the fewest negative gains, then the
+ * largest smallest gain. Returns 1 if `cand` replaced `best`. */
+static int select_set_gains(SET_GAINS *best, SET_GAINS *cand) {
+    if (cand->neg_g_am < best->neg_g_am ||
+        (cand->neg_g_am == best->neg_g_am &&
+         cand->smallest_wt > best->smallest_wt)) {
+        *best = *cand;
+        return 1;
     }
+    return 0;
+}
 
-    j = 0;
-    tmp = sets[0].smallest_wt;
-    tmp2 = sets[0].neg_g_am;
-    for (i=1; i<ls_set_am; i++) {
-        if (sets[i].neg_g_am < tmp2) {
-            tmp = sets[i].smallest_wt;
-            tmp2 = sets[i].neg_g_am;
+/* Selects the vector base of a direction among the candidates of its grid
+ * cell. Every set without negative gain is a candidate, so the choice is
+ * the one of the exhaustive search. Returns -1 if no candidate is free of
+ * negative gains (direction outside of the loudspeaker sets), or if the 
+ * vector is too short for the grid threshold. */
+static int grid_select_set(VBAP_LAYOUT *layout, float vec[3], SET_GAINS *best) {
+    int i, j, n, cell;
+    float len = 0.0;
+    SET_GAINS cand;
+    LS_SET_GRID *grid = layout->grid;
+
+    for (i=0; i<layout->dimension; i++)
+        len += vec[i] * vec[i];
+    if (len < (LS_SET_GRID_MIN_LENGTH * LS_SET_GRID_MIN_LENGTH))
+        return -1;
+    cell = grid_cell(grid, vec, layout->dimension);
+    if (cell < 0 || grid->offsets[cell] == grid->offsets[cell+1])
+        return -1;
+
+    j = grid->sets[grid->offsets[cell]];
+    compute_set_gains(&layout->ls_sets[j], vec, layout->dimension, best);
+    for (n=grid->offsets[cell]+1; n<grid->offsets[cell+1]; n++) {
+        i = grid->sets[n];
+        compute_set_gains(&layout->ls_sets[i], vec, layout->dimension, &cand);
+        if (select_set_gains(best, &cand))
             j = i;
-        }
-        else if (sets[i].neg_g_am == tmp2) {
-            if (sets[i].smallest_wt > tmp) {
-                tmp = sets[i].smallest_wt;
-                tmp2 = sets[i].neg_g_am;
+    }
+    return best->neg_g_am == 0 ? j : -1;
+}
+
+/* Selects the vector base of a direction and calculates its gain
+ * factors, clipped to positive values. Returns the index of the set. */
+static int select_set(VBAP_LAYOUT *layout, float vec[3], float gains[3]) {
+    int i, j, dim = layout->dimension;
+    SET_GAINS best, cand;
+    LS_SET *sets = layout->ls_sets;
+
+    j = -1;
+    if (layout->grid != NULL)
+        j = grid_select_set(layout, vec, &best);
+
+    if (j < 0) {
+        j = 0;
+        compute_set_gains(&sets[0], vec, dim, &best);
+        for (i=1; i<layout->ls_set_am; i++) {
+            compute_set_gains(&sets[i], vec, dim, &cand);
+            if (select_set_gains(&best, &cand))
                 j = i;
-            }
         }
     }
 
-    if (sets[j].set_gains[0] <= 0.0 &&
-        sets[j].set_gains[1] <= 0.0 &&
-        sets[j].set_gains[2] <= 0.0) {
+    if (best.set_gains[0] <= 0.0 &&
+        best.set_gains[1] <= 0.0 &&
+        best.set_gains[2] <= 0.0) {
 
-        sets[j].set_gains[0] = 1.0;
-        sets[j].set_gains[1] = 1.0;
-        sets[j].set_gains[2] = 1.0;
+        best.set_gains[0] = 1.0;
+        best.set_gains[1] = 1.0;
+        best.set_gains[2] = 1.0;
     }
 
-    memset(gains, 0, ls_amount * sizeof(float));
+    for (i=0; i<3; i++) {
+        gains[i] = best.set_gains[i] < 0.0 ? 0.0 : best.set_gains[i];
+    }
+    return j;
+}
 
-    gains[sets[j].ls_nos[0]-1] = sets[j].set_gains[0];
-    gains[sets[j].ls_nos[1]-1] = sets[j].set_gains[1];
-    if (dim == 3)
-        gains[sets[j].ls_nos[2]-1] = sets[j].set_gains[2];
+/* Selects a vector base of a virtual source.
+ * Calculates gain factors in that base. */
+void compute_gains(VBAP_LAYOUT *layout, float *gains, CART_VEC cart_dir) {
+    int i, j;
+    float vec[3], g[3];
 
-    for (i=0; i<ls_amount; i++) {
-        if (gains[i] < 0.0)
-            gains[i] = 0.0;
+    /* Direction of the virtual source in cartesian coordinates. */
+    vec[0] = cart_dir.x;
+    vec[1] = cart_dir.y;
+    vec[2] = cart_dir.z;
+
+    j = select_set(layout, vec, g);
+
+    memset(gains, 0, layout->ls_am * sizeof(float));
+    for (i=0; i<layout->dimension; i++) {
+        gains[layout->ls_sets[j].ls_nos[i]-1] = g[i];
     }
 }
 
 int vbap_get_triplets(VBAP_DATA *data, int ***triplets) {
-    int i, num = data->ls_set_am;
+    int i, num = data->layout->ls_set_am;
     (*triplets) = (int **)malloc(num * sizeof(int *));
     for (i=0; i<num; i++) {
         (*triplets)[i] = (int *)malloc(3 * sizeof(int));
-        (*triplets)[i][0] = data->ls_sets[i].ls_nos[0];
-        (*triplets)[i][1] = data->ls_sets[i].ls_nos[1];
-        (*triplets)[i][2] = data->ls_sets[i].ls_nos[2];
+        (*triplets)[i][0] = data->layout->ls_sets[i].ls_nos[0];
+        (*triplets)[i][1] = data->layout->ls_sets[i].ls_nos[1];
+        (*triplets)[i][2] = data->layout->ls_sets[i].ls_nos[2];
     }
     return num;
 }
@@ -7,6 +7,8 @@
 #ifndef __VBAP_H
 #define __VBAP_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus 
 extern "C" {
 #endif
@@ -14,6 +16,9 @@ extern "C" {
 #define MAX_LS_AMOUNT 256
 #define MAX_TRIPLET_AMOUNT 128
 #define MIN_VOL_P_SIDE_LGTH 0.01
+#define LS_SET_GRID_RESOLUTION 16
+#define VBAP_SPREAD_DIRS 16
+#define VBAP_MAX_SPREAD_DIRS 64
 
 typedef struct {
     int dimension;      /* Number of dimension, always 3. */
@@ -40,30 +45,47 @@ typedef struct {
 typedef struct {
     int ls_nos[3];
     float inv_mx[9];
-    float set_gains[3];
-    float smallest_wt;
-    int neg_g_am;
 } LS_SET;
 
+/* Spatial index of the loudspeaker sets. The direction space is split in
+ * cells (the faces of a cube map in 3D, slices of the circle in 2D), each
+ * one listing the sets a direction inside the cell can be panned to. */
+typedef struct {
+    int resolution;     /* Cells per cube face side (3D) or per circle (2D). */
+    int cell_am;        /* Number of cells. */
+    int *offsets;       /* First candidate of each cell (cell_am + 1). */
+    int *sets;          /* Candidate sets, ascending inside a cell. */
+} LS_SET_GRID;
+
 /* A struct for a loudspeaker instance. */
 typedef struct { 
     CART_VEC coords;
     ANG_VEC angles;
 } ls; // TODO: rename this struct.
 
-/* VBAP structure of n loudspeaker panning */
+/* Loudspeaker layout of a VBAP setup. It is never modified after its
+ * creation and is shared, with a reference count, by all the VBAP_DATA
+ * copied from the same setup. */
 typedef struct {
+    int refcount;                       /* Number of VBAP_DATA using it. */
     int out_patches[MAX_LS_AMOUNT];     /* Physical outputs (starts at 1). */
-    float gains[MAX_LS_AMOUNT];         /* Loudspeaker gains. */
-    float y[MAX_LS_AMOUNT];             /* Loudspeaker gains smoothing. */
     int dimension;                      /* Dimensions, 2 or 3. */
     LS_SET *ls_sets;                    /* Loudspeaker triplet structure. */
+    LS_SET_GRID *grid;                  /* Loudspeaker sets lookup. */
     int ls_out;                         /* Number of output patches. */
     int ls_am;                          /* Number of loudspeakers. */
     int ls_set_am;                      /* Number of triplets. */
+} VBAP_LAYOUT;
+
+/* VBAP structure of n loudspeaker panning, one per source. */
+typedef struct {
+    VBAP_LAYOUT *layout;                /* Shared loudspeaker layout. */
+    float gains[MAX_LS_AMOUNT];         /* Loudspeaker gains. */
+    float y[MAX_LS_AMOUNT];             /* Loudspeaker gains smoothing. */
     ANG_VEC ang_dir;                    /* Angular direction. */
     CART_VEC cart_dir;                  /* Cartesian direction. */
     CART_VEC spread_base;               /* Spreading vector. */
+    int spread_dirs;                    /* Spread resolution. */
 } VBAP_DATA;
 
 /* Fill a SPEAKERS_SETUP structure from values.
@@ -93,9 +115,20 @@ VBAP_DATA * init_vbap_from_speakers(ls lss[MAX_LS_AMOUNT], int count,
                                     int dim, int outputPatches[MAX_LS_AMOUNT],
                                     int maxOutputPatch, int **triplets);
 
+/* Returns a new VBAP_DATA sharing the loudspeaker layout of `data`.
+ * Copies and frees of VBAP_DATA sharing a layout must be done from
+ * the same thread.
+ */
 VBAP_DATA * copy_vbap_data(VBAP_DATA *data);
 
-/* Properly free a previously allocated VBAP_DATA structure.
+/* Makes `data` use the loudspeaker layout of `from`, keeping its direction
+ * and gains. Its previous layout is released, and freed if no other
+ * VBAP_DATA uses it.
+ */
+void vbap_share_layout(VBAP_DATA *data, VBAP_DATA *from);
+
+/* Properly free a previously allocated VBAP_DATA structure. The
+ * loudspeaker layout is released with its last VBAP_DATA.
  */
 void free_vbap_data(VBAP_DATA *data);
 
@@ -108,6 +141,34 @@ void vbap_flip_y_z(float azi, float ele, float spread, VBAP_DATA *data);
 void vbap2_flip_y_z(float azi, float ele, float sp_azi,
                     float sp_ele, VBAP_DATA *data);
 
+/* Calculates the gain factors of `num` sources at once, as vbap2 (or
+ * vbap2_flip_y_z if `flip_y_z` is not 0) would for each of them. The
+ * arrays give the position and spread of every source, the gains of
+ * source i are written in data[i]->gains. Sources moving in the same
+ * control period should be updated with a single call.
+ */
+void vbap_compute_batch(VBAP_DATA **data, float *azi, float *ele,
+                        float *sp_azi, float *sp_ele, int num, int flip_y_z);
+
+/* Sets the number of directions a source spread along one axis is panned
+ * to (a multiple of 4, up to VBAP_MAX_SPREAD_DIRS). A 3D spread along both
+ * axes uses twice as many, a 2D spread half as many. Fewer directions are
+ * cheaper, more give a smoother spread. Defaults to VBAP_SPREAD_DIRS.
+ */
+void vbap_set_spread_dirs(VBAP_DATA *data, int count);
+
+/* Writes the loudspeaker layout of `data` (sets, inverse matrices and
+ * lookup grid) in `buffer`, so it can be restored without computing the
+ * triplets again. Returns the number of bytes needed, nothing is written
+ * if `buffer` is NULL or smaller than that.
+ */
+size_t vbap_layout_serialize(VBAP_DATA *data, void *buffer, size_t size);
+
+/* Returns a new VBAP_DATA using the layout serialized in `buffer`, or NULL
+ * if the buffer does not hold a valid layout.
+ */
+VBAP_DATA * vbap_layout_deserialize(const void *buffer, size_t size);
+
 int vbap_get_triplets(VBAP_DATA *data, int ***triplets);
 
 #ifdef __cplusplus 